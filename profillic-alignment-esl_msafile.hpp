@@ -45,6 +45,7 @@ extern "C" {
 extern "C" {
 #include "esl_msa.h"
 }
+#include "profillic-profilefile.hpp"
 #undef new
 #define eslMSAFILE_PROFILLIC       98103  /* A galosh profile (from profillic)   */
 //TAH 3/12 this doesn't do what the original programmer intended.  And it fails under linux.
@@ -482,7 +483,7 @@ profillic_esl_alignment_profile_Read (ESLX_MSAFILE *afp, ESL_MSA **ret_msa, Prof
   ESL_MSA                 *msa      = NULL;
 //  string profile_string;
   char *buf;
-  long len;
+  esl_pos_t len;
   int                      seqidx;
   int                      status;
   char       errmsg2[eslERRBUFSIZE];
@@ -501,6 +502,10 @@ profillic_esl_alignment_profile_Read (ESLX_MSAFILE *afp, ESL_MSA **ret_msa, Prof
 
   afp->errmsg[0] = '\0';
 
+  // Binary galosh profiles hold a single global-transition profile, not an alignment profile.
+  if (esl_buffer_Get(afp->bf, &buf, &len) == eslOK && profillic_profilefile_IsBinary(buf, len))
+    ESL_XFAIL(eslEFORMAT, afp->errmsg, "%s is a binary galosh profile, not an alignment profile; build it with profillic-hmmbuild", afp->bf->filename);
+
   // Read in the galosh alignment profile (from profuse)
   profile_ptr->fromFile( afp->bf->filename, *profile_ptr );
   profile_ptr->normalize( 1E-5 ); //TAH 7/12 experimental mod for Robert Hubley
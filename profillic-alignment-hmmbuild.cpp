@@ -69,6 +69,8 @@ Control of E-value calibration:
   --EfL <n> : length of sequences for Forward exp tail tau fit  [100]  (n>0)
   --EfN <n> : number of sequences for Forward exp tail tau fit  [200]  (n>0)
   --Eft <x> : tail mass for Forward exponential tail tau fit  [0.04]  (0<x<1)
+  --calib-lookup <f> : interpolate E-value parameters from lookup table <f>; no simulation
+  --calib-cache <f>  : reuse, and save, simulated E-value parameters in cache file <f>
 
 Other options:
   --cpu <n>      : number of parallel CPU workers for multithreads
@@ -215,6 +217,8 @@ typedef struct {
   P7_BG	           *bg;
   P7_BUILDER       *bld;
   int                     use_priors;
+  PROFILLIC_CALIBRATION   calib;      /* --calib-lookup, --calib-cache, --seed */
+  PROFILLIC_CALIBRATION  *use_calib;  /* &calib if a table or cache was given; else NULL, to calibrate as p7_Calibrate() */
 } WORKER_INFO;
 
 #ifdef HMMER_THREADS
@@ -296,6 +300,8 @@ static ESL_OPTIONS options[] = {
   { "--EfL",     eslARG_INT,    "100", NULL,"n>0",       NULL,    NULL,      NULL, "length of sequences for Forward exp tail tau fit",     6 },   
   { "--EfN",     eslARG_INT,    "200", NULL,"n>0",       NULL,    NULL,      NULL, "number of sequences for Forward exp tail tau fit",     6 },   
   { "--Eft",     eslARG_REAL,  "0.04", NULL,"0<x<1",     NULL,    NULL,      NULL, "tail mass for Forward exponential tail tau fit",       6 },   
+  { "--calib-lookup", eslARG_INFILE, NULL, NULL, NULL,    NULL,    NULL,      NULL, "interpolate E-value parameters from lookup table <f>; no simulation", 6 },
+  { "--calib-cache", eslARG_OUTFILE, NULL, NULL, NULL,    NULL,    NULL,      NULL, "reuse, and save, simulated E-value parameters in cache file <f>", 6 },
 
 /* Other options */
 #ifdef HMMER_THREADS 
@@ -348,6 +354,9 @@ struct cfg_s {
 
   int           use_priors; /* TRUE except when esl_opt_GetBoolean(go, "--noprior") */
   int           nseq;       /* TAH 3/12 Assume the alignment profile was created from this many sequences */
+
+  PROFILLIC_CALIBTABLE *calibtable; /* --calib-lookup table, or NULL */
+  PROFILLIC_CALIBCACHE *calibcache; /* --calib-cache file, or NULL */
 };
 
 
@@ -355,6 +364,7 @@ static char usage[]  = "[-options] <hmmfile_out> <msafile>";
 static char banner[] = "profile HMM construction from multiple sequence alignments and galosh profiles";
 
 static int  profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg);
+static void profillic_open_calibration(const ESL_GETOPTS *go, struct cfg_s *cfg);
 template <class ProfileType>
 static void  profillic_serial_loop  (WORKER_INFO *info, struct cfg_s *cfg, ProfileType * profile_ptr, const ESL_GETOPTS *go);
 #ifdef HMMER_THREADS
@@ -507,6 +517,8 @@ profillic_output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
   if (esl_opt_IsUsed(go, "--EfL")        && fprintf(cfg->ofp, "# seq length for Fwd exp tau fit:   %d\n",        esl_opt_GetInteger(go, "--EfL"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--EfN")        && fprintf(cfg->ofp, "# seq number for Fwd exp tau fit:   %d\n",        esl_opt_GetInteger(go, "--EfN"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--Eft")        && fprintf(cfg->ofp, "# tail mass for Fwd exp tau fit:    %f\n",        esl_opt_GetReal(go, "--Eft"))        < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--calib-lookup") && fprintf(cfg->ofp, "# calibration lookup table:         %s\n",      esl_opt_GetString(go, "--calib-lookup")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--calib-cache")  && fprintf(cfg->ofp, "# calibration cache file:           %s\n",      esl_opt_GetString(go, "--calib-cache"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--popen")      && fprintf(cfg->ofp, "# gap open probability:            %f\n",         esl_opt_GetReal   (go, "--popen"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--pextend")    && fprintf(cfg->ofp, "# gap extend probability:          %f\n",         esl_opt_GetReal   (go, "--pextend")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--mx")         && fprintf(cfg->ofp, "# subst score matrix (built-in):   %s\n",         esl_opt_GetString (go, "--mx"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -569,6 +581,8 @@ main(int argc, char **argv)
   //TAH 4/12
   cfg.nseq       = esl_opt_GetInteger(go,"--nseq"); /* 0 by default */
   cfg.use_priors = !esl_opt_GetBoolean(go, "--noprior");
+  cfg.calibtable = NULL;
+  cfg.calibcache = NULL;
 
   if( esl_opt_IsUsed(go, "--profillic-amino")||esl_opt_IsUsed(go, "--profillic-dna") ) {
     cfg.fmt = eslMSAFILE_PROFILLIC;
@@ -629,6 +643,8 @@ main(int argc, char **argv)
     if (cfg.abc)   esl_alphabet_Destroy(cfg.abc);
     if (cfg.hmmfp) fclose(cfg.hmmfp);
   }
+  profillic_calibtable_Destroy(cfg.calibtable);
+  profillic_calibcache_Destroy(cfg.calibcache);
   esl_getopts_Destroy(go);
   esl_stopwatch_Destroy(w);
   return 0;
@@ -694,6 +710,8 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
     } 
   else cfg->postmsafp = NULL;
 
+  profillic_open_calibration(go, cfg);
+
   /* Looks like the i/o is set up successfully...
    * Initial output to the user
    */
@@ -744,6 +762,13 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
       if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
 #endif
       info[i].use_priors = cfg->use_priors;
+      info[i].calib.ncpus = 0;
+      info[i].calib.seed  = esl_opt_GetInteger(go, "--seed");
+      info[i].calib.tol   = 0.;
+      info[i].calib.table = cfg->calibtable;
+      info[i].calib.cache = cfg->calibcache;
+      info[i].calib.stamp = FALSE;
+      info[i].use_calib   = (cfg->calibtable != NULL || cfg->calibcache != NULL) ? &(info[i].calib) : NULL;
     }
 
 #ifdef HMMER_THREADS
@@ -1086,6 +1111,8 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
   int           pos;
   char          errmsg[eslERRBUFSIZE];
   ESL_SQ     *sq          = NULL;
+  PROFILLIC_CALIBRATION  calib;
+  PROFILLIC_CALIBRATION *use_calib;
 
   /* After master initialization: master broadcasts its status.
    */
@@ -1118,6 +1145,14 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
   }
 
   bg = p7_bg_Create(cfg->abc);
+  profillic_open_calibration(go, cfg);
+  calib.table = cfg->calibtable;
+  calib.cache = cfg->calibcache;
+  calib.ncpus = 0;
+  calib.seed  = esl_opt_GetInteger(go, "--seed");
+  calib.tol   = 0.;
+  calib.stamp = FALSE;
+  use_calib   = (cfg->calibtable != NULL || cfg->calibcache != NULL) ? &calib : NULL;
 
   ESL_DPRINTF2(("worker %d: initialized\n", cfg->my_rank));
 
@@ -1129,12 +1164,12 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
 
       if ( msa->nseq > 1 || cfg->abc->type != eslAMINO || !esl_opt_IsUsed(go, "--single")) {
 //TAH 2/12 for conversion to alignment profile
-    	  if ((status = profillic_p7_Builder(bld, msa, ( galosh::AlignmentProfileAccessor<seqan::Dna, floatrealspace, floatrealspace, floatrealspace> * )NULL, bg, &hmm, NULL, NULL, NULL, postmsa_ptr, cfg->use_priors)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
+    	  if ((status = profillic_p7_Builder(bld, msa, ( galosh::AlignmentProfileAccessor<seqan::Dna, floatrealspace, floatrealspace, floatrealspace> * )NULL, bg, &hmm, NULL, NULL, NULL, postmsa_ptr, cfg->use_priors, use_calib)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
       } else {
         //for protein, single sequence, use blosum matrix:
         sq = esl_sq_CreateDigital(cfg->abc);
         if ((status = esl_sq_FetchFromMSA(msa, 0, &sq)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
-        if ((status = p7_SingleBuilder(bld, sq, bg, &hmm, NULL, NULL, NULL)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
+        if ((status = profillic_p7_SingleBuilder(bld, sq, bg, &hmm, NULL, NULL, NULL, use_calib)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
         esl_sq_Destroy(sq);
         sq = NULL;
         hmm->eff_nseq = 1;
@@ -1210,12 +1245,12 @@ profillic_serial_loop(WORKER_INFO *info, struct cfg_s *cfg, ProfileType * profil
 
       /*         bg   new-HMM trarr gm   om  */
       if ( msa->nseq > 1 || (cfg->abc != NULL && cfg->abc->type != eslAMINO) || !esl_opt_IsUsed(go, "--single")) {
-        if ((status = profillic_p7_Builder(info->bld, msa, profile_ptr, info->bg, &hmm, NULL, NULL, NULL, postmsa_ptr, info->use_priors)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+        if ((status = profillic_p7_Builder(info->bld, msa, profile_ptr, info->bg, &hmm, NULL, NULL, NULL, postmsa_ptr, info->use_priors, info->use_calib)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
       } else {
         //for protein, single sequence, use blosum matrix:
         sq = esl_sq_CreateDigital(cfg->abc);
         if ((status = esl_sq_FetchFromMSA(msa, 0, &sq)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
-        if ((status = p7_SingleBuilder(info->bld, sq, info->bg, &hmm, NULL, NULL, NULL)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+        if ((status = profillic_p7_SingleBuilder(info->bld, sq, info->bg, &hmm, NULL, NULL, NULL, info->use_calib)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
         esl_sq_Destroy(sq);
         sq = NULL;
         hmm->eff_nseq = 1;
@@ -1410,7 +1445,7 @@ pipeline_thread(void *arg)
 
       if ( item->msa->nseq > 1 || info->bg->abc->type != eslAMINO || !item->force_single) {
 //TAH 2/12 for conversion to alignment profile
-        status = profillic_p7_Builder(info->bld, item->msa, ( galosh::AlignmentProfileAccessor<seqan::Dna, floatrealspace, floatrealspace,floatrealspace> * )NULL, info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors);
+        status = profillic_p7_Builder(info->bld, item->msa, ( galosh::AlignmentProfileAccessor<seqan::Dna, floatrealspace, floatrealspace,floatrealspace> * )NULL, info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors, info->use_calib);
         if (status != eslOK) p7_Fail("build failed: %s", info->bld->errbuf);
       } else {
         //for protein, single sequence, use blosum matrix:
@@ -1418,7 +1453,7 @@ pipeline_thread(void *arg)
         status = esl_sq_FetchFromMSA(item->msa, 0, &sq);
         if (status != eslOK) p7_Fail("build failed: %s", info->bld->errbuf);
 
-        status = p7_SingleBuilder(info->bld, sq, info->bg, &item->hmm, NULL, NULL, NULL);
+        status = profillic_p7_SingleBuilder(info->bld, sq, info->bg, &item->hmm, NULL, NULL, NULL, info->use_calib);
         if (status != eslOK) p7_Fail("build failed: %s", info->bld->errbuf);
 
         esl_sq_Destroy(sq);
@@ -1486,6 +1521,31 @@ output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P
 }
 
 
+/**
+ * profillic_open_calibration()
+ *
+ * With --calib-lookup, read the lookup table into <cfg->calibtable>,
+ * and check that it covers <cfg->abc>; with --calib-cache, open the
+ * cache file into <cfg->calibcache>. Each is left NULL if not asked for.
+ */
+static void
+profillic_open_calibration(const ESL_GETOPTS *go, struct cfg_s *cfg)
+{
+  char errbuf[eslERRBUFSIZE];
+
+  if (esl_opt_IsOn(go, "--calib-lookup"))
+    {
+      if (profillic_calibtable_Read(esl_opt_GetString(go, "--calib-lookup"), &(cfg->calibtable), errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+      if (profillic_calibtable_Grid(cfg->calibtable, cfg->abc->type) == NULL)
+        p7_Fail("calibration table %s has no %s grid", esl_opt_GetString(go, "--calib-lookup"), esl_abc_DecodeType(cfg->abc->type));
+    }
+  if (esl_opt_IsOn(go, "--calib-cache"))
+    {
+      if (esl_opt_GetInteger(go, "--seed") == 0) p7_Fail("--calib-cache needs a fixed --seed; with --seed 0 no two calibrations are alike");
+      if (profillic_calibcache_Open(esl_opt_GetString(go, "--calib-cache"), &(cfg->calibcache), errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+    }
+}
+
 
 /**
  * <pre> 
@@ -56,6 +56,7 @@ extern "C" {
 /* ////////////// For profillic-hmmer ////////////////////////////////// */
 /// Stuff we needed to modify in order to compile it in c++:
 #include "profillic-hmmer.hpp"
+#include "profillic-calibcache.hpp"
 #include <seqan/basic.h>
 
 // Forward declarations
@@ -429,7 +430,7 @@ static int    profillic_build_model          (P7_BUILDER *bld, ESL_MSA *msa, Pro
 static int    effective_seqnumber  (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, const P7_BG *bg);
 static int    profillic_parameterize         (P7_BUILDER *bld, P7_HMM *hmm, int const use_priors);
 static int    annotate             (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm);
-static int    calibrate            (P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om);
+static int    calibrate            (P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, const PROFILLIC_CALIBRATION *calib);
 static int    make_post_msa        (P7_BUILDER *bld, const ESL_MSA *premsa, const P7_HMM *hmm, P7_TRACE **tr, ESL_MSA **opt_postmsa);
 
 /** 
@@ -452,6 +453,8 @@ static int    make_post_msa        (P7_BUILDER *bld, const ESL_MSA *premsa, cons
  *            opt_gm      - optRETURN: profile corresponding to <hmm>
  *            opt_om      - optRETURN: optimized profile corresponding to <gm>
  *            opt_postmsa - optRETURN: RF-annotated, possibly modified MSA 
+ *            use_priors  - TRUE to parameterize with <bld->prior>
+ *            calib       - optional E-value calibration settings (NULL: as p7_Calibrate())
  *
  * Returns:   <eslOK> on success. The new HMM is optionally returned in
  *            <*opt_hmm>, along with optional returns of an array of faux tracebacks
@@ -476,7 +479,7 @@ template <class ProfileType>
 int
 profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const profile_ptr, P7_BG *bg,
 	   P7_HMM **opt_hmm, P7_TRACE ***opt_trarr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om,
-                     ESL_MSA **opt_postmsa, int const use_priors)
+                     ESL_MSA **opt_postmsa, int const use_priors, const PROFILLIC_CALIBRATION *calib = NULL)
 {
   int i,j;
   uint32_t    checksum = 0;	/* checksum calculated for the input MSA. hmmalign --mapali verifies against this. */
@@ -513,16 +516,18 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
   if ((status =  effective_seqnumber  (bld, msa, hmm, bg))              != eslOK) goto ERROR;
   if ((status =  profillic_parameterize (bld, hmm, use_priors))          != eslOK) goto ERROR;
   if ((status =  annotate             (bld, msa, hmm))                  != eslOK) goto ERROR;
-  if ((status =  calibrate            (bld, hmm, bg, opt_gm, opt_om))   != eslOK) goto ERROR;
-  if ((status =  make_post_msa        (bld, msa, hmm, tr, opt_postmsa)) != eslOK) goto ERROR;
 
   //force masked positions to background  (it'll be close already, so no relevant impact on weighting)
+  //before calibrating, so that the E-values, and any stamp, are for the parameters that are saved
   if (hmm->mm != NULL)
     for (i=1; i<hmm->M; i++ )
       if (hmm->mm[i] == 'm')
         for (j=0; j<hmm->abc->K; j++)
           hmm->mat[i][j] = bg->f[j];
 
+  if ((status =  calibrate            (bld, hmm, bg, opt_gm, opt_om, calib)) != eslOK) goto ERROR;
+  if ((status =  make_post_msa        (bld, msa, hmm, tr, opt_postmsa)) != eslOK) goto ERROR;
+
   if ( bld->abc->type == eslDNA ||  bld->abc->type == eslRNA ) {
 	  if (bld->w_len > 0)           hmm->max_length = bld->w_len;
 	  else if (bld->w_beta == 0.0)  hmm->max_length = hmm->M *4;
@@ -563,6 +568,7 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
  *            opt_hmm   - optRETURN: new HMM
  *            opt_gm    - optRETURN: profile corresponding to <hmm>
  *            opt_om    - optRETURN: optimized profile corresponding to <gm>
+ *            calib     - optional E-value calibration settings, as for profillic_p7_Builder()
  *
  * Returns:   <eslOK> on success.
  *
@@ -572,7 +578,7 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
  */
 int
 profillic_p7_SingleBuilder(P7_BUILDER *bld, ESL_SQ *sq, P7_BG *bg, P7_HMM **opt_hmm,
-		 P7_TRACE **opt_tr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om)
+		 P7_TRACE **opt_tr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, const PROFILLIC_CALIBRATION *calib = NULL)
 {
   P7_HMM   *hmm = NULL;
   P7_TRACE *tr  = NULL;
@@ -585,7 +591,7 @@ profillic_p7_SingleBuilder(P7_BUILDER *bld, ESL_SQ *sq, P7_BG *bg, P7_HMM **opt_
   if ((status = p7_Seqmodel(bld->abc, sq->dsq, sq->n, sq->name, bld->Q, bg->f, bld->popen, bld->pextend, &hmm)) != eslOK) goto ERROR;
   if ((status = p7_hmm_SetComposition(hmm))                                                                     != eslOK) goto ERROR;
   if ((status = p7_hmm_SetConsensus(hmm, sq))                                                                   != eslOK) goto ERROR; 
-  if ((status = calibrate(bld, hmm, bg, opt_gm, opt_om))                                                        != eslOK) goto ERROR;
+  if ((status = calibrate(bld, hmm, bg, opt_gm, opt_om, calib))                                                 != eslOK) goto ERROR;
 
   /* build a faux glocal trace */
   if (opt_tr != NULL) 
@@ -1434,17 +1440,19 @@ annotate(P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm)
  * 
  * Sets the E value parameters of the model with two short simulations.
  * A profile and an oprofile are created here. If caller wants to keep either
- * of them, it can pass non-<NULL> <opt_gm>, <opt_om> pointers.
+ * of them, it can pass non-<NULL> <opt_gm>, <opt_om> pointers. A non-<NULL>
+ * <calib> may replace the simulations with a lookup table or a cached
+ * calibration.
  */
 static int
-calibrate(P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om)
+calibrate(P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, const PROFILLIC_CALIBRATION *calib)
 {
   int status;
 
   if (opt_gm != NULL) *opt_gm = NULL;
   if (opt_om != NULL) *opt_om = NULL;
 
-  if ((status = p7_Calibrate(hmm, bld, &(bld->r), &bg, opt_gm, opt_om)) != eslOK) goto ERROR;
+  if ((status = profillic_Calibrate(hmm, bld, &(bld->r), &bg, opt_gm, opt_om, calib, bld->errbuf)) != eslOK) goto ERROR;
   return eslOK;
 
  ERROR:
@@ -0,0 +1,407 @@
+/**
+ * \file profillic-buildcache.hpp
+ * \brief
+ * A content-addressed on-disk cache of built HMMs (for profillic-hmmbuild)
+ * \details
+ * <pre>
+ * Table of contents:
+ *     1. PROFILLIC_BUILDCACHE: the cache directory and its option key.
+ *     2. Keys: hashing an input MSA or galosh profile.
+ *     3. Fetching and storing models.
+ *
+ * Each cached model is one binary HMM file, <dir>/<key>.h3m, where
+ * <key> is a 64-bit hash (see profillic_p7_hmm_Fingerprint()) of
+ * the input MSA or galosh profile together with every command line
+ * option that can change the built model. A model is built at most
+ * once for a given input and configuration; later runs read it back
+ * instead of building (and calibrating) it again.
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICBUILDCACHE_HPP__
+#define __GALOSH_PROFILLICBUILDCACHE_HPP__
+
+extern "C" {
+#include "p7_config.h"
+}
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+extern "C" {
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+  /// \note TAH 8/12 Workaround for C++ keyword "new" in esl_msa.h
+#define new _new
+#include "esl_msa.h"
+#undef new
+
+#include "hmmer.h"
+}
+
+#include "profillic-hmmer.hpp"
+#include "profillic-p7_hmm.hpp"
+#include <seqan/basic.h>
+
+/* Bump when anything that goes into a key, or the file layout, changes. */
+#define PROFILLIC_BUILDCACHE_VERSION 1
+
+/*****************************************************************
+ * 1. PROFILLIC_BUILDCACHE: the cache directory and its option key.
+ *****************************************************************/
+
+/**
+ * PROFILLIC_BUILDCACHE
+ *
+ * Read-only once created, so one cache may be shared by all
+ * worker threads.
+ */
+typedef struct {
+  char               *dir;	/**< cache directory                                       */
+  uint64_t            optkey;	/**< hash of the build-affecting options, alphabet, version */
+  const ESL_ALPHABET *abc;	/**< alphabet of the cached models                          */
+} PROFILLIC_BUILDCACHE;
+
+/* Options that can't change the model, and so stay out of the key. */
+static const char *profillic_buildcache_ignored[] = {
+  "-h", "-o", "-O", "--cpu", "--reorder-window", "--unordered", "--lookahead", "--mpi", "--stall", "--informat", "--cache-dir", "--calib-cache", "--w_batch", NULL
+};
+
+/* Fold in the contents of file <path>, and their length, so that a file edited in place changes the key. */
+static int
+profillic_buildcache_HashFile(PROFILLIC_XXH64 *xh, const char *path)
+{
+  FILE     *fp;
+  char      buf[4096];
+  size_t    n;
+  uint64_t  len = 0;
+  uint32_t  w[2];
+
+  if ((fp = fopen(path, "rb")) == NULL) return eslENOTFOUND;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) { profillic_xxh64_UpdateBytes(xh, buf, n); len += n; }
+  if (ferror(fp)) { fclose(fp); return eslFAIL; }
+  fclose(fp);
+
+  w[0] = (uint32_t) (len & 0xffffffffu);
+  w[1] = (uint32_t) (len >> 32);
+  profillic_xxh64_UpdateWords(xh, w, 2);
+  return eslOK;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_buildcache_Create()
+ * Synopsis:  Open (creating if need be) a build cache directory.
+ *
+ * Purpose:   Create a cache of models for alphabet <abc> in directory
+ *            <dir>, for builds configured by <go>. Every option in
+ *            <go> goes into the cache's keys except the few that only
+ *            direct output or parallelization; so a model is only
+ *            reused by a build that would have made it identically.
+ *            An input file option (a score matrix, a lookup table)
+ *            goes in by its contents as well as its name.
+ *
+ * Returns:   <eslOK> on success, and <*ret_cache> points to the new
+ *            cache. Free with <profillic_buildcache_Destroy()>.
+ *
+ *            <eslENOTFOUND> if <dir> doesn't exist and can't be
+ *            created, or an input file option's file can't be read,
+ *            with a message in <errbuf>.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_buildcache_Create(const char *dir, const ESL_GETOPTS *go, const ESL_ALPHABET *abc, PROFILLIC_BUILDCACHE **ret_cache, char *errbuf)
+{
+  PROFILLIC_BUILDCACHE *cache = NULL;
+  PROFILLIC_XXH64       xh;
+  uint32_t              hdr[2];
+  int                   i, j;
+  int                   status;
+
+  *ret_cache = NULL;
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) ESL_XFAIL(eslENOTFOUND, errbuf, "couldn't create build cache directory %s", dir);
+  if (! esl_FileExists(dir))                    ESL_XFAIL(eslENOTFOUND, errbuf, "build cache directory %s isn't accessible", dir);
+
+  ESL_ALLOC_CPP(PROFILLIC_BUILDCACHE, cache, sizeof(PROFILLIC_BUILDCACHE));
+  cache->dir = NULL;
+  cache->abc = abc;
+  if ((status = esl_strdup(dir, -1, &(cache->dir))) != eslOK) goto ERROR;
+
+  hdr[0] = PROFILLIC_BUILDCACHE_VERSION;
+  hdr[1] = (uint32_t) abc->type;
+  profillic_xxh64_Init(&xh, 0);
+  profillic_xxh64_UpdateWords(&xh, hdr, 2);
+  profillic_xxh64_UpdateString(&xh, HMMER_VERSION);
+  for (i = 0; i < go->nopts; i++)
+    {
+      for (j = 0; profillic_buildcache_ignored[j] != NULL; j++)
+        if (strcmp(go->opt[i].name, profillic_buildcache_ignored[j]) == 0) break;
+      if (profillic_buildcache_ignored[j] != NULL) continue;
+
+      profillic_xxh64_UpdateString(&xh, go->opt[i].name);
+      profillic_xxh64_UpdateString(&xh, go->val[i]);
+      if (go->opt[i].type == eslARG_INFILE && go->val[i] != NULL && profillic_buildcache_HashFile(&xh, go->val[i]) != eslOK)
+        ESL_XFAIL(eslENOTFOUND, errbuf, "couldn't read %s file %s for the build cache", go->opt[i].name, go->val[i]);
+    }
+  cache->optkey = profillic_xxh64_Digest(&xh);
+
+  *ret_cache = cache;
+  return eslOK;
+
+ ERROR:
+  if (cache != NULL) { if (cache->dir != NULL) free(cache->dir); free(cache); }
+  return status;
+}
+
+static void
+profillic_buildcache_Destroy(PROFILLIC_BUILDCACHE *cache)
+{
+  if (cache == NULL) return;
+  if (cache->dir != NULL) free(cache->dir);
+  free(cache);
+}
+
+/*****************************************************************
+ * 2. Keys: hashing an input MSA or galosh profile.
+ *****************************************************************/
+
+/* Everything in <msa> the builder reads: sequences, names (which become the model's), weights, and consensus annotation. */
+static void
+profillic_buildcache_HashMSA(PROFILLIC_XXH64 *xh, const ESL_MSA *msa)
+{
+  uint32_t hdr[3];
+  int      i;
+
+  hdr[0] = (uint32_t) msa->nseq;
+  hdr[1] = (uint32_t) msa->alen;
+  hdr[2] = (uint32_t) (msa->flags & (eslMSA_DIGITAL | eslMSA_HASWGTS));
+  profillic_xxh64_UpdateWords(xh, hdr, 3);
+
+  profillic_xxh64_UpdateString(xh, msa->name);
+  profillic_xxh64_UpdateString(xh, msa->acc);
+  profillic_xxh64_UpdateString(xh, msa->desc);
+  profillic_xxh64_UpdateString(xh, msa->rf);
+  profillic_xxh64_UpdateString(xh, msa->mm);
+  profillic_xxh64_UpdateString(xh, msa->ss_cons);
+  profillic_xxh64_UpdateString(xh, msa->sa_cons);
+  profillic_xxh64_UpdateString(xh, msa->pp_cons);
+  for (i = 0; i < eslMSA_NCUTS; i++)
+    {
+      float cut = (msa->cutset[i] ? msa->cutoff[i] : -eslINFINITY);
+      profillic_xxh64_UpdateFloats(xh, &cut, 1);
+    }
+
+  for (i = 0; i < msa->nseq; i++)
+    {
+      profillic_xxh64_UpdateString(xh, msa->sqname[i]);
+#ifdef eslAUGMENT_ALPHABET
+      if (msa->flags & eslMSA_DIGITAL) profillic_xxh64_UpdateBytes(xh, msa->ax[i] + 1, msa->alen);
+      else
+#endif
+        profillic_xxh64_UpdateBytes(xh, msa->aseq[i], msa->alen);
+      if (msa->flags & eslMSA_HASWGTS)
+        {
+          float wgt = (float) msa->wgt[i];
+          profillic_xxh64_UpdateFloats(xh, &wgt, 1);
+        }
+    }
+}
+
+/* Every parameter of a galosh profile, in the order profillic_p7_Profillicmodelmaker() reads them. */
+template <typename ProfileType>
+static void
+profillic_buildcache_HashProfile(PROFILLIC_XXH64 *xh, ProfileType const & profile)
+{
+  typedef typename galosh::profile_traits<ProfileType>::ResidueType ResidueType;
+
+  const uint32_t K = seqan::ValueSize<ResidueType>::VALUE;
+  uint32_t       hdr[2];
+  float          x[ 16 ];
+  uint32_t       pos_i;
+  uint32_t       res_i;
+
+  hdr[0] = profile.length();
+  hdr[1] = K;
+  profillic_xxh64_UpdateWords(xh, hdr, 2);
+
+  x[ 0 ]  = toDouble( profile[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toPreAlign ] );
+  x[ 1 ]  = toDouble( profile[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toBegin ] );
+  x[ 2 ]  = toDouble( profile[ galosh::Transition::fromBegin ][ galosh::TransitionFromBegin::toMatch ] );
+  x[ 3 ]  = toDouble( profile[ galosh::Transition::fromBegin ][ galosh::TransitionFromBegin::toDeletion ] );
+  x[ 4 ]  = toDouble( profile[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toMatch ] );
+  x[ 5 ]  = toDouble( profile[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toInsertion ] );
+  x[ 6 ]  = toDouble( profile[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toDeletion ] );
+  x[ 7 ]  = toDouble( profile[ galosh::Transition::fromInsertion ][ galosh::TransitionFromInsertion::toMatch ] );
+  x[ 8 ]  = toDouble( profile[ galosh::Transition::fromInsertion ][ galosh::TransitionFromInsertion::toInsertion ] );
+  x[ 9 ]  = toDouble( profile[ galosh::Transition::fromDeletion ][ galosh::TransitionFromDeletion::toMatch ] );
+  x[ 10 ] = toDouble( profile[ galosh::Transition::fromDeletion ][ galosh::TransitionFromDeletion::toDeletion ] );
+  x[ 11 ] = toDouble( profile[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toPostAlign ] );
+  x[ 12 ] = toDouble( profile[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toTerminal ] );
+  profillic_xxh64_UpdateFloats(xh, x, 13);
+
+  for( res_i = 0; res_i < K; res_i++ ) {
+    x[ 0 ] = toDouble( profile[ galosh::Emission::PreAlignInsertion ][ res_i ] );
+    x[ 1 ] = toDouble( profile[ galosh::Emission::Insertion ][ res_i ] );
+    x[ 2 ] = toDouble( profile[ galosh::Emission::PostAlignInsertion ][ res_i ] );
+    profillic_xxh64_UpdateFloats(xh, x, 3);
+  }
+  for( pos_i = 0; pos_i < profile.length(); pos_i++ ) {
+    for( res_i = 0; res_i < K; res_i++ ) {
+      x[ 0 ] = toDouble( profile[ pos_i ][ galosh::Emission::Match ][ res_i ] );
+      profillic_xxh64_UpdateFloats(xh, x, 1);
+    }
+  }
+}
+
+/**
+ * <pre>
+ * Function:  profillic_buildcache_Key()
+ * Synopsis:  Cache key for building a model from <msa> (and a profile).
+ *
+ * Purpose:   Hash <msa>, the galosh profile <*profile_ptr> (if it
+ *            isn't NULL), and the cache's option key, and return the
+ *            key in <*ret_key>. Must be called before the model is
+ *            built, because building may consume the profile.
+ *
+ * Returns:   <eslOK> on success.
+ * </pre>
+ */
+template <class ProfileType>
+static int
+profillic_buildcache_Key(const PROFILLIC_BUILDCACHE *cache, const ESL_MSA *msa, ProfileType const * const profile_ptr, uint64_t *ret_key)
+{
+  PROFILLIC_XXH64 xh;
+
+  profillic_xxh64_Init(&xh, cache->optkey);
+  profillic_buildcache_HashMSA(&xh, msa);
+  if (profile_ptr != NULL) profillic_buildcache_HashProfile(&xh, *profile_ptr);
+  *ret_key = profillic_xxh64_Digest(&xh);
+  return eslOK;
+}
+
+/* With --profillic-fused, the profile is already a count model: its fingerprint stands in for it. */
+static int
+profillic_buildcache_Key(const PROFILLIC_BUILDCACHE *cache, const ESL_MSA *msa, PROFILLIC_HMMPROFILE const * const profile_ptr, uint64_t *ret_key)
+{
+  PROFILLIC_XXH64 xh;
+  uint64_t        fp;
+  uint32_t        w[2];
+
+  profillic_xxh64_Init(&xh, cache->optkey);
+  profillic_buildcache_HashMSA(&xh, msa);
+  if (profile_ptr != NULL && profile_ptr->hmm != NULL)
+    {
+      profillic_p7_hmm_Fingerprint(profile_ptr->hmm, &fp);
+      w[0] = (uint32_t) fp;
+      w[1] = (uint32_t) (fp >> 32);
+      profillic_xxh64_UpdateWords(&xh, w, 2);
+    }
+  *ret_key = profillic_xxh64_Digest(&xh);
+  return eslOK;
+}
+
+/*****************************************************************
+ * 3. Fetching and storing models.
+ *****************************************************************/
+
+/**
+ * <pre>
+ * Function:  profillic_buildcache_Fetch()
+ * Synopsis:  Read the cached model for <key>, if there is one.
+ *
+ * Returns:   <eslOK> on a hit, and <*ret_hmm> is the model (caller
+ *            frees). <eslENOTFOUND> on a miss, or if the cached file
+ *            can't be read (it's then rebuilt and overwritten), and
+ *            <*ret_hmm> is NULL.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_buildcache_Fetch(const PROFILLIC_BUILDCACHE *cache, uint64_t key, P7_HMM **ret_hmm)
+{
+  ESL_ALPHABET *abc  = const_cast<ESL_ALPHABET *>( cache->abc );
+  P7_HMMFILE   *hfp  = NULL;
+  P7_HMM       *hmm  = NULL;
+  char         *path = NULL;
+  int           status;
+
+  *ret_hmm = NULL;
+  if ((status = esl_sprintf(&path, "%s/%016" PRIx64 ".h3m", cache->dir, key)) != eslOK) goto ERROR;
+  if (! esl_FileExists(path))                          { status = eslENOTFOUND; goto ERROR; }
+  if (p7_hmmfile_OpenE(path, NULL, &hfp, NULL) != eslOK) { status = eslENOTFOUND; goto ERROR; }
+  if (p7_hmmfile_Read(hfp, &abc, &hmm)         != eslOK) { status = eslENOTFOUND; goto ERROR; }
+
+  p7_hmmfile_Close(hfp);
+  free(path);
+  *ret_hmm = hmm;
+  return eslOK;
+
+ ERROR:
+  if (hmm  != NULL) p7_hmm_Destroy(hmm);
+  if (hfp  != NULL) p7_hmmfile_Close(hfp);
+  if (path != NULL) free(path);
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_buildcache_Store()
+ * Synopsis:  Save the model built for <key>.
+ *
+ * Purpose:   Write <hmm> to a temporary file in the cache directory
+ *            and rename it into place, so concurrent builds (threads
+ *            or whole processes sharing the directory) never see a
+ *            partial file.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEWRITE> if the model can't be saved; <eslEMEM> on
+ *            allocation failure.
+ * </pre>
+ */
+static int
+profillic_buildcache_Store(const PROFILLIC_BUILDCACHE *cache, uint64_t key, P7_HMM *hmm)
+{
+  FILE *fp     = NULL;
+  char *tmpath = NULL;
+  char *path   = NULL;
+  int   fd;
+  int   status;
+
+  if ((status = esl_sprintf(&path,   "%s/%016" PRIx64 ".h3m",        cache->dir, key)) != eslOK) goto ERROR;
+  if ((status = esl_sprintf(&tmpath, "%s/.%016" PRIx64 ".h3m.XXXXXX", cache->dir, key)) != eslOK) goto ERROR;
+
+  if ((fd = mkstemp(tmpath)) == -1)  ESL_XEXCEPTION(eslEWRITE, "couldn't create a file in build cache %s", cache->dir);
+  if ((fp = fdopen(fd, "wb")) == NULL) { close(fd); ESL_XEXCEPTION(eslEWRITE, "couldn't open a file in build cache %s", cache->dir); }
+  if ((status = p7_hmmfile_WriteBinary(fp, -1, hmm)) != eslOK) ESL_XEXCEPTION(eslEWRITE, "couldn't save model to build cache %s", cache->dir);
+  if (fclose(fp) != 0) { fp = NULL; ESL_XEXCEPTION(eslEWRITE, "couldn't save model to build cache %s", cache->dir); }
+  fp = NULL;
+  if (rename(tmpath, path) != 0)     ESL_XEXCEPTION(eslEWRITE, "couldn't move model into build cache %s", cache->dir);
+
+  free(tmpath);
+  free(path);
+  return eslOK;
+
+ ERROR:
+  if (fp     != NULL) fclose(fp);
+  if (tmpath != NULL) { remove(tmpath); free(tmpath); }
+  if (path   != NULL) free(path);
+  return status;
+}
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICBUILDCACHE_HPP__
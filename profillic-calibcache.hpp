@@ -0,0 +1,524 @@
+/**
+ * \file profillic-calibcache.hpp
+ * \brief
+ * A persistent cache of E-value calibrations (for profillic)
+ * \details
+ * <pre>
+ * Table of contents:
+ *     1. PROFILLIC_CALIBCACHE: opening and closing a cache file.
+ *     2. Keys, fetching and storing.
+ *     3. Stamps: has a model changed since it was calibrated?
+ *     4. profillic_Calibrate(): calibrating by whichever route is asked for.
+ *
+ * Simulating a model's E-value parameters is the slowest step of a
+ * build, and with a nonzero seed it is deterministic: the same model
+ * parameters, simulation settings (EmL..Eft, --calib-tol) and seed
+ * always give the same evparams (see profillic-evalues.hpp, section
+ * 2). So they are worth keeping between runs, in a text file of one
+ * line per calibration:
+ *
+ *     <key>  <evparam[0]> ... <evparam[p7_NEVPARAM-1]>
+ *
+ * where <key> is a 64-bit hash (16 hex digits) of the model's
+ * fingerprint (profillic_p7_hmm_Fingerprint()) and those settings,
+ * and each evparam is the hex bit pattern of the float, so a fetched
+ * calibration is bit-identical to a simulated one. Lines are only ever
+ * appended, each with one write(), so threads and whole processes can
+ * share one file; a line that doesn't parse (e.g. cut short by a
+ * crash) is ignored.
+ *
+ * Interpolated (--calib-lookup) calibrations are never cached, and
+ * with seed 0 nothing is, since simulations then depend on the run.
+ *
+ * With <calib->stamp> (--calib-stamp), a model calibrated here is
+ * also stamped, in its command log, with a fingerprint of its
+ * parameters as they are saved; a tool that later changes them without
+ * recalibrating leaves a stamp that no longer matches, which is how
+ * profillic-hmmcalibrate --missing-only knows to redo it.
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICCALIBCACHE_HPP__
+#define __GALOSH_PROFILLICCALIBCACHE_HPP__
+
+extern "C" {
+#include "p7_config.h"
+}
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern "C" {
+#include "easel.h"
+#include "esl_random.h"
+#include "esl_vectorops.h"
+
+#include "base/p7_bg.h"
+#include "base/p7_hmm.h"
+#include "base/p7_profile.h"
+#include "build/p7_builder.h"
+#include "build/evalues.h"
+#include "dp_vector/p7_oprofile.h"
+}
+
+#include "profillic-hmmer.hpp"
+#include "profillic-p7_hmm.hpp"
+#include "profillic-evalues.hpp"
+#include "profillic-calibtable.hpp"
+
+/* Bump when anything that goes into a key, or the line layout, changes. */
+#define PROFILLIC_CALIBCACHE_VERSION 3
+
+/* Command log line, followed by the model's fingerprint, marking the parameters it was calibrated for. */
+#define PROFILLIC_CALIBRATION_STAMP "profillic: E-value parameters calibrated for model fingerprint"
+
+/*****************************************************************
+ * 1. PROFILLIC_CALIBCACHE: opening and closing a cache file.
+ *****************************************************************/
+
+typedef struct {
+  uint64_t key;
+  float    evparam[p7_NEVPARAM];
+} PROFILLIC_CALIBCACHE_ENTRY;
+
+/**
+ * PROFILLIC_CALIBCACHE
+ *
+ * The calibrations already in the file when it was opened, sorted by
+ * key, and a descriptor to append new ones to. The entries are
+ * read-only once opened, so one cache may be shared by all worker
+ * threads; calibrations stored during a run are found by the next
+ * run, not this one.
+ */
+typedef struct profillic_calibcache_s {
+  char                       *path;	/**< the cache file                     */
+  int                         fd;	/**< open for appending                 */
+  PROFILLIC_CALIBCACHE_ENTRY *entry;	/**< calibrations read, sorted by key   */
+  int                         n;	/**< number of them                     */
+} PROFILLIC_CALIBCACHE;
+
+static int
+profillic_calibcache_cmp(const void *a, const void *b)
+{
+  uint64_t ka = ((const PROFILLIC_CALIBCACHE_ENTRY *) a)->key;
+  uint64_t kb = ((const PROFILLIC_CALIBCACHE_ENTRY *) b)->key;
+
+  return (ka < kb ? -1 : (ka > kb ? 1 : 0));
+}
+
+static void
+profillic_calibcache_Destroy(PROFILLIC_CALIBCACHE *cache)
+{
+  if (cache == NULL) return;
+  if (cache->fd    != -1)   close(cache->fd);
+  if (cache->entry != NULL) free(cache->entry);
+  if (cache->path  != NULL) free(cache->path);
+  free(cache);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibcache_Open()
+ * Synopsis:  Open (creating if need be) a calibration cache file.
+ *
+ * Purpose:   Read the calibrations in <path>, if it exists, and open
+ *            it for appending new ones; return the cache in
+ *            <*ret_cache>.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if <path> can't be opened for reading and
+ *            appending; <errbuf> says why, and <*ret_cache> is NULL.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibcache_Open(const char *path, PROFILLIC_CALIBCACHE **ret_cache, char *errbuf)
+{
+  PROFILLIC_CALIBCACHE *cache  = NULL;
+  FILE                 *fp     = NULL;
+  void                 *tmp;
+  char                  line[256];
+  uint32_t              w[p7_NEVPARAM];
+  uint64_t              key;
+  int                   nalloc = 0;
+  int                   i, pos;
+  int                   status;
+
+  *ret_cache = NULL;
+  ESL_ALLOC_CPP(PROFILLIC_CALIBCACHE, cache, sizeof(PROFILLIC_CALIBCACHE));
+  cache->path  = NULL;
+  cache->fd    = -1;
+  cache->entry = NULL;
+  cache->n     = 0;
+  if ((status = esl_strdup(path, -1, &(cache->path))) != eslOK) goto ERROR;
+
+  if ((cache->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666)) == -1)
+    ESL_XFAIL(eslENOTFOUND, errbuf, "couldn't open calibration cache %s", path);
+  if ((fp = fopen(path, "r")) == NULL)
+    ESL_XFAIL(eslENOTFOUND, errbuf, "couldn't read calibration cache %s", path);
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+    {
+      if (strchr(line, '\n') == NULL) continue; /* unterminated: a write cut short */
+      if (sscanf(line, "%" SCNx64 "%n", &key, &pos) != 1) continue;
+      for (i = 0; i < p7_NEVPARAM; i++)
+        {
+          int adv;
+          if (sscanf(line + pos, "%" SCNx32 "%n", &(w[i]), &adv) != 1) break;
+          pos += adv;
+        }
+      if (i < p7_NEVPARAM) continue;
+
+      if (cache->n == nalloc)
+        {
+          nalloc = (nalloc == 0 ? 256 : 2 * nalloc);
+          ESL_RALLOC_CPP(PROFILLIC_CALIBCACHE_ENTRY, cache->entry, tmp, sizeof(PROFILLIC_CALIBCACHE_ENTRY) * nalloc);
+        }
+      cache->entry[cache->n].key = key;
+      memcpy(cache->entry[cache->n].evparam, w, sizeof(float) * p7_NEVPARAM);
+      cache->n++;
+    }
+  fclose(fp);
+  fp = NULL;
+
+  if (cache->n > 1) qsort(cache->entry, cache->n, sizeof(PROFILLIC_CALIBCACHE_ENTRY), profillic_calibcache_cmp);
+
+  *ret_cache = cache;
+  return eslOK;
+
+ ERROR:
+  if (fp != NULL) fclose(fp);
+  profillic_calibcache_Destroy(cache);
+  return status;
+}
+
+/*****************************************************************
+ * 2. Keys, fetching and storing.
+ *****************************************************************/
+
+/**
+ * <pre>
+ * Function:  profillic_calibcache_Key()
+ * Synopsis:  Cache key for calibrating <hmm> as <cfg_b>, <calib> say.
+ *
+ * Purpose:   Hash <hmm>'s fingerprint with everything that changes
+ *            its simulated E-value parameters: the simulation lengths
+ *            and counts in <cfg_b> (p7_Calibrate()'s defaults if
+ *            NULL), <calib>'s seed and tolerance, and whether it is
+ *            sharded (<profillic_p7_Calibrate()>). Thread counts beyond
+ *            that don't change a seeded calibration, so they stay out.
+ *
+ * Returns:   <eslOK> on success, with the key in <*ret_key>.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibcache_Key(const P7_HMM *hmm, const P7_BUILDER *cfg_b, const PROFILLIC_CALIBRATION *calib, uint64_t *ret_key)
+{
+  PROFILLIC_XXH64 xh;
+  uint64_t        fp;
+  uint32_t        w[11];
+  float           x[2];
+  int             status;
+
+  if ((status = profillic_p7_hmm_Fingerprint(hmm, &fp)) != eslOK) return status;
+
+  w[0] = PROFILLIC_CALIBCACHE_VERSION;
+  w[1] = (uint32_t) fp;
+  w[2] = (uint32_t) (fp >> 32);
+  w[3] = (uint32_t) (cfg_b != NULL ? cfg_b->EmL : 200);
+  w[4] = (uint32_t) (cfg_b != NULL ? cfg_b->EmN : 200);
+  w[5] = (uint32_t) (cfg_b != NULL ? cfg_b->EvL : 200);
+  w[6] = (uint32_t) (cfg_b != NULL ? cfg_b->EvN : 200);
+  w[7] = (uint32_t) (cfg_b != NULL ? cfg_b->EfL : 100);
+  w[8] = (uint32_t) (cfg_b != NULL ? cfg_b->EfN : 200);
+  w[9] = calib->seed;
+  w[10] = (calib->seed != 0 || calib->ncpus > 1 || calib->tol > 0.) ? 1 : 0;	/* sharded (see profillic_p7_Calibrate()) */
+  x[0] = (float) (cfg_b != NULL ? cfg_b->Eft : 0.04);
+  x[1] = (float) calib->tol;
+
+  profillic_xxh64_Init(&xh, 0);
+  profillic_xxh64_UpdateWords(&xh, w, 11);
+  profillic_xxh64_UpdateFloats(&xh, x, 2);
+  *ret_key = profillic_xxh64_Digest(&xh);
+  return eslOK;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibcache_Fetch()
+ * Synopsis:  Look up the calibration cached for <key>.
+ *
+ * Purpose:   If <cache> holds a calibration for <key>, copy its
+ *            E-value parameters into <hmm>'s <evparam> and set its
+ *            <p7H_STATS> flag.
+ *
+ * Returns:   <eslOK> on a hit; <eslENOTFOUND> on a miss, with <hmm>
+ *            unchanged.
+ * </pre>
+ */
+static int
+profillic_calibcache_Fetch(const PROFILLIC_CALIBCACHE *cache, uint64_t key, P7_HMM *hmm)
+{
+  int lo = 0;
+  int hi = cache->n;		/* search [lo, hi) */
+  int mid;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if      (cache->entry[mid].key < key) lo = mid + 1;
+      else if (cache->entry[mid].key > key) hi = mid;
+      else
+        {
+          esl_vec_FCopy(cache->entry[mid].evparam, p7_NEVPARAM, hmm->evparam);
+          hmm->flags |= p7H_STATS;
+          return eslOK;
+        }
+    }
+  return eslENOTFOUND;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibcache_Store()
+ * Synopsis:  Append <hmm>'s calibration to the cache file under <key>.
+ *
+ * Purpose:   Write one line for <hmm>'s <evparam>s with a single
+ *            write() to the file opened for appending, so concurrent
+ *            writers never interleave within a line.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEWRITE> if the line can't be written.
+ * </pre>
+ */
+static int
+profillic_calibcache_Store(const PROFILLIC_CALIBCACHE *cache, uint64_t key, const P7_HMM *hmm)
+{
+  char     line[256];
+  uint32_t w;
+  int      n, i;
+
+  n = snprintf(line, sizeof(line), "%016" PRIx64, key);
+  for (i = 0; i < p7_NEVPARAM; i++)
+    {
+      memcpy(&w, &(hmm->evparam[i]), sizeof(uint32_t));
+      n += snprintf(line + n, sizeof(line) - n, " %08" PRIx32, w);
+    }
+  n += snprintf(line + n, sizeof(line) - n, "\n");
+
+  if (write(cache->fd, line, n) != n) ESL_EXCEPTION(eslEWRITE, "couldn't append to calibration cache %s", cache->path);
+  return eslOK;
+}
+
+/*****************************************************************
+ * 3. Stamps: has a model changed since it was calibrated?
+ *****************************************************************/
+
+/* Take every line starting with <prefix> out of <hmm>'s command log. */
+static void
+profillic_comlog_RemoveLines(P7_HMM *hmm, const char *prefix)
+{
+  char   *s, *eol;
+  size_t  n = strlen(prefix);
+
+  s = hmm->comlog;
+  while (s != NULL && *s != '\0')
+    {
+      eol = strchr(s, '\n');
+      if (strncmp(s, prefix, n) != 0) { s = (eol != NULL ? eol + 1 : NULL); continue; }
+
+      if      (eol != NULL)        memmove(s, eol + 1, strlen(eol + 1) + 1);
+      else if (s > hmm->comlog)    s[-1] = '\0';	/* last line: drop the newline before it too */
+      else                         s[0]  = '\0';
+      if (eol == NULL) break;
+    }
+  if (hmm->comlog != NULL && hmm->comlog[0] == '\0') { free(hmm->comlog); hmm->comlog = NULL; }
+}
+
+/* Fold in probability <p> as p7_hmmfile_WriteASCII() saves it: -logf(p) to 5 decimals, or "*" for 0.
+ * llrint() rounds half to even, as printf() does. */
+static void
+profillic_calibration_HashProb(PROFILLIC_XXH64 *xh, float p)
+{
+  int64_t  q = (p == 0.0f ? INT64_MIN : (int64_t) llrint((double) -logf(p) * 1e5));
+  uint32_t w[2];
+
+  w[0] = (uint32_t) ((uint64_t) q & 0xffffffffu);
+  w[1] = (uint32_t) ((uint64_t) q >> 32);
+  profillic_xxh64_UpdateWords(xh, w, 2);
+}
+
+/* As profillic_p7_hmm_Fingerprint(), but over the parameters as they are saved
+ * (no node 0 match emissions, and each to the writer's precision), so a model
+ * that is saved and read back keeps its fingerprint. */
+static int
+profillic_calibration_Fingerprint(const P7_HMM *hmm, uint64_t *ret_fp)
+{
+  PROFILLIC_XXH64 xh;
+  uint32_t        hdr[3];
+  int             k, x;
+
+  hdr[0] = (uint32_t) hmm->abc->type;
+  hdr[1] = (uint32_t) hmm->abc->K;
+  hdr[2] = (uint32_t) hmm->M;
+
+  profillic_xxh64_Init(&xh, 0);
+  profillic_xxh64_UpdateWords(&xh, hdr, 3);
+  for (k = 0; k <= hmm->M; k++)
+    {
+      if (k > 0) for (x = 0; x < hmm->abc->K; x++) profillic_calibration_HashProb(&xh, hmm->mat[k][x]);
+      for (x = 0; x < hmm->abc->K;      x++) profillic_calibration_HashProb(&xh, hmm->ins[k][x]);
+      for (x = 0; x < p7H_NTRANSITIONS; x++) profillic_calibration_HashProb(&xh, hmm->t[k][x]);
+    }
+  *ret_fp = profillic_xxh64_Digest(&xh);
+  return eslOK;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibration_Stamp()
+ * Synopsis:  Record in <hmm>'s command log which parameters it was calibrated for.
+ *
+ * Purpose:   Replace any calibration stamp in <hmm>'s command log
+ *            with one carrying its current fingerprint, taken over
+ *            its parameters as p7_hmmfile_WriteASCII() will save them.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibration_Stamp(P7_HMM *hmm)
+{
+  char     stamp[128];
+  uint64_t fp;
+  int      status;
+
+  if ((status = profillic_calibration_Fingerprint(hmm, &fp)) != eslOK) return status;
+  snprintf(stamp, sizeof(stamp), "%s %016" PRIx64, PROFILLIC_CALIBRATION_STAMP, fp);
+
+  profillic_comlog_RemoveLines(hmm, PROFILLIC_CALIBRATION_STAMP);
+  if (hmm->comlog != NULL && (status = esl_strcat(&(hmm->comlog), -1, "\n", 1)) != eslOK) return status;
+  return esl_strcat(&(hmm->comlog), -1, stamp, -1);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibration_IsCurrent()
+ * Synopsis:  TRUE if <hmm>'s E-value parameters can be kept as they are.
+ *
+ * Purpose:   A model's calibration is current if it has E-value
+ *            parameters (<p7H_STATS>) that are finite, with positive
+ *            lambdas; they were simulated, not interpolated from a
+ *            lookup table; and it carries a calibration stamp that
+ *            matches its parameters. A model with no stamp may have had
+ *            its parameters changed since it was calibrated (as by
+ *            profillic-hmmcopytransitions), so it is not current.
+ *
+ * Returns:   TRUE or FALSE.
+ * </pre>
+ */
+static int
+profillic_calibration_IsCurrent(const P7_HMM *hmm)
+{
+  const char *s;
+  uint64_t    fp, stamped;
+  int         i;
+
+  if (! (hmm->flags & p7H_STATS)) return FALSE;
+  for (i = 0; i < p7_NEVPARAM; i++)
+    if (! isfinite(hmm->evparam[i])) return FALSE;
+  if (hmm->evparam[p7_MLAMBDA] <= 0. || hmm->evparam[p7_VLAMBDA] <= 0. || hmm->evparam[p7_FLAMBDA] <= 0.) return FALSE;
+  if (profillic_calibtable_IsTagged(hmm)) return FALSE;
+
+  if (hmm->comlog == NULL || (s = strstr(hmm->comlog, PROFILLIC_CALIBRATION_STAMP)) == NULL) return FALSE;
+  if (sscanf(s + strlen(PROFILLIC_CALIBRATION_STAMP), " %" SCNx64, &stamped) != 1)       return FALSE;
+  if (profillic_calibration_Fingerprint(hmm, &fp) != eslOK)                             return FALSE;
+  return (fp == stamped);
+}
+
+/*****************************************************************
+ * 4. profillic_Calibrate(): calibrating by whichever route is asked for.
+ *****************************************************************/
+
+/**
+ * <pre>
+ * Function:  profillic_Calibrate()
+ * Synopsis:  Calibrate <hmm> from the cache, a lookup table, or by simulation.
+ *
+ * Purpose:   As <p7_Calibrate()>, with the same bypass conventions,
+ *            but taking the E-value parameters from <calib->cache> if
+ *            it has them for this model and these settings; else
+ *            interpolating them from <calib->table> if there is one
+ *            (see <profillic_calibtable_Calibrate()>); else simulating
+ *            them (see <profillic_p7_Calibrate()>) and, if there is a
+ *            cache, adding them to it. A model that is cached or
+ *            simulated loses any lookup table tag it had, and, if
+ *            <calib->stamp>, is stamped (see <profillic_calibration_Stamp()>).
+ *
+ *            A NULL <calib> calibrates exactly as <p7_Calibrate()>.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENORESULT> if <calib->table> has no grid for the
+ *            model's alphabet; <errbuf>, if non-NULL, says so.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslEWRITE> if the
+ *            cache can't be appended to.
+ * </pre>
+ */
+static int
+profillic_Calibrate(P7_HMM *hmm, P7_BUILDER *cfg_b, ESL_RANDOMNESS **byp_rng, P7_BG **byp_bg, P7_PROFILE **byp_gm, P7_OPROFILE **byp_om,
+                    const PROFILLIC_CALIBRATION *calib, char *errbuf)
+{
+  const PROFILLIC_CALIBCACHE *cache = (calib != NULL && calib->seed != 0 ? calib->cache : NULL);
+  P7_BG                      *bg    = NULL;
+  uint64_t                    key   = 0;
+  int                         status;
+
+  if (calib == NULL) return p7_Calibrate(hmm, cfg_b, byp_rng, byp_bg, byp_gm, byp_om);
+
+  if (cache != NULL)
+    {
+      if ((status = profillic_calibcache_Key(hmm, cfg_b, calib, &key)) != eslOK) return status;
+      if (profillic_calibcache_Fetch(cache, key, hmm) == eslOK)
+        {
+          profillic_calibtable_Untag(hmm);
+          if (calib->stamp && (status = profillic_calibration_Stamp(hmm)) != eslOK) return status;
+          calib->last.nm     = calib->last.nv     = calib->last.nf     = 0;
+          calib->last.mmu_se = calib->last.vmu_se = calib->last.tau_se = -1.;
+          if (byp_gm == NULL && byp_om == NULL) return eslOK;
+
+          if      (byp_bg != NULL && *byp_bg != NULL) bg = *byp_bg;
+          else if ((bg = p7_bg_Create(hmm->abc)) == NULL) return eslEMEM;
+          status = profillic_calibration_Profiles(hmm, bg, (cfg_b != NULL ? cfg_b->EmL : 200), byp_gm, byp_om);
+          if      (byp_bg != NULL) *byp_bg = bg;
+          else                     p7_bg_Destroy(bg);
+          return status;
+        }
+    }
+
+  if (calib->table != NULL) return profillic_calibtable_Calibrate(hmm, cfg_b, byp_bg, byp_gm, byp_om, calib, errbuf);
+
+  if ((status = profillic_p7_Calibrate(hmm, cfg_b, byp_rng, byp_bg, byp_gm, byp_om, calib)) != eslOK) return status;
+  profillic_calibtable_Untag(hmm);
+  if (calib->stamp && (status = profillic_calibration_Stamp(hmm)) != eslOK) return status;
+  if (cache != NULL) return profillic_calibcache_Store(cache, key, hmm);
+  return eslOK;
+}
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICCALIBCACHE_HPP__
@@ -0,0 +1,630 @@
+/**
+ * \file profillic-calibtable.hpp
+ * \brief
+ * Approximate E-value calibration from a precomputed lookup table (for profillic)
+ * \details
+ * <pre>
+ * Table of contents:
+ *     1. PROFILLIC_CALIBTABLE: reading, writing, and interpolating a table.
+ *     2. profillic_calibtable_Calibrate(): calibrating a model from a table.
+ *     3. Building a table from a synthetic sweep.
+ *
+ * lambda is computed from the model itself (p7_Lambda()), which is
+ * cheap; it's the MSV and Viterbi mu's and the Forward tau that need
+ * simulation. Those depend mostly on the model length M and on how
+ * informative its match states are, so a table of them over a grid of
+ * M and mean match relative entropy (p7_MeanMatchRelativeEntropy()),
+ * one grid per alphabet, predicts them well enough for interactive
+ * use. Models calibrated this way carry PROFILLIC_CALIBTABLE_TAG in
+ * their command log, so a later, full calibration can find them.
+ *
+ * A table file holds one record per alphabet:
+ *
+ *     ALPH  amino
+ *     M     25 50 100 ...
+ *     RE    0.20 0.35 0.50 ...
+ *     25  0.20  <mmu> <vmu> <tau>
+ *     25  0.35  <mmu> <vmu> <tau>
+ *     ...                            (every M, RE pair, RE varying fastest)
+ *     //
+ *
+ * with '#' comments. Interpolation is bilinear in (log M, RE), and
+ * clamped to the grid at its edges.
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICCALIBTABLE_HPP__
+#define __GALOSH_PROFILLICCALIBTABLE_HPP__
+
+extern "C" {
+#include "p7_config.h"
+}
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+extern "C" {
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_fileparser.h"
+#include "esl_random.h"
+#include "esl_vectorops.h"
+
+#include "base/p7_bg.h"
+#include "base/p7_hmm.h"
+#include "base/p7_profile.h"
+#include "build/p7_builder.h"
+#include "build/evalues.h"
+#include "dp_vector/p7_oprofile.h"
+}
+
+#include "profillic-hmmer.hpp"
+#include "profillic-evalues.hpp"
+
+/* Command log line marking a model whose mu's and tau were interpolated, not simulated. */
+#define PROFILLIC_CALIBTABLE_TAG "profillic: E-value parameters interpolated from a calibration lookup table"
+
+/*****************************************************************
+ * 1. PROFILLIC_CALIBTABLE: reading, writing, and interpolating a table.
+ *****************************************************************/
+
+/**
+ * PROFILLIC_CALIBGRID
+ *
+ * One alphabet's table: fits at every (M[i], re[j]), stored at
+ * [i*nre + j].
+ */
+typedef struct {
+  int     type;			/**< eslAMINO, eslDNA, ... */
+  int     nM, nre;
+  double *M;			/**< model lengths, ascending          */
+  double *re;			/**< mean match relative entropies, ascending */
+  double *mmu, *vmu, *tau;
+} PROFILLIC_CALIBGRID;
+
+/**
+ * PROFILLIC_CALIBTABLE
+ *
+ * A lookup table: a grid for each alphabet it covers.
+ */
+typedef struct profillic_calibtable_s {
+  PROFILLIC_CALIBGRID *grid;
+  int                  ngrid;
+} PROFILLIC_CALIBTABLE;
+
+static void
+profillic_calibgrid_Release(PROFILLIC_CALIBGRID *g)
+{
+  if (g->M   != NULL) free(g->M);
+  if (g->re  != NULL) free(g->re);
+  if (g->mmu != NULL) free(g->mmu);
+  if (g->vmu != NULL) free(g->vmu);
+  if (g->tau != NULL) free(g->tau);
+  g->M  = g->re  = g->mmu = g->vmu = g->tau = NULL;
+  g->nM = g->nre = 0;
+}
+
+/* Allocate <g>'s fit arrays, once its M and re axes are known. */
+static int
+profillic_calibgrid_Shape(PROFILLIC_CALIBGRID *g)
+{
+  int status;
+
+  ESL_ALLOC_CPP(double, g->mmu, sizeof(double) * g->nM * g->nre);
+  ESL_ALLOC_CPP(double, g->vmu, sizeof(double) * g->nM * g->nre);
+  ESL_ALLOC_CPP(double, g->tau, sizeof(double) * g->nM * g->nre);
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+static void
+profillic_calibtable_Destroy(PROFILLIC_CALIBTABLE *table)
+{
+  int i;
+
+  if (table == NULL) return;
+  for (i = 0; i < table->ngrid; i++) profillic_calibgrid_Release(&(table->grid[i]));
+  if (table->grid != NULL) free(table->grid);
+  free(table);
+}
+
+/* Read the rest of the current line as an ascending list of numbers into <*ret_x>, <*ret_n>. */
+static int
+profillic_calibtable_ReadAxis(ESL_FILEPARSER *efp, double **ret_x, int *ret_n, char *errbuf)
+{
+  double *x      = NULL;
+  void   *tmp;
+  int     n      = 0;
+  int     nalloc = 0;
+  char   *tok;
+  int     toklen;
+  int     status;
+
+  while (esl_fileparser_GetTokenOnLine(efp, &tok, &toklen) == eslOK)
+    {
+      if (n == nalloc) { nalloc = (nalloc == 0 ? 16 : 2 * nalloc); ESL_RALLOC_CPP(double, x, tmp, sizeof(double) * nalloc); }
+      x[n] = atof(tok);
+      if (n > 0 && x[n] <= x[n-1]) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: grid values must be ascending", efp->linenumber);
+      n++;
+    }
+  if (n == 0) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: empty grid axis", efp->linenumber);
+
+  *ret_x = x;
+  *ret_n = n;
+  return eslOK;
+
+ ERROR:
+  if (x != NULL) free(x);
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibtable_Read()
+ * Synopsis:  Read a calibration lookup table.
+ *
+ * Purpose:   Read the lookup table in <tablefile> (format at the top
+ *            of this file) and return it in <*ret_table>.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if the file can't be opened, and
+ *            <eslEFORMAT> on a parse error; <errbuf> says why, and
+ *            <*ret_table> is NULL.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibtable_Read(const char *tablefile, PROFILLIC_CALIBTABLE **ret_table, char *errbuf)
+{
+  PROFILLIC_CALIBTABLE *table = NULL;
+  PROFILLIC_CALIBGRID  *g     = NULL;	/* the record being read, or NULL between records */
+  ESL_FILEPARSER       *efp   = NULL;
+  void                 *tmp;
+  char                 *tok;
+  int                   toklen;
+  int                   nrow  = 0;
+  double                row[5];
+  int                   i, j, c;
+  int                   status;
+
+  *ret_table = NULL;
+  ESL_ALLOC_CPP(PROFILLIC_CALIBTABLE, table, sizeof(PROFILLIC_CALIBTABLE));
+  table->grid  = NULL;
+  table->ngrid = 0;
+
+  if (esl_fileparser_Open(tablefile, NULL, &efp) != eslOK) ESL_XFAIL(eslENOTFOUND, errbuf, "Failed to open calibration table %s", tablefile);
+  esl_fileparser_SetCommentChar(efp, '#');
+
+  while ((status = esl_fileparser_NextLine(efp)) == eslOK)
+    {
+      if (esl_fileparser_GetTokenOnLine(efp, &tok, &toklen) != eslOK) continue;
+
+      if (strcmp(tok, "ALPH") == 0)
+        {
+          if (g != NULL) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: ALPH before // ending the last record", efp->linenumber);
+          ESL_RALLOC_CPP(PROFILLIC_CALIBGRID, table->grid, tmp, sizeof(PROFILLIC_CALIBGRID) * (table->ngrid + 1));
+          g = &(table->grid[table->ngrid++]);
+          g->M  = g->re  = g->mmu = g->vmu = g->tau = NULL;
+          g->nM = g->nre = 0;
+          nrow  = 0;
+          if (esl_fileparser_GetTokenOnLine(efp, &tok, &toklen) != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: ALPH needs an alphabet", efp->linenumber);
+          if ((g->type = esl_abc_EncodeType(tok)) == eslUNKNOWN)          ESL_XFAIL(eslEFORMAT, errbuf, "line %d: unknown alphabet %s", efp->linenumber, tok);
+        }
+      else if (g == NULL) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: expected ALPH", efp->linenumber);
+      else if (strcmp(tok, "M") == 0)
+        {
+          if (g->M != NULL) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: second M line", efp->linenumber);
+          if ((status = profillic_calibtable_ReadAxis(efp, &(g->M), &(g->nM), errbuf)) != eslOK) goto ERROR;
+          if (g->M[0] < 1.) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: model lengths must be positive", efp->linenumber);
+        }
+      else if (strcmp(tok, "RE") == 0)
+        {
+          if (g->re != NULL) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: second RE line", efp->linenumber);
+          if ((status = profillic_calibtable_ReadAxis(efp, &(g->re), &(g->nre), errbuf)) != eslOK) goto ERROR;
+        }
+      else if (strcmp(tok, "//") == 0)
+        {
+          if (g->mmu == NULL || nrow != g->nM * g->nre) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: record has %d of its %d rows", efp->linenumber, nrow, g->nM * g->nre);
+          g = NULL;
+        }
+      else
+        {
+          if (g->M == NULL || g->re == NULL) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: data row before M and RE lines", efp->linenumber);
+          if (g->mmu == NULL && (status = profillic_calibgrid_Shape(g)) != eslOK) goto ERROR;
+          if (nrow == g->nM * g->nre) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: too many rows", efp->linenumber);
+
+          row[0] = atof(tok);
+          for (c = 1; c < 5; c++)
+            {
+              if (esl_fileparser_GetTokenOnLine(efp, &tok, &toklen) != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "line %d: expected M, RE, MSV mu, Viterbi mu, Forward tau", efp->linenumber);
+              row[c] = atof(tok);
+            }
+          i = nrow / g->nre;
+          j = nrow % g->nre;
+          if (fabs(row[0] - g->M[i])  > 1e-6 * g->M[i] || fabs(row[1] - g->re[j]) > 1e-6 * ESL_MAX(1., fabs(g->re[j])))
+            ESL_XFAIL(eslEFORMAT, errbuf, "line %d: expected the row for M=%g, RE=%g", efp->linenumber, g->M[i], g->re[j]);
+          g->mmu[nrow] = row[2];
+          g->vmu[nrow] = row[3];
+          g->tau[nrow] = row[4];
+          nrow++;
+        }
+    }
+  if (status != eslEOF) ESL_XFAIL(eslEFORMAT, errbuf, "failed reading calibration table %s", tablefile);
+  if (g != NULL)        ESL_XFAIL(eslEFORMAT, errbuf, "calibration table %s ends without //", tablefile);
+  if (table->ngrid == 0) ESL_XFAIL(eslEFORMAT, errbuf, "calibration table %s is empty", tablefile);
+
+  esl_fileparser_Close(efp);
+  *ret_table = table;
+  return eslOK;
+
+ ERROR:
+  if (efp != NULL) esl_fileparser_Close(efp);
+  profillic_calibtable_Destroy(table);
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibtable_Write()
+ * Synopsis:  Write one alphabet's record of a lookup table.
+ *
+ * Returns:   <eslOK> on success; <eslEWRITE> on a write failure.
+ * </pre>
+ */
+static int
+profillic_calibtable_Write(FILE *fp, const PROFILLIC_CALIBGRID *g)
+{
+  int i, j;
+
+  if (fprintf(fp, "ALPH  %s\nM    ", esl_abc_DecodeType(g->type)) < 0) return eslEWRITE;
+  for (i = 0; i < g->nM; i++)  if (fprintf(fp, " %g", g->M[i])   < 0) return eslEWRITE;
+  if (fprintf(fp, "\nRE   ") < 0) return eslEWRITE;
+  for (j = 0; j < g->nre; j++) if (fprintf(fp, " %g", g->re[j])  < 0) return eslEWRITE;
+  if (fprintf(fp, "\n# %6s %6s %10s %10s %10s\n", "M", "RE", "MSV mu", "Vit mu", "Fwd tau") < 0) return eslEWRITE;
+  for (i = 0; i < g->nM; i++)
+    for (j = 0; j < g->nre; j++)
+      if (fprintf(fp, "%8g %6g %10.4f %10.4f %10.4f\n", g->M[i], g->re[j], g->mmu[i*g->nre+j], g->vmu[i*g->nre+j], g->tau[i*g->nre+j]) < 0) return eslEWRITE;
+  if (fprintf(fp, "//\n") < 0) return eslEWRITE;
+  return eslOK;
+}
+
+/* The grid for alphabet <type>, or NULL if the table hasn't one. */
+static const PROFILLIC_CALIBGRID *
+profillic_calibtable_Grid(const PROFILLIC_CALIBTABLE *table, int type)
+{
+  int i;
+
+  for (i = 0; i < table->ngrid; i++)
+    if (table->grid[i].type == type) return &(table->grid[i]);
+  return NULL;
+}
+
+/* Bracket <x> in ascending <axis[0..n-1]>: <*ret_i> and the weight <*ret_w> on <axis[i+1]>, clamped at the ends. */
+static void
+profillic_calibtable_Bracket(const double *axis, int n, double x, double (*f)(double), int *ret_i, double *ret_w)
+{
+  int i;
+
+  if (n == 1 || x <= axis[0]) { *ret_i = 0;                 *ret_w = 0.; return; }
+  if (x >= axis[n-1])         { *ret_i = n-2;               *ret_w = 1.; return; }
+  for (i = 0; i < n-2 && x >= axis[i+1]; i++) ;
+  *ret_i = i;
+  *ret_w = (f(x) - f(axis[i])) / (f(axis[i+1]) - f(axis[i]));
+}
+
+static double profillic_calibtable_identity(double x) { return x; }
+
+/**
+ * <pre>
+ * Function:  profillic_calibtable_Lookup()
+ * Synopsis:  Interpolate the E-value fits for a model of length <M>, relative entropy <re>.
+ *
+ * Returns:   <eslOK> on success, with the MSV mu, Viterbi mu and
+ *            Forward tau in <*ret_mmu>, <*ret_vmu>, <*ret_tau>.
+ *            <eslENORESULT> if <table> has no grid for alphabet <type>.
+ * </pre>
+ */
+static int
+profillic_calibtable_Lookup(const PROFILLIC_CALIBTABLE *table, int type, int M, double re, double *ret_mmu, double *ret_vmu, double *ret_tau)
+{
+  const PROFILLIC_CALIBGRID *g = profillic_calibtable_Grid(table, type);
+  const double              *v[3];
+  double                    *ret[3];
+  double                     wm, wr;
+  int                        i, j, i1, j1, c;
+
+  if (g == NULL) return eslENORESULT;
+
+  profillic_calibtable_Bracket(g->M,  g->nM,  (double) M, log,                           &i, &wm);
+  profillic_calibtable_Bracket(g->re, g->nre, re,         profillic_calibtable_identity, &j, &wr);
+  i1 = ESL_MIN(i+1, g->nM-1);
+  j1 = ESL_MIN(j+1, g->nre-1);
+
+  v[0] = g->mmu;  ret[0] = ret_mmu;
+  v[1] = g->vmu;  ret[1] = ret_vmu;
+  v[2] = g->tau;  ret[2] = ret_tau;
+  for (c = 0; c < 3; c++)
+    *(ret[c]) = (1.-wm) * ((1.-wr) * v[c][i *g->nre+j] + wr * v[c][i *g->nre+j1])
+              +     wm  * ((1.-wr) * v[c][i1*g->nre+j] + wr * v[c][i1*g->nre+j1]);
+  return eslOK;
+}
+
+/*****************************************************************
+ * 2. profillic_calibtable_Calibrate(): calibrating a model from a table.
+ *****************************************************************/
+
+/* TRUE if <hmm> was calibrated from a lookup table, and not since by simulation. */
+static int
+profillic_calibtable_IsTagged(const P7_HMM *hmm)
+{
+  return (hmm->comlog != NULL && strstr(hmm->comlog, PROFILLIC_CALIBTABLE_TAG) != NULL);
+}
+
+/* Take the lookup tag out of <hmm>'s command log, with the newline that joined it. */
+static void
+profillic_calibtable_Untag(P7_HMM *hmm)
+{
+  char   *s;
+  size_t  n = strlen(PROFILLIC_CALIBTABLE_TAG);
+
+  while (hmm->comlog != NULL && (s = strstr(hmm->comlog, PROFILLIC_CALIBTABLE_TAG)) != NULL)
+    {
+      if      (s[n] == '\n')                      memmove(s,   s+n+1, strlen(s+n+1) + 1);
+      else if (s > hmm->comlog && s[-1] == '\n')  memmove(s-1, s+n,   strlen(s+n)   + 1);
+      else                                        memmove(s,   s+n,   strlen(s+n)   + 1);
+      if (hmm->comlog[0] == '\0') { free(hmm->comlog); hmm->comlog = NULL; }
+    }
+}
+
+static int
+profillic_calibtable_Tag(P7_HMM *hmm)
+{
+  int status;
+
+  if (profillic_calibtable_IsTagged(hmm)) return eslOK;
+  if (hmm->comlog != NULL && (status = esl_strcat(&(hmm->comlog), -1, "\n", 1)) != eslOK) return status;
+  return esl_strcat(&(hmm->comlog), -1, PROFILLIC_CALIBTABLE_TAG, -1);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibtable_Calibrate()
+ * Synopsis:  Set E-value parameters from <calib->table>, without simulation.
+ *
+ * Purpose:   As <p7_Calibrate()>, with the same bypass conventions for
+ *            <byp_bg>, <byp_gm> and <byp_om>, but interpolating the
+ *            mu's and tau from the lookup table <calib->table> by the
+ *            model's length and mean match relative entropy. The
+ *            model is tagged (PROFILLIC_CALIBTABLE_TAG) as
+ *            approximately calibrated, and <calib->last> records that
+ *            nothing was simulated.
+ *
+ *            A profile is only made if the caller asks for one.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENORESULT> if the table has no grid for the model's
+ *            alphabet; <errbuf>, if non-NULL, says so.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibtable_Calibrate(P7_HMM *hmm, P7_BUILDER *cfg_b, P7_BG **byp_bg, P7_PROFILE **byp_gm, P7_OPROFILE **byp_om,
+                               const PROFILLIC_CALIBRATION *calib, char *errbuf)
+{
+  P7_BG       *bg  = NULL;
+  int          EmL = (cfg_b != NULL ? cfg_b->EmL : 200);
+  double       lambda, mmu, vmu, tau;
+  int          status;
+
+  if      (byp_bg != NULL && *byp_bg != NULL) bg = *byp_bg;
+  else if ((bg = p7_bg_Create(hmm->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+
+  if ((status = p7_Lambda(hmm, bg, &lambda)) != eslOK) goto ERROR;
+  if (profillic_calibtable_Lookup(calib->table, hmm->abc->type, hmm->M, p7_MeanMatchRelativeEntropy(hmm, bg), &mmu, &vmu, &tau) != eslOK)
+    {
+      if (errbuf != NULL) sprintf(errbuf, "calibration table has no %s grid", esl_abc_DecodeType(hmm->abc->type));
+      status = eslENORESULT;
+      goto ERROR;
+    }
+
+  hmm->evparam[p7_MLAMBDA] = lambda;
+  hmm->evparam[p7_VLAMBDA] = lambda;
+  hmm->evparam[p7_FLAMBDA] = lambda;
+  hmm->evparam[p7_MMU]     = mmu;
+  hmm->evparam[p7_VMU]     = vmu;
+  hmm->evparam[p7_FTAU]    = tau;
+  hmm->flags              |= p7H_STATS;
+  if ((status = profillic_calibtable_Tag(hmm)) != eslOK) goto ERROR;
+
+  calib->last.nm     = calib->last.nv     = calib->last.nf     = 0;
+  calib->last.mmu_se = calib->last.vmu_se = calib->last.tau_se = -1.;
+
+  if ((status = profillic_calibration_Profiles(hmm, bg, EmL, byp_gm, byp_om)) != eslOK) goto ERROR;
+
+  if (byp_bg != NULL) *byp_bg = bg; else p7_bg_Destroy(bg);
+  return eslOK;
+
+ ERROR:
+  if (! (byp_bg != NULL && *byp_bg == bg) && bg != NULL) p7_bg_Destroy(bg);
+  return status;
+}
+
+/*****************************************************************
+ * 3. Building a table from a synthetic sweep.
+ *****************************************************************/
+
+/* Synthetic models at each grid point; their fits are averaged. */
+#define PROFILLIC_CALIBTABLE_NREP 3
+
+/* Default sweep grid. */
+static const double profillic_calibtable_defaultM[]  = { 25, 50, 100, 200, 400, 800, 1600 };
+static const double profillic_calibtable_defaultRE[] = { 0.20, 0.35, 0.50, 0.65, 0.80, 1.00, 1.25 };
+
+/* Mean match relative entropy of <hmm> with match emissions tilted to bg_a (mat0_ka/bg_a)^t, left in <hmm>. */
+static double
+profillic_calibtable_Tilt(P7_HMM *hmm, float **mat0, const P7_BG *bg, double t)
+{
+  int k, a;
+
+  for (k = 1; k <= hmm->M; k++)
+    {
+      for (a = 0; a < hmm->abc->K; a++)
+        hmm->mat[k][a] = bg->f[a] * pow(mat0[k][a] / bg->f[a], t);
+      esl_vec_FNorm(hmm->mat[k], hmm->abc->K);
+    }
+  return p7_MeanMatchRelativeEntropy(hmm, bg);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibtable_SampleModel()
+ * Synopsis:  Sample a synthetic model of length <M> and mean match relative entropy <re>.
+ *
+ * Purpose:   Sample match emissions with <p7_hmm_Sample()>, then tilt
+ *            them towards or away from the background, by bisection,
+ *            until the mean match relative entropy is <re> (or as
+ *            close as the sample allows). Transitions are set to
+ *            typical built-model values, and insert emissions to the
+ *            background, so that M and <re> are what varies.
+ *
+ * Returns:   <eslOK> on success, and the model in <*ret_hmm>.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibtable_SampleModel(ESL_RANDOMNESS *r, int M, const ESL_ALPHABET *abc, const P7_BG *bg, double re, P7_HMM **ret_hmm)
+{
+  P7_HMM  *hmm  = NULL;
+  float  **mat0 = NULL;
+  double   lo = 0., hi = 1., mid;
+  int      k, it;
+  int      status;
+
+  if ((status = p7_hmm_Sample(r, M, abc, &hmm)) != eslOK) goto ERROR;
+
+  for (k = 0; k <= M; k++)
+    {
+      hmm->t[k][p7H_MM] = 0.96;  hmm->t[k][p7H_MI] = 0.02;  hmm->t[k][p7H_MD] = 0.02;
+      hmm->t[k][p7H_IM] = 0.60;  hmm->t[k][p7H_II] = 0.40;
+      hmm->t[k][p7H_DM] = 0.60;  hmm->t[k][p7H_DD] = 0.40;
+      esl_vec_FCopy(bg->f, abc->K, hmm->ins[k]);
+    }
+  hmm->t[0][p7H_DM] = 1.0;  hmm->t[0][p7H_DD] = 0.0;	/* there's no D_0 */
+  hmm->t[M][p7H_MM] = 0.98; hmm->t[M][p7H_MD] = 0.0;	/* nor a D_M+1 */
+  hmm->t[M][p7H_DM] = 1.0;  hmm->t[M][p7H_DD] = 0.0;
+
+  ESL_ALLOC_CPP(float *, mat0, sizeof(float *) * (M+1));
+  for (k = 0; k <= M; k++) mat0[k] = NULL;
+  for (k = 1; k <= M; k++)
+    {
+      ESL_ALLOC_CPP(float, mat0[k], sizeof(float) * abc->K);
+      esl_vec_FCopy(hmm->mat[k], abc->K, mat0[k]);
+    }
+
+  /* relative entropy rises with the tilt t >= 0 (t=0 is the background) */
+  while (hi < 64. && profillic_calibtable_Tilt(hmm, mat0, bg, hi) < re) { lo = hi; hi *= 2.; }
+  for (it = 0; it < 40; it++)
+    {
+      mid = 0.5 * (lo + hi);
+      if (profillic_calibtable_Tilt(hmm, mat0, bg, mid) < re) lo = mid; else hi = mid;
+    }
+  profillic_calibtable_Tilt(hmm, mat0, bg, hi);
+  if ((status = p7_hmm_SetConsensus(hmm, NULL)) != eslOK) goto ERROR;
+
+  for (k = 1; k <= M; k++) free(mat0[k]);
+  free(mat0);
+  *ret_hmm = hmm;
+  return eslOK;
+
+ ERROR:
+  if (mat0 != NULL) { for (k = 1; k <= M; k++) if (mat0[k] != NULL) free(mat0[k]); free(mat0); }
+  if (hmm  != NULL) p7_hmm_Destroy(hmm);
+  *ret_hmm = NULL;
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_calibtable_Sweep()
+ * Synopsis:  Build one alphabet's lookup table by simulation.
+ *
+ * Purpose:   For each of the <nM> model lengths <M> and <nre>
+ *            relative entropies <re>, calibrate
+ *            PROFILLIC_CALIBTABLE_NREP synthetic models with
+ *            <profillic_p7_Calibrate()> under <cfg_b> and <calib>,
+ *            and store their mean fits in <g>. Models are sampled
+ *            from <r>. If <ofp> is non-NULL, a progress line is
+ *            written to it per grid point.
+ *
+ * Returns:   <eslOK> on success; <g> is filled in, and should be
+ *            released with <profillic_calibgrid_Release()>.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibtable_Sweep(ESL_RANDOMNESS *r, const ESL_ALPHABET *abc, const double *M, int nM, const double *re, int nre,
+                           P7_BUILDER *cfg_b, const PROFILLIC_CALIBRATION *calib, FILE *ofp, PROFILLIC_CALIBGRID *g)
+{
+  P7_BG          *bg  = NULL;
+  P7_HMM         *hmm = NULL;
+  ESL_RANDOMNESS *cr  = NULL;	/* calibration RNG, when <calib> doesn't derive its own streams */
+  int             i, j, n, x;
+  int             status;
+
+  g->type = abc->type;
+  g->nM   = nM;
+  g->nre  = nre;
+  g->M    = g->re = g->mmu = g->vmu = g->tau = NULL;
+  ESL_ALLOC_CPP(double, g->M,  sizeof(double) * nM);
+  ESL_ALLOC_CPP(double, g->re, sizeof(double) * nre);
+  esl_vec_DCopy(M,  nM,  g->M);
+  esl_vec_DCopy(re, nre, g->re);
+  if ((status = profillic_calibgrid_Shape(g)) != eslOK) goto ERROR;
+
+  if ((bg = p7_bg_Create(abc))                                                == NULL) { status = eslEMEM; goto ERROR; }
+  if ((cr = esl_randomness_CreateFast(1 + esl_rnd_Roll(r, 2147483646)))       == NULL) { status = eslEMEM; goto ERROR; }
+
+  for (i = 0; i < nM; i++)
+    for (j = 0; j < nre; j++)
+      {
+        x = i * nre + j;
+        g->mmu[x] = g->vmu[x] = g->tau[x] = 0.;
+        for (n = 0; n < PROFILLIC_CALIBTABLE_NREP; n++)
+          {
+            if ((status = profillic_calibtable_SampleModel(r, (int) M[i], abc, bg, re[j], &hmm)) != eslOK) goto ERROR;
+            if ((status = profillic_p7_Calibrate(hmm, cfg_b, &cr, &bg, NULL, NULL, calib))     != eslOK) goto ERROR;
+            g->mmu[x] += hmm->evparam[p7_MMU]  / PROFILLIC_CALIBTABLE_NREP;
+            g->vmu[x] += hmm->evparam[p7_VMU]  / PROFILLIC_CALIBTABLE_NREP;
+            g->tau[x] += hmm->evparam[p7_FTAU] / PROFILLIC_CALIBTABLE_NREP;
+            p7_hmm_Destroy(hmm);
+            hmm = NULL;
+          }
+        if (ofp != NULL) fprintf(ofp, "# M=%-6g RE=%-5g  MSV mu %8.4f  Vit mu %8.4f  Fwd tau %8.4f\n", M[i], re[j], g->mmu[x], g->vmu[x], g->tau[x]);
+      }
+
+  p7_bg_Destroy(bg);
+  esl_randomness_Destroy(cr);
+  return eslOK;
+
+ ERROR:
+  if (hmm != NULL) p7_hmm_Destroy(hmm);
+  if (bg  != NULL) p7_bg_Destroy(bg);
+  if (cr  != NULL) esl_randomness_Destroy(cr);
+  profillic_calibgrid_Release(g);
+  return status;
+}
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICCALIBTABLE_HPP__
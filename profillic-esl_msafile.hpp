@@ -29,11 +29,17 @@ extern "C" {
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+
+#include <vector>
 
 extern "C" {
 #include "easel.h"
 #include "esl_mem.h"
 #include "esl_msafile.h"
+#ifdef HAVE_PTHREAD
+#include "esl_threads.h"
+#endif
 #ifdef eslAUGMENT_ALPHABET
 #include "esl_alphabet.h"
 #endif
@@ -46,6 +52,9 @@ extern "C" {
 extern "C" {
 #include "esl_msa.h"
 }
+#include "profillic-profilefile.hpp"
+#include "profillic-p7_hmm.hpp"
+#include "profillic-residuemap.hpp"
 #undef new
 #define eslMSAFILE_PROFILLIC       98103  /* A galosh profile (from profillic)   */
 #define PRId64 "d"
@@ -62,6 +71,9 @@ template <typename ProfileType>
 static int
 profillic_esl_msafile_profile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, ProfileType * profile_ptr );
 
+static int
+profillic_esl_msafile_profile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, PROFILLIC_HMMPROFILE * profile_ptr );
+
 /* /////////////// End profillic-hmmer ////////////////////////////////// */
 
 
@@ -429,6 +441,833 @@ profillic_eslx_msafile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, ProfileType *
  * 12.5. galosh profile format (from profilic)
  *****************************************************************/
 
+/**
+ * <pre>
+ * Function:  profillic_profile_comment_GetName()
+ * Synopsis:  Look for a "name=<token>" pair in a profile comment line.
+ *
+ * Purpose:   Scan comment line <p> of length <n> (not NUL-terminated)
+ *            for a whitespace-delimited "name=<token>" pair. If found,
+ *            return a newly allocated copy of <token> in <*ret_name>;
+ *            otherwise leave <*ret_name> untouched.
+ *
+ * Returns:   <eslOK> on success (found or not).
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_profile_comment_GetName(char *p, esl_pos_t n, char **ret_name)
+{
+  char     *tok;
+  esl_pos_t toklen;
+
+  while (esl_memtok(&p, &n, " \t\r#", &tok, &toklen) == eslOK)
+    if (toklen > 5 && esl_memstrpfx(tok, toklen, "name="))
+      return esl_memstrdup(tok+5, toklen-5, ret_name);
+  return eslOK;
+}
+
+/**
+ * PROFILLIC_PROFILE_MARKS
+ *
+ * Line-aligned split points in a text profile record, noted by
+ * profillic_profile_ScanRecord() every <PROFILLIC_PROFILE_MARKEVERY>
+ * positions, so that the record can be parsed in chunks without
+ * first counting the positions before each chunk.
+ */
+#define PROFILLIC_PROFILE_MARKEVERY  4096
+
+typedef struct {
+  esl_pos_t *off;		/**< offset of a position line from the record's start */
+  uint32_t  *pos;		/**< index of the position on that line                */
+  int64_t   *line;		/**< its line number                                   */
+  int        n;
+  int        nalloc;
+} PROFILLIC_PROFILE_MARKS;
+
+static void
+profillic_profile_marks_Release(PROFILLIC_PROFILE_MARKS *marks)
+{
+  if (marks->off)  free(marks->off);
+  if (marks->pos)  free(marks->pos);
+  if (marks->line) free(marks->line);
+  marks->off    = NULL;
+  marks->pos    = NULL;
+  marks->line   = NULL;
+  marks->n      = marks->nalloc = 0;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ScanRecord()
+ * Synopsis:  Find the extent of the next galosh profile record.
+ *
+ * Purpose:   Read lines from <afp> up to the next "//" line or EOF,
+ *            and return the record they make up as a span of
+ *            <*ret_n> bytes at <*ret_p>, in the memory of <afp->bf>
+ *            itself. Also return the number of position ("M:") lines
+ *            in <*ret_npos>, the line number of the record's first
+ *            line in <*ret_line0>, and the first "name=<token>" found
+ *            in its comments in <*ret_name> (if any; caller frees).
+ *
+ *            If <opt_marks> is non-NULL, split points for a chunked
+ *            parse are appended to it (see <PROFILLIC_PROFILE_MARKS>);
+ *            caller releases them.
+ *
+ *            The buffer is anchored at the record's start so the span
+ *            stays valid; <*ret_start> gets the anchored offset, and
+ *            the caller releases it with
+ *            <esl_buffer_RaiseAnchor(afp->bf, *ret_start)> once done
+ *            with the bytes.
+ *
+ * Returns:   <eslOK> on success; <afp> is poised after the "//", or
+ *            at EOF.
+ *
+ *            <eslEOF> if there's no more record content (only blank
+ *            or comment lines) in <afp>. No anchor is left set.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> on read
+ *            failure. No anchor is left set.
+ * </pre>
+ */
+static int
+profillic_profile_ScanRecord(ESLX_MSAFILE *afp, esl_pos_t *ret_start, const char **ret_p, esl_pos_t *ret_n, uint32_t *ret_npos, int64_t *ret_line0, char **ret_name,
+                             PROFILLIC_PROFILE_MARKS *opt_marks = NULL)
+{
+  void     *tmp;
+  esl_pos_t start    = esl_buffer_GetOffset(afp->bf);
+  esl_pos_t end;
+  int64_t   line0    = afp->linenumber + 1;
+  char     *name     = NULL;
+  uint32_t  npos     = 0;
+  int       ncontent = 0;
+  char     *p;
+  esl_pos_t n;
+  esl_pos_t idx;
+  int       status;
+
+  if ((status = esl_buffer_SetAnchor(afp->bf, start)) != eslOK) return status;
+
+  for (;;)
+    {
+      end = esl_buffer_GetOffset(afp->bf);
+      if ((status = eslx_msafile_GetLine(afp, &p, &n)) != eslOK) break;
+
+      idx = esl_memspn(p, n, " \t\r");
+      if (n - idx >= 2 && esl_memstrpfx(p+idx, n-idx, "//")) break;
+      if (idx == n) continue;	/* blank line */
+      if (p[idx] == '#')
+        { 
+          if (name == NULL && (status = profillic_profile_comment_GetName(p+idx, n-idx, &name)) != eslOK) goto ERROR;
+          continue;
+        }
+      ncontent++;
+      if (! esl_memstrcontains(p+idx, esl_memcspn(p+idx, n-idx, "#"), "M:")) continue;
+
+      if (opt_marks != NULL && npos > 0 && npos % PROFILLIC_PROFILE_MARKEVERY == 0)
+        {
+          if (opt_marks->n == opt_marks->nalloc)
+            {
+              opt_marks->nalloc = (opt_marks->nalloc ? opt_marks->nalloc * 2 : 64);
+              ESL_RALLOC_CPP(esl_pos_t, opt_marks->off,  tmp, sizeof(esl_pos_t) * opt_marks->nalloc);
+              ESL_RALLOC_CPP(uint32_t,  opt_marks->pos,  tmp, sizeof(uint32_t)  * opt_marks->nalloc);
+              ESL_RALLOC_CPP(int64_t,   opt_marks->line, tmp, sizeof(int64_t)   * opt_marks->nalloc);
+            }
+          opt_marks->off [opt_marks->n] = end - start;
+          opt_marks->pos [opt_marks->n] = npos;
+          opt_marks->line[opt_marks->n] = afp->linenumber;
+          opt_marks->n++;
+        }
+      npos++;
+    }
+  if (status != eslOK && status != eslEOF) goto ERROR;
+  if (ncontent == 0) { status = eslEOF; goto ERROR; }
+
+  *ret_start = start;
+  *ret_p     = afp->bf->mem + (start - afp->bf->baseoffset);
+  *ret_n     = end - start;
+  *ret_npos  = npos;
+  *ret_line0 = line0;
+  if (name != NULL) { if (*ret_name == NULL) *ret_name = name; else free(name); }
+  return eslOK;
+
+ ERROR:
+  esl_buffer_RaiseAnchor(afp->bf, start);
+  if (name != NULL) free(name);
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ParseFloat()
+ * Synopsis:  Parse one decimal floating point number from memory.
+ *
+ * Purpose:   Parse a number such as "0.9805369" or "5.045593e-06"
+ *            starting at <*ip>, reading no further than <end>, and
+ *            return it in <*ret_x>. <*ip> is advanced past the number.
+ *
+ *            Numbers with at most 15 significant digits and a decimal
+ *            exponent of magnitude at most 22 (everything galosh
+ *            writes) are converted exactly with a single multiply or
+ *            divide by a power of ten; anything else, including
+ *            "inf" and "nan", falls back to <strtod()> on a bounded
+ *            copy. The memory need not be NUL-terminated.
+ *
+ * Returns:   <eslOK> on success; <eslEFORMAT> if no number is found.
+ * </pre>
+ */
+static int
+profillic_profile_ParseFloat(const char **ip, const char *end, double *ret_x)
+{
+  static const double pow10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                  1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                  1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char *s        = *ip;
+  uint64_t    mant     = 0;
+  int         ndig     = 0;	/* significant digits accumulated in <mant> */
+  int         nseen    = 0;	/* all digits seen in the mantissa          */
+  int         exp10    = 0;
+  int         eval     = 0;
+  int         neg      = FALSE;
+  int         eneg     = FALSE;
+  double      x;
+  char        buf[64];
+  char       *ep;
+
+  if (s < end && (*s == '-' || *s == '+')) { neg = (*s == '-'); s++; }
+  for (; s < end && isdigit((unsigned char) *s); s++, nseen++)
+    {
+      if (ndig || *s != '0') { if (ndig < 19) mant = mant * 10 + (*s - '0'); else exp10++; ndig++; }
+    }
+  if (s < end && *s == '.')
+    for (s++; s < end && isdigit((unsigned char) *s); s++, nseen++)
+      {
+        if (ndig || *s != '0') { if (ndig < 19) { mant = mant * 10 + (*s - '0'); exp10--; } ndig++; }
+        else exp10--;
+      }
+  if (nseen && s < end && (*s == 'e' || *s == 'E'))
+    {
+      const char *t = s+1;
+      if (t < end && (*t == '-' || *t == '+')) { eneg = (*t == '-'); t++; }
+      if (t < end && isdigit((unsigned char) *t))
+        {
+          for (; t < end && isdigit((unsigned char) *t); t++) if (eval < 10000) eval = eval * 10 + (*t - '0');
+          exp10 += (eneg ? -eval : eval);
+          s = t;
+        }
+    }
+
+  if (nseen && ndig <= 15 && exp10 >= -22 && exp10 <= 22)
+    {
+      x = (double) mant;
+      x = (exp10 < 0) ? x / pow10[-exp10] : x * pow10[exp10];
+      *ret_x = (neg ? -x : x);
+      *ip    = s;
+      return eslOK;
+    }
+
+  /* Slow path: long mantissas, big exponents, inf/nan. */
+  s = *ip;
+  if (end - s > (esl_pos_t) sizeof(buf) - 1) end = s + sizeof(buf) - 1;
+  memcpy(buf, s, end - s);
+  buf[end - s] = '\0';
+  x = strtod(buf, &ep);
+  if (ep == buf) return eslEFORMAT;
+  *ret_x = x;
+  *ip    = s + (ep - buf);
+  return eslOK;
+}
+
+/* Bit for the global group <tag>-> (arrow) or <tag>: in a "seen" mask. */
+#define PROFILLIC_PROFILE_GROUPBIT(tag, arrow) ((uint64_t) 1 << (((tag) & 0x1f) + ((arrow) ? 0 : 32)))
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ParseLine()
+ * Synopsis:  Tokenize one line of a galosh profile record.
+ *
+ * Purpose:   Parse one line <p> of length <n> (not NUL-terminated) of
+ *            the galosh profile text format, delivering its values to
+ *            <sink>. A line is either blank, a '#' comment, or a
+ *            bracketed list of groups with an optional trailing
+ *            comment:
+ *
+ *              [ M:(A=..,C=..), M->(M=..,I=..,D=..), I:(A=..), ... ]
+ *
+ *            "M:" groups are the match emissions of position <*pos>;
+ *            a line holding one is a profile position, and <*pos> is
+ *            incremented. "I:" groups are insertion emissions, and
+ *            "<X>->" groups the transitions out of state <X>. These
+ *            are global to the profile: the first line carrying a
+ *            given group supplies its values, and the repeats that
+ *            per-position files (e.g. blort.profile) write on later
+ *            lines are checked for syntax but not delivered. <*seen>
+ *            is a bitmask of the global groups already delivered.
+ *
+ *            <sink> provides <Match(pos, residue, x)>,
+ *            <Insertion(residue, x)> and <Transition(from, to, x)>,
+ *            each returning <eslOK>, or <eslEFORMAT> for a key it
+ *            doesn't recognize.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEFORMAT> on a parse error, with a message in <errbuf>.
+ * </pre>
+ */
+template <typename Sink>
+static int
+profillic_profile_ParseLine(const char *p, esl_pos_t n, uint32_t *pos, uint64_t *seen, Sink &sink, char *errbuf)
+{
+  const char *s       = p;
+  const char *end     = p + n;
+  uint64_t    lineset = 0;
+  int         has_match = FALSE;
+  char        tag;
+  char        key;
+  int         arrow;
+  int         deliver;
+  double      x;
+  int         status;
+
+  while (s < end && isspace((unsigned char) *s)) s++;
+  if (s == end || *s == '#') return eslOK;
+  if (*s++ != '[') ESL_FAIL(eslEFORMAT, errbuf, "expected '[' at start of profile line");
+
+  for (;;)
+    {
+      while (s < end && isspace((unsigned char) *s)) s++;
+      if (s == end) ESL_FAIL(eslEFORMAT, errbuf, "profile line ends before closing ']'");
+      if (*s == ']') { s++; break; }
+
+      tag = *s++;
+      if      (s < end   && *s == ':')                 { arrow = FALSE; s += 1; }
+      else if (end-s > 1 && s[0] == '-' && s[1] == '>') { arrow = TRUE;  s += 2; }
+      else ESL_FAIL(eslEFORMAT, errbuf, "expected ':' or '->' after group tag '%c'", tag);
+      if (s == end || *s++ != '(') ESL_FAIL(eslEFORMAT, errbuf, "expected '(' after group tag '%c'", tag);
+
+      if (! arrow && tag == 'M')
+        {
+          if (has_match) ESL_FAIL(eslEFORMAT, errbuf, "more than one M: group on a profile line");
+          has_match = deliver = TRUE;
+        }
+      else if (! arrow && tag != 'I') ESL_FAIL(eslEFORMAT, errbuf, "unrecognized emission group '%c:'", tag);
+      else 
+        {
+          deliver  = ! (*seen & PROFILLIC_PROFILE_GROUPBIT(tag, arrow));
+          lineset |= PROFILLIC_PROFILE_GROUPBIT(tag, arrow);
+        }
+
+      for (;;)
+        {
+          while (s < end && isspace((unsigned char) *s)) s++;
+          if (s == end) ESL_FAIL(eslEFORMAT, errbuf, "group '%c' not closed", tag);
+          key = *s++;
+          while (s < end && isspace((unsigned char) *s)) s++;
+          if (s == end || *s++ != '=') ESL_FAIL(eslEFORMAT, errbuf, "expected '=' after key '%c' in group '%c'", key, tag);
+          if (profillic_profile_ParseFloat(&s, end, &x) != eslOK) ESL_FAIL(eslEFORMAT, errbuf, "bad value for key '%c' in group '%c'", key, tag);
+
+          if (deliver)
+            {
+              if      (arrow)      status = sink.Transition(tag, key, x);
+              else if (tag == 'M') status = sink.Match(*pos, key, x);
+              else                 status = sink.Insertion(key, x);
+              if (status != eslOK) ESL_FAIL(eslEFORMAT, errbuf, "unrecognized key '%c' in group '%c%s'", key, tag, arrow ? "->" : ":");
+            }
+
+          while (s < end && isspace((unsigned char) *s)) s++;
+          if (s < end && *s == ',') { s++; continue; }
+          if (s < end && *s == ')') { s++; break;    }
+          ESL_FAIL(eslEFORMAT, errbuf, "expected ',' or ')' in group '%c'", tag);
+        }
+
+      while (s < end && isspace((unsigned char) *s)) s++;
+      if (s < end && *s == ',') s++;
+    }
+
+  while (s < end && isspace((unsigned char) *s)) s++;
+  if (s < end && *s != '#') ESL_FAIL(eslEFORMAT, errbuf, "unexpected text after closing ']'");
+
+  *seen |= lineset;
+  if (has_match) (*pos)++;
+  return eslOK;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ParseRecord()
+ * Synopsis:  Parse a whole galosh profile record held in memory.
+ *
+ * Purpose:   Parse the <npos>-position profile record <p> of length
+ *            <n> bytes, one line at a time, into <sink>. <sink.Begin(npos)>
+ *            is called first, so the sink can size itself once, and
+ *            <sink.End()> after the last line.
+ *            The bytes are used in place: for an mmap'ed
+ *            <ESL_BUFFER> they are the file itself.
+ *
+ *            <*linenumber> is the line number of the first line on
+ *            input; on a parse error it is set to the offending line.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEFORMAT> on a parse error, or if the number of
+ *            position lines isn't <npos>; <errbuf> is set.
+ *
+ * Throws:    <eslEMEM> if the sink fails to allocate.
+ * </pre>
+ */
+template <typename Sink>
+static int
+profillic_profile_ParseRecord(const char *p, esl_pos_t n, uint32_t npos, Sink &sink, int64_t *linenumber, char *errbuf)
+{
+  const char *end  = p + n;
+  const char *eol;
+  uint32_t    pos  = 0;
+  uint64_t    seen = 0;
+  int         status;
+
+  if ((status = sink.Begin(npos)) != eslOK) return status;
+
+  for (; p < end; p = eol + 1, (*linenumber)++)
+    {
+      if ((eol = static_cast<const char *>( memchr(p, '\n', end - p) )) == NULL) eol = end;
+      if ((status = profillic_profile_ParseLine(p, eol - p, &pos, &seen, sink, errbuf)) != eslOK) return status;
+      if (pos > npos) break;
+    }
+  if (pos != npos) ESL_FAIL(eslEFORMAT, errbuf, "expected %u profile positions, parsed %u", npos, pos);
+  return sink.End();
+}
+
+/**
+ * profillic_profiletree_sink_s
+ *
+ * Sink for profillic_profile_ParseRecord() and
+ * profillic_profilefile_ParseBinary() that fills a galosh
+ * ProfileTreeRoot in place.
+ */
+template <typename ProfileType>
+struct profillic_profiletree_sink_s
+{
+  typedef typename galosh::profile_traits<ProfileType>::ResidueType ResidueType;
+
+  ProfileType *profile;
+  int          resmap[256];	/**< residue character -> galosh index, or -1 */
+
+  profillic_profiletree_sink_s(ProfileType *p) : profile(p)
+  {
+    uint32_t res_i;
+    char     c;
+    for (res_i = 0; res_i < 256; res_i++) resmap[res_i] = -1;
+    for (res_i = 0; res_i < seqan::ValueSize<ResidueType>::VALUE; res_i++) {
+      c = static_cast<char>( ResidueType( res_i ) );
+      resmap[ (unsigned char) toupper(c) ] = resmap[ (unsigned char) tolower(c) ] = res_i;
+    }
+  }
+
+  int Begin(uint32_t npos) { profile->reinitialize( npos ); return eslOK; }
+  int End()                { return eslOK; }
+
+  // A binary record's residues must be this profile's residue type, in galosh order.
+  int Alphabet(uint32_t K, const char *sym)
+  {
+    uint32_t res_i;
+    if (K != seqan::ValueSize<ResidueType>::VALUE) return eslEINCOMPAT;
+    for (res_i = 0; res_i < K; res_i++)
+      if (toupper(sym[res_i]) != toupper(static_cast<char>( ResidueType( res_i ) ))) return eslEINCOMPAT;
+    return eslOK;
+  }
+
+  int Match(uint32_t pos, char key, double x)
+  {
+    int res_i = resmap[ (unsigned char) key ];
+    if (res_i < 0) return eslEFORMAT;
+    ( *profile )[ pos ][ galosh::Emission::Match ][ res_i ] = x;
+    return eslOK;
+  }
+
+  int Insertion(char key, double x)
+  {
+    int res_i = resmap[ (unsigned char) key ];
+    if (res_i < 0) return eslEFORMAT;
+    // The text format has one insertion distribution; galosh ties the pre- and post-align ones to it.
+    ( *profile )[ galosh::Emission::Insertion ][ res_i ]          = x;
+    ( *profile )[ galosh::Emission::PreAlignInsertion ][ res_i ]  = x;
+    ( *profile )[ galosh::Emission::PostAlignInsertion ][ res_i ] = x;
+    return eslOK;
+  }
+
+  int Transition(char from, char to, double x)
+  {
+    switch (from) {
+    case 'M':
+      if      (to == 'M') ( *profile )[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toMatch ]         = x;
+      else if (to == 'I') ( *profile )[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toInsertion ]     = x;
+      else if (to == 'D') ( *profile )[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toDeletion ]      = x;
+      else return eslEFORMAT;
+      break;
+    case 'I':
+      if      (to == 'M') ( *profile )[ galosh::Transition::fromInsertion ][ galosh::TransitionFromInsertion::toMatch ]     = x;
+      else if (to == 'I') ( *profile )[ galosh::Transition::fromInsertion ][ galosh::TransitionFromInsertion::toInsertion ] = x;
+      else return eslEFORMAT;
+      break;
+    case 'D':
+      if      (to == 'M') ( *profile )[ galosh::Transition::fromDeletion ][ galosh::TransitionFromDeletion::toMatch ]    = x;
+      else if (to == 'D') ( *profile )[ galosh::Transition::fromDeletion ][ galosh::TransitionFromDeletion::toDeletion ] = x;
+      else return eslEFORMAT;
+      break;
+    case 'N':
+      if      (to == 'N') ( *profile )[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toPreAlign ] = x;
+      else if (to == 'B') ( *profile )[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toBegin ]    = x;
+      else return eslEFORMAT;
+      break;
+    case 'B':
+      if      (to == 'M') ( *profile )[ galosh::Transition::fromBegin ][ galosh::TransitionFromBegin::toMatch ]    = x;
+      else if (to == 'D') ( *profile )[ galosh::Transition::fromBegin ][ galosh::TransitionFromBegin::toDeletion ] = x;
+      else return eslEFORMAT;
+      break;
+    case 'C':
+      if      (to == 'C') ( *profile )[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toPostAlign ] = x;
+      else if (to == 'T') ( *profile )[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toTerminal ]  = x;
+      else return eslEFORMAT;
+      break;
+    default: return eslEFORMAT;
+    }
+    return eslOK;
+  }
+};
+
+#ifdef HAVE_PTHREAD
+/*****************************************************************
+ * Parsing one long text profile record on several threads.
+ *****************************************************************/
+
+/* Records smaller than this many bytes per chunk aren't worth splitting. */
+#define PROFILLIC_PROFILE_CHUNKMIN   (1 << 20)
+
+static int profillic_profile_nthreads = 0;
+
+/**
+ * <pre>
+ * Function:  profillic_profile_SetThreads()
+ * Synopsis:  Set how many threads may parse one text profile record.
+ *
+ * Purpose:   Allow records of at least <PROFILLIC_PROFILE_CHUNKMIN>
+ *            bytes per thread to be parsed in up to <nthreads>
+ *            line-aligned chunks concurrently. Fewer than 2 (the
+ *            default is 0) parses every record on the calling thread. The
+ *            caller is blocked while the chunks are parsed, so its own
+ *            core counts as one of <nthreads>; so may those of threads
+ *            that wait on the record (build workers with nothing else
+ *            queued), but not those of threads kept busy meanwhile.
+ * </pre>
+ */
+static void
+profillic_profile_SetThreads(int nthreads)
+{
+  profillic_profile_nthreads = nthreads;
+}
+
+/* A global group value seen by one chunk; replayed in file order after the join. */
+typedef struct {
+  uint64_t bit;
+  char     tag;
+  char     key;
+  int      arrow;
+  double   x;
+} PROFILLIC_PROFILE_GLOBAL;
+
+/**
+ * profillic_profile_chunksink_s
+ *
+ * Per-chunk sink: match emissions, which belong to distinct
+ * positions, go straight to the shared <sink>; global groups are
+ * recorded for an ordered replay so that, as in the serial parse,
+ * the first line in the record carrying a group supplies it.
+ */
+template <typename Sink>
+struct profillic_profile_chunksink_s
+{
+  Sink                                  *sink;
+  std::vector<PROFILLIC_PROFILE_GLOBAL>  globals;
+
+  int Match(uint32_t pos, char key, double x) { return sink->Match(pos, key, x); }
+
+  int Insertion(char key, double x)
+  {
+    PROFILLIC_PROFILE_GLOBAL g = { PROFILLIC_PROFILE_GROUPBIT('I', FALSE), 'I', key, FALSE, x };
+    globals.push_back(g);
+    return eslOK;
+  }
+
+  int Transition(char from, char to, double x)
+  {
+    PROFILLIC_PROFILE_GLOBAL g = { PROFILLIC_PROFILE_GROUPBIT(from, TRUE), from, to, TRUE, x };
+    globals.push_back(g);
+    return eslOK;
+  }
+};
+
+template <typename Sink>
+struct profillic_profile_chunk_s
+{
+  const char                           *p;
+  esl_pos_t                             n;
+  uint32_t                              pos0;	/* index of the chunk's first position    */
+  uint32_t                              pos1;	/* RETURN: one past its last position     */
+  int64_t                               line;	/* first line number; RETURN: error line  */
+  int                                   status;
+  char                                  errbuf[eslERRBUFSIZE];
+  profillic_profile_chunksink_s<Sink>   csink;
+};
+
+template <typename Sink>
+static void
+profillic_profile_chunk_thread(void *arg)
+{
+  ESL_THREADS                     *obj = (ESL_THREADS *) arg;
+  profillic_profile_chunk_s<Sink> *chunk;
+  const char                      *p;
+  const char                      *end;
+  const char                      *eol;
+  uint64_t                         seen = 0;
+  int                              workeridx;
+
+  esl_threads_Started(obj, &workeridx);
+  chunk = (profillic_profile_chunk_s<Sink> *) esl_threads_GetData(obj, workeridx);
+
+  chunk->status = eslOK;
+  chunk->pos1   = chunk->pos0;
+  for (p = chunk->p, end = p + chunk->n; p < end; p = eol + 1, chunk->line++)
+    {
+      if ((eol = static_cast<const char *>( memchr(p, '\n', end - p) )) == NULL) eol = end;
+      if ((chunk->status = profillic_profile_ParseLine(p, eol - p, &chunk->pos1, &seen, chunk->csink, chunk->errbuf)) != eslOK) break;
+    }
+
+  esl_threads_Finished(obj, workeridx);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ParseRecordThreaded()
+ * Synopsis:  Parse a long text profile record in chunks, concurrently.
+ *
+ * Purpose:   As <profillic_profile_ParseRecord()>, but split the record
+ *            at up to <nchunks>-1 of the <marks> noted by
+ *            <profillic_profile_ScanRecord()> and parse the chunks on
+ *            their own threads. Each chunk writes its positions
+ *            straight into <sink>; global groups are applied after
+ *            the join, in record order.
+ *
+ * Returns:   as <profillic_profile_ParseRecord()>. On a parse error,
+ *            the first failing chunk's message and line are reported.
+ *
+ * Throws:    <eslEMEM> on allocation failure, <eslESYS> if threads
+ *            can't be started.
+ * </pre>
+ */
+template <typename Sink>
+static int
+profillic_profile_ParseRecordThreaded(const char *p, esl_pos_t n, uint32_t npos, Sink &sink, const PROFILLIC_PROFILE_MARKS *marks, int nchunks,
+                                      int64_t *linenumber, char *errbuf)
+{
+  profillic_profile_chunk_s<Sink> *chunk = NULL;
+  ESL_THREADS                     *obj   = NULL;
+  uint64_t                         seen  = 0;
+  uint64_t                         newly;
+  size_t                           g;
+  int                              nc    = 1;
+  int                              m     = 0;
+  int                              c;
+  int                              status;
+
+  chunk = new profillic_profile_chunk_s<Sink>[nchunks];
+  chunk[0].p    = p;
+  chunk[0].pos0 = 0;
+  chunk[0].line = *linenumber;
+  for (c = 1; c < nchunks; c++)
+    {
+      while (m < marks->n && marks->off[m] < (esl_pos_t) ((double) n * c / nchunks)) m++;
+      if (m == marks->n) break;
+      chunk[nc].p    = p + marks->off[m];
+      chunk[nc].pos0 = marks->pos[m];
+      chunk[nc].line = marks->line[m];
+      nc++;
+      m++;
+    }
+  for (c = 0; c < nc; c++)
+    {
+      chunk[c].n           = (c+1 < nc ? chunk[c+1].p : p + n) - chunk[c].p;
+      chunk[c].csink.sink  = &sink;
+      chunk[c].errbuf[0]   = '\0';
+    }
+
+  if ((status = sink.Begin(npos)) != eslOK) goto ERROR;
+
+  if ((obj = esl_threads_Create(&profillic_profile_chunk_thread<Sink>)) == NULL) { status = eslESYS; goto ERROR; }
+  for (c = 0; c < nc; c++)
+    if ((status = esl_threads_AddThread(obj, &chunk[c])) != eslOK) goto ERROR;
+  esl_threads_WaitForStart(obj);
+  esl_threads_WaitForFinish(obj);
+  esl_threads_Destroy(obj);
+  obj = NULL;
+
+  for (c = 0; c < nc; c++)
+    {
+      if (chunk[c].status != eslOK) 
+        {
+          strcpy(errbuf, chunk[c].errbuf);
+          *linenumber = chunk[c].line;
+          status = chunk[c].status;
+          goto ERROR;
+        }
+      if (chunk[c].pos1 != (c+1 < nc ? chunk[c+1].pos0 : npos)) ESL_XFAIL(eslEFORMAT, errbuf, "expected %u profile positions, parsed a different number", npos);
+
+      for (newly = 0, g = 0; g < chunk[c].csink.globals.size(); g++)
+        {
+          PROFILLIC_PROFILE_GLOBAL const &glob = chunk[c].csink.globals[g];
+          if (seen & glob.bit) continue;
+          newly |= glob.bit;
+          status = (glob.arrow ? sink.Transition(glob.tag, glob.key, glob.x) : sink.Insertion(glob.key, glob.x));
+          if (status != eslOK) { *linenumber = chunk[c].line; ESL_XFAIL(eslEFORMAT, errbuf, "unrecognized key '%c' in group '%c%s'", glob.key, glob.tag, glob.arrow ? "->" : ":"); }
+        }
+      seen |= newly;
+    }
+
+  delete [] chunk;
+  return sink.End();
+
+ ERROR:
+  /* chunks already started are still reading <chunk>: join them first */
+  if (obj != NULL) {
+    esl_threads_WaitForStart(obj);
+    esl_threads_WaitForFinish(obj);
+    esl_threads_Destroy(obj);
+  }
+  delete [] chunk;
+  return status;
+}
+#endif /*HAVE_PTHREAD*/
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ReadTextRecord()
+ * Synopsis:  Read the next text galosh profile record from <afp>.
+ *
+ * Purpose:   Find the next text record with
+ *            <profillic_profile_ScanRecord()> and parse it in place
+ *            into <sink> -- in concurrent chunks, if it's big enough
+ *            and <profillic_profile_SetThreads()> allows. Returns the
+ *            profile length in <*ret_M>, and the record's name, if
+ *            any, in <*ret_name> (caller frees).
+ *
+ * Returns:   <eslOK> on success; <eslEOF> if no records remain;
+ *            <eslEFORMAT> on a parse error, with <afp->errmsg> and
+ *            <afp->linenumber> set.
+ *
+ * Throws:    <eslEMEM>, <eslESYS>.
+ * </pre>
+ */
+template <typename Sink>
+static int
+profillic_profile_ReadTextRecord(ESLX_MSAFILE *afp, Sink &sink, uint32_t *ret_M, char **ret_name)
+{
+  PROFILLIC_PROFILE_MARKS  marks  = { NULL, NULL, NULL, 0, 0 };
+  PROFILLIC_PROFILE_MARKS *mptr   = NULL;
+  const char              *rec;
+  esl_pos_t                recn;
+  esl_pos_t                start  = -1;
+  int64_t                  line0;
+  uint32_t                 M;
+  int                      nchunks = 1;
+  int                      status;
+
+#ifdef HAVE_PTHREAD
+  if (profillic_profile_nthreads > 1) mptr = &marks;
+#endif
+  if ((status = profillic_profile_ScanRecord(afp, &start, &rec, &recn, &M, &line0, ret_name, mptr)) != eslOK) { start = -1; goto ERROR; }
+  if (M == 0) ESL_XFAIL(eslEFORMAT, afp->errmsg, "profile record ending at line %" PRId64 " has no positions", afp->linenumber);
+
+#ifdef HAVE_PTHREAD
+  nchunks = ESL_MIN(profillic_profile_nthreads, (int) (recn / PROFILLIC_PROFILE_CHUNKMIN));
+  if (nchunks > 1 && marks.n > 0)
+    status = profillic_profile_ParseRecordThreaded(rec, recn, M, sink, &marks, nchunks, &line0, afp->errmsg);
+  else
+#endif
+    status = profillic_profile_ParseRecord(rec, recn, M, sink, &line0, afp->errmsg);
+  if (status != eslOK) { afp->linenumber = line0; goto ERROR; }
+
+  esl_buffer_RaiseAnchor(afp->bf, start);
+  profillic_profile_marks_Release(&marks);
+  *ret_M = M;
+  return eslOK;
+
+ ERROR:
+  if (start >= 0) esl_buffer_RaiseAnchor(afp->bf, start);
+  profillic_profile_marks_Release(&marks);
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profile_ReadBinaryRecord()
+ * Synopsis:  Read the next binary galosh profile record from <afp>.
+ *
+ * Purpose:   Read one binary profile record (see
+ *            profillic-profilefile.hpp) starting at the current
+ *            position of <afp->bf> into <sink>. When the whole input
+ *            is in memory (mmap'ed, slurped, or a string) the record
+ *            is used in place; otherwise it is read into a temporary
+ *            block. Returns the profile length in <*ret_M>, and the
+ *            "name" metadata, if any, in <*ret_name> (caller frees).
+ *
+ * Returns:   <eslOK> on success; <afp> is poised at the next record.
+ *            <eslEFORMAT> on a bad or truncated record; <afp->errmsg>
+ *            is set.
+ *
+ * Throws:    <eslEMEM>, <eslESYS>.
+ * </pre>
+ */
+template <typename Sink>
+static int
+profillic_profile_ReadBinaryRecord(ESLX_MSAFILE *afp, Sink &sink, uint32_t *ret_M, char **ret_name)
+{
+  PROFILLIC_PROFILEB_HDR hdr;
+  char                   hbuf[PROFILLIC_PROFILEB_HDRSIZE];
+  char                  *buf   = NULL;
+  char                  *p;
+  esl_pos_t              n;
+  esl_pos_t              start = esl_buffer_GetOffset(afp->bf);
+  int                    status;
+
+  status = esl_buffer_Read(afp->bf, PROFILLIC_PROFILEB_HDRSIZE, hbuf);
+  if      (status == eslEOF) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary galosh profile header is truncated");
+  else if (status != eslOK)  goto ERROR;
+  if ((status = profillic_profilefile_ReadHeader(hbuf, PROFILLIC_PROFILEB_HDRSIZE, &hdr, afp->errmsg)) != eslOK) goto ERROR;
+
+  if (afp->bf->mode_is == eslBUFFER_MMAP || afp->bf->mode_is == eslBUFFER_ALLFILE || afp->bf->mode_is == eslBUFFER_STRING)
+    {
+      if ((status = esl_buffer_SetOffset(afp->bf, start)) != eslOK) goto ERROR;
+      if ((status = esl_buffer_Get(afp->bf, &p, &n))      != eslOK || n < hdr.size) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary galosh profile record is truncated");
+      if ((status = profillic_profilefile_ParseBinary(p, n, &hdr, sink, ret_name, afp->errmsg)) != eslOK) goto ERROR;
+      esl_buffer_Set(afp->bf, p, hdr.size);
+    }
+  else
+    {
+      ESL_ALLOC_CPP(char, buf, hdr.size);
+      memcpy(buf, hbuf, PROFILLIC_PROFILEB_HDRSIZE);
+      status = esl_buffer_Read(afp->bf, hdr.size - PROFILLIC_PROFILEB_HDRSIZE, buf + PROFILLIC_PROFILEB_HDRSIZE);
+      if      (status == eslEOF) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary galosh profile record is truncated");
+      else if (status != eslOK)  goto ERROR;
+      if ((status = profillic_profilefile_ParseBinary(buf, hdr.size, &hdr, sink, ret_name, afp->errmsg)) != eslOK) goto ERROR;
+      free(buf);
+    }
+
+  *ret_M = hdr.M;
+  return eslOK;
+
+ ERROR:
+  if (buf != NULL) free(buf);
+  return status;
+}
+
 /**
  * <pre>
  *
@@ -438,29 +1277,48 @@ profillic_eslx_msafile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, ProfileType *
  *
  * Synopsis:  Read a profillic/galosh profile.
  *
- * Purpose: Parse the Profile HMM from an open galosh profile format
- *            file (from profillic) <afp>, leaving the profile in
- *            <ret_profile>. Also create a new
+ * Purpose: Parse the next Profile HMM from an open galosh profile
+ *            format file (from profillic) <afp>, leaving the profile in
+ *            <profile_ptr>. Also create a new
  *            MSA, and return it by reference through 
  *            <*ret_msa>. Caller is responsible for freeing
  *            this <ESL_MSA>.
  *
+ *            A file may hold several profiles, one after another.
+ *            Records are separated by a line starting with "//", as
+ *            in Stockholm; the terminator after the last record is
+ *            optional. Lines starting with '#' are comments; a
+ *            "name=<token>" pair in a comment names the returned
+ *            MSA (and so the HMM built from it).
+ *
+ *            Records may also be binary (see profillic-profilefile.hpp);
+ *            they are recognized by their magic number, and their
+ *            "name" metadata plays the same role.
+ *
+ *            The record is tokenized in place in <afp->bf>'s memory
+ *            (the file itself, when the buffer is mmap'ed) by
+ *            <profillic_profile_ParseRecord()>; there's no
+ *            intermediate string or stream.
+ *
  * Args:      <afp>     - open <ESL_MSAFILE> to read from
  *            <ret_msa> - RETURN: newly parsed, created <ESL_MSA>
+ *            <profile_ptr> - RETURN: the parsed profile
  *
  * Returns:   <eslOK> on success. <*ret_msa> contains the newly
  *            allocated MSA. <afp> is poised at start of next
- *            alignment record, or is at EOF. The profile is in
- *            <ret_profile>.
+ *            profile record, or is at EOF. The profile is in
+ *            <profile_ptr>.
  *
  *            <eslEOF> if no (more) profile data are found in
  *            <afp>, and <afp> is returned at EOF. 
  *
  *            <eslEFORMAT> on a parse error. <*ret_msa> is set to
- *            <NULL>, and <ret_profile> is unaffected.
+ *            <NULL>, and the contents of <profile_ptr> are undefined.
  *            <afp> contains information sufficient for
  *            constructing useful diagnostic output: 
  *            | <afp->errmsg>       | user-directed error message     |
+ *            | <afp->linenumber>   | line number where error was detected |
+ *            | <afp->line>         | offending line (not NUL-term)   |
  *            | <afp->bf->filename> | name of the file                |
  *
  * Throws:    <eslEMEM> on allocation error.
@@ -473,90 +1331,68 @@ template <typename ProfileType>
 static int
 profillic_esl_msafile_profile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, ProfileType * profile_ptr )
 {
-  /// \note Right now this isn't actually using the open file pointer; for convenience I just use the profile.fromFile( <filename> ) method.
-  /// \todo Use convenience fns in esl_buffer.h; see eg hmmer-3.1/easel/esl_msafile_stockholm.c for examples...
   ESL_MSA                 *msa      = NULL;
-  string profile_string;
-  char *buf;
-  long len;
-  int                      seqidx;
+  char                    *name     = NULL;
+  char                    *p;
+  esl_pos_t                n;
   int                      status;
-  char       errmsg2[eslERRBUFSIZE];
 
   ESL_DASSERT1((afp->format == eslMSAFILE_PROFILLIC));
 
+  typedef typename ProfileType::ProfileResidueType ResidueType;
+
   const char * const seqname = "Galosh Profile Consensus";
   const char * const msaname = "Galosh Profile";
   uint32_t profile_length;
-  galosh::Sequence<typename ProfileType::ProfileResidueType> consensus_sequence;
-  stringstream tmp_consensus_output_stream;
+  profillic_profiletree_sink_s<ProfileType> sink( profile_ptr );
 
   uint32_t pos_i;
 
   if (profile_ptr == NULL)  { ESL_EXCEPTION(eslEINCONCEIVABLE, "profile_ptr is NULL in profillic_esl_msafile_profile_Read(..)!"); }
-  //if (feof(afp->bf->fp))  { status = eslEOF; goto ERROR; }
   afp->errmsg[0] = '\0';
 
-  // Read in the galosh profile (from profillic)
-  //fseek( afp->bf->fp, 0, SEEK_END ); // go to the end
-  //len = afp->bf->ftell( afp->bf->fp ); // get the position at the end (length)
-  //fseek( afp->bf->fp, 0, SEEK_SET ); // go to the beginning again.
-
-  //ESL_ALLOC_CPP( char, buf, sizeof( char ) * len ); //malloc buffer
-  //fread( buf, len, 1, afp->bf->fp ); //read into buffer
-
-  //profile_string = buf;
-  //profile_ptr->fromString( profile_string );
-  profile_ptr->fromFile( afp->bf->filename );
-  //if (buf)      free(buf);
-  // \todo WHY WON'T THIS WORK?  See HACKs in profillic-hmmbuild.cpp to work around it.
-  //fseek( afp->bf->fp, 0, SEEK_END ); // go to the end (to signal there's no more profiles in the file, the next time we come to this function)
-
-  // Calculate the consensus sequence.
-  profile_length = profile_ptr->length();
-  consensus_sequence.reinitialize( profile_length );
-  for( pos_i = 0; pos_i < profile_length; pos_i++ ) {
-    consensus_sequence[ pos_i ] =
-      ( *profile_ptr )[ pos_i ][ galosh::Emission::Match ].maximumValueType();
-  }
-  tmp_consensus_output_stream << consensus_sequence;
-
-  /* Allocate a growable MSA, and auxiliary parse data coupled to the MSA allocation */
-#ifdef eslAUGMENT_ALPHABET
-  if (afp->abc   &&  (msa = esl_msa_CreateDigital(afp->abc, 16, -1)) == NULL) { status = eslEMEM; goto ERROR; }
-#endif
-  if (! afp->abc &&  (msa = esl_msa_Create(                 16, -1)) == NULL) { status = eslEMEM; goto ERROR; }
-
-
-  // Set first-and-only seq to the consensus.  This should set sqlen[0] to the profile's length and set ax to have length 1 and ax[0] to be the sequence itself.  Also msa->sqname[0] to the "name" of that consensus sequence.
+  // Read in the galosh profile (from profillic), straight from the buffer's bytes.
+  if (esl_buffer_Get(afp->bf, &p, &n) == eslOK && profillic_profilefile_IsBinary(p, n))
+    {
+      if ((status = profillic_profile_ReadBinaryRecord(afp, sink, &profile_length, &name)) != eslOK) goto ERROR;
+      if (profile_length == 0) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary profile record has no positions");
+    }
+  else
+    {
+      if ((status = profillic_profile_ReadTextRecord(afp, sink, &profile_length, &name)) != eslOK) goto ERROR;
+    }
 
-  /* if nec, make room for the new seq */
-  if (msa->nseq >= msa->sqalloc && (status = esl_msa_Expand(msa)) != eslOK) return status; 
-  seqidx = msa->nseq; // 0
-  msa->nseq++; // = 1
-  status = esl_strdup(seqname, -1, &(msa->sqname[seqidx]));
-  // NOTE: Could add description of this "sequence" here, using esl_msa_SetSeqDescription(msa, seqidx, desc).
+  // The consensus is the first-and-only seq, written straight into a
+  // fixed-size MSA: msa->ax[0] (or aseq[0]) comes allocated with room
+  // for <profile_length> residues, and nseq is already 1.
 #ifdef eslAUGMENT_ALPHABET
-  if (msa->flags & eslMSA_DIGITAL)
+  if (afp->abc)
     {
-      // NOTE (profillic): There was a bug in this; it had said .."esl_abc_dsqcat(msa->abc, " where it should have said .."esl_abc_dsqcat(msa->abc->inmap, "
-      if((status = esl_abc_dsqcat(msa->abc->inmap, &(msa->ax[seqidx]), &(msa->sqlen[seqidx]), tmp_consensus_output_stream.str().c_str(), profile_length)) != eslOK) {
-        /* invalid char(s), get informative error message */
-        if (esl_abc_ValidateSeq(msa->abc, tmp_consensus_output_stream.str().c_str(), profile_length, afp->errmsg) != eslOK) 
-          ESL_XFAIL(eslEFORMAT, errmsg2, "%s (line %d): %s", msa->sqname[0], afp->linenumber, afp->errmsg);
+      profillic_residuemap_s<ResidueType> const resmap( afp->abc );
+
+      if ((msa = esl_msa_CreateDigital(afp->abc, 1, profile_length)) == NULL) { status = eslEMEM; goto ERROR; }
+      for( pos_i = 0; pos_i < profile_length; pos_i++ ) {
+        msa->ax[ 0 ][ pos_i + 1 ] =
+          resmap[ seqan::ordValue( ( *profile_ptr )[ pos_i ][ galosh::Emission::Match ].maximumValueType() ) ];
+        if (! esl_abc_XIsCanonical(afp->abc, msa->ax[ 0 ][ pos_i + 1 ])) 
+          ESL_XFAIL(eslEFORMAT, afp->errmsg, "consensus residue %u of the profile isn't in the %s alphabet", pos_i + 1, esl_abc_DecodeType(afp->abc->type));
       }
     }
 #endif
-  if (! (msa->flags & eslMSA_DIGITAL))
+  if (! afp->abc)
     {
-      status = esl_strcat(&(msa->aseq[seqidx]), 0, tmp_consensus_output_stream.str().c_str(), profile_length);
-      msa->sqlen[seqidx] = profile_length;
-    } 
-  msa->alen = profile_length;
+      if ((msa = esl_msa_Create(1, profile_length)) == NULL) { status = eslEMEM; goto ERROR; }
+      for( pos_i = 0; pos_i < profile_length; pos_i++ ) {
+        msa->aseq[ 0 ][ pos_i ] =
+          static_cast<char>( ( *profile_ptr )[ pos_i ][ galosh::Emission::Match ].maximumValueType() );
+      }
+    }
+  if ((status = esl_strdup(seqname, -1, &(msa->sqname[0]))) != eslOK) goto ERROR;
+  // NOTE: Could add description of this "sequence" here, using esl_msa_SetSeqDescription(msa, 0, desc).
 
   /// \todo OR read in a fasta file of sequences too.
-  /// \todo (Optional?) Set msa->name to the name of the profile (file?)
-  esl_strdup(msaname, -1, &(msa->name));
+  if (name != NULL) { msa->name = name; name = NULL; }
+  else if ((status = esl_strdup(msaname, -1, &(msa->name))) != eslOK) goto ERROR;
   /// \todo make sure eslMSA_HASWGTS is FALSE .. OR set it to TRUE and set msa->wgt[idx] to 1.0.
   /// \note Could have secondary structure (per sequence) too. msa->ss[0]. msa->sslen[0] should be the same as msa->sqlen[0].
   /// \todo Investigate what msa->sa and msa->pp are for.
@@ -573,6 +1409,73 @@ profillic_esl_msafile_profile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, Profile
   return eslOK;
 
  ERROR:
+  if (name != NULL)     free(name);
+  if (msa != NULL)      esl_msa_Destroy(msa);
+  if (ret_msa != NULL) *ret_msa = NULL;
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_esl_msafile_profile_Read()
+ * Synopsis:  Read a galosh profile straight into an H3 count model.
+ *
+ * Purpose:   As the ProfileTreeRoot version above, but for the fused
+ *            build path: the record (text or binary) is parsed
+ *            directly into a new count model <profile_ptr->hmm>, and
+ *            the one-sequence consensus MSA is digitized straight
+ *            from that model's match emissions. No galosh profile
+ *            object, consensus string, or stream is made.
+ *
+ *            <afp> must be open in digital mode.
+ *
+ * Returns:   as above.
+ * </pre>
+ */
+static int
+profillic_esl_msafile_profile_Read(ESLX_MSAFILE *afp, ESL_MSA **ret_msa, PROFILLIC_HMMPROFILE * profile_ptr )
+{
+  ESL_MSA                 *msa      = NULL;
+  char                    *name     = NULL;
+  char                    *p;
+  esl_pos_t                n;
+  uint32_t                 M;
+  int                      k;
+  int                      status;
+
+  ESL_DASSERT1((afp->format == eslMSAFILE_PROFILLIC));
+
+  if (profile_ptr == NULL) ESL_EXCEPTION(eslEINCONCEIVABLE, "profile_ptr is NULL in profillic_esl_msafile_profile_Read(..)!");
+  if (afp->abc    == NULL) ESL_EXCEPTION(eslEINCONCEIVABLE, "fused galosh profile reading needs a digital msafile");
+  afp->errmsg[0] = '\0';
+
+  profillic_hmm_sink_s sink( profile_ptr, afp->abc );
+
+  if (esl_buffer_Get(afp->bf, &p, &n) == eslOK && profillic_profilefile_IsBinary(p, n))
+    {
+      if ((status = profillic_profile_ReadBinaryRecord(afp, sink, &M, &name)) != eslOK) goto ERROR;
+      if (M == 0) ESL_XFAIL(eslEFORMAT, afp->errmsg, "binary profile record has no positions");
+    }
+  else
+    {
+      if ((status = profillic_profile_ReadTextRecord(afp, sink, &M, &name)) != eslOK) goto ERROR;
+    }
+
+  /* A fixed-size one-sequence MSA; its ax[0] comes allocated, with sentinels. */
+  if ((msa = esl_msa_CreateDigital(afp->abc, 1, M)) == NULL) { status = eslEMEM; goto ERROR; }
+  for (k = 1; k <= (int) M; k++)
+    msa->ax[0][k] = esl_vec_FArgMax(profile_ptr->hmm->mat[k], afp->abc->K);
+  if ((status = esl_strdup("Galosh Profile Consensus", -1, &(msa->sqname[0]))) != eslOK) goto ERROR;
+  if (name != NULL) { msa->name = name; name = NULL; }
+  else if ((status = esl_strdup("Galosh Profile", -1, &(msa->name))) != eslOK) goto ERROR;
+
+  if (( status = esl_msa_SetDefaultWeights(msa)) != eslOK) goto ERROR;
+
+  if (ret_msa != NULL) *ret_msa = msa; else esl_msa_Destroy(msa);
+  return eslOK;
+
+ ERROR:
+  if (name != NULL)     free(name);
   if (msa != NULL)      esl_msa_Destroy(msa);
   if (ret_msa != NULL) *ret_msa = NULL;
   return status;
@@ -0,0 +1,622 @@
+/**
+ * \file profillic-evalues.hpp
+ * \brief
+ * E-value calibration of one model on several threads (for profillic)
+ * \details
+ * <pre>
+ * Table of contents:
+ *     1. PROFILLIC_CALIBRATION: how to calibrate.
+ *     2. Per-model random number streams.
+ *     3. profillic_p7_Calibrate(): p7_Calibrate() over a thread pool.
+ *     4. Profiles for a model calibrated without simulation.
+ *
+ * p7_Calibrate() scores EmN, EvN and EfN random sequences against
+ * one model, one after another. Here the sequences are cut into up to
+ * <PROFILLIC_CALIBRATION_NSHARD> shards, each simulated from its own
+ * random number stream; the shards are shared out among threads, each
+ * with its own copies of the model and null model, and the fits are
+ * made over all the shards' scores, as one simulation would make them:
+ *
+ *   - MSV and Viterbi: with lambda known, the ML Gumbel location of
+ *     n scores is mu = -1/lambda log(1/n sum_i exp(-lambda x_i)), so
+ *     the pooled mu follows exactly from the per-shard mu's, however
+ *     few scores each shard has.
+ *
+ *   - Forward: tau comes from a full Gumbel fit, which doesn't pool;
+ *     so the shards keep their scores, in shard order, and tau is fit
+ *     once, to all of them, as p7_Tau() fits it.
+ *
+ * With a nonzero <seed>, a shard's stream is derived from the seed,
+ * the model's parameter fingerprint, and the shard's index alone, and
+ * the number of shards depends only on EmN, EvN and EfN; so a model's E-value
+ * parameters are the same however many threads calibrate it, and
+ * whichever worker, process, or position in the input it comes from.
+ *
+ * So a calibration with a <seed> is always sharded, on one thread or
+ * many. Without one, sharding is only used when asked for (more than
+ * one thread, or a tolerance); otherwise p7_Calibrate() does it all,
+ * as one fit, exactly as ever.
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICEVALUES_HPP__
+#define __GALOSH_PROFILLICEVALUES_HPP__
+
+extern "C" {
+#include "p7_config.h"
+}
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+
+extern "C" {
+#include "easel.h"
+#include "esl_gumbel.h"
+#include "esl_random.h"
+#include "esl_randomseq.h"
+#include "esl_vectorops.h"
+#ifdef HMMER_THREADS
+#include "esl_threads.h"
+#endif
+
+#include "base/p7_bg.h"
+#include "base/p7_hmm.h"
+#include "base/p7_profile.h"
+#include "build/p7_builder.h"
+#include "build/evalues.h"
+#include "dp_vector/p7_oprofile.h"
+#include "dp_vector/p7_checkptmx.h"
+#include "dp_vector/fwdfilter.h"
+}
+
+#include "profillic-hmmer.hpp"
+#include "profillic-p7_hmm.hpp"
+
+/*****************************************************************
+ * 1. PROFILLIC_CALIBRATION: how to calibrate.
+ *****************************************************************/
+
+/* Most shards a calibration is cut into, so the most threads it can use; fewer if there are fewer sequences. */
+#define PROFILLIC_CALIBRATION_NSHARD 64
+
+/* Fewest Forward scores an early-stopping (<tol>) calibration may fit tau to, and trust its error, and stop. */
+#define PROFILLIC_CALIBRATION_MINFWD 50
+
+/**
+ * PROFILLIC_CALIBRATION_STATS
+ *
+ * How much simulation went into one model's E-value parameters, and
+ * how precise they came out. lambda isn't fit (p7_Lambda() gives it
+ * from the model), so it has no error.
+ */
+typedef struct {
+  int    nm, nv, nf;			/**< sequences simulated for the MSV mu, Viterbi mu and Forward tau fits */
+  double mmu_se, vmu_se, tau_se;	/**< standard errors of those fits, in bits (the Gumbel fits' asymptotic ones); -1 if unknown */
+} PROFILLIC_CALIBRATION_STATS;
+
+struct profillic_calibtable_s;	/* profillic-calibtable.hpp */
+struct profillic_calibcache_s;	/* profillic-calibcache.hpp */
+
+/**
+ * PROFILLIC_CALIBRATION
+ *
+ * Calibration settings that P7_BUILDER has no room for. A NULL
+ * PROFILLIC_CALIBRATION, or one with no <seed>, <ncpus> of 0 or 1 and
+ * no <tol>, calibrates exactly as p7_Calibrate(); any other is sharded
+ * (see above), with the same results for any <ncpus>. A <table> is
+ * used instead of simulation, and a <cache> consulted first, by
+ * callers that dispatch through profillic_Calibrate()
+ * (profillic-calibcache.hpp); profillic_p7_Calibrate() itself always
+ * simulates.
+ *
+ * With <tol> > 0, shards are simulated in order and calibration stops
+ * at the first shard after which every standard error is below <tol>;
+ * EmN, EvN and EfN become caps rather than fixed counts.
+ */
+typedef struct profillic_calibration_s {
+  int      ncpus;		/**< threads to spread one model's simulations over */
+  uint32_t seed;		/**< nonzero: derive each model's streams from this (see section 2); 0: draw them from the caller's RNG */
+  double   tol;			/**< > 0: stop simulating once mu's and tau's standard errors are below this (bits); 0: simulate all */
+  const struct profillic_calibtable_s *table;	/**< non-NULL: interpolate E-value parameters from this lookup table */
+  const struct profillic_calibcache_s *cache;	/**< non-NULL (and seed nonzero): reuse, and keep, calibrations in this cache */
+  int      stamp;		/**< TRUE: profillic_Calibrate() stamps each model it calibrates (see profillic_calibration_Stamp()) */
+  mutable PROFILLIC_CALIBRATION_STATS last;	/**< RETURN: how the last model calibrated came out */
+} PROFILLIC_CALIBRATION;
+
+/*****************************************************************
+ * 2. Per-model random number streams.
+ *****************************************************************/
+
+/* splitmix64 (S. Vigna) step: advance <*x>, return a well-mixed 64-bit value. */
+static inline uint64_t
+profillic_splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_rng_StreamSeed()
+ * Synopsis:  Seed of one random number stream, from (seed, key, stream).
+ *
+ * Purpose:   Return a seed for an <ESL_RANDOMNESS> that depends only
+ *            on the run's <seed>, a <key> naming what is being
+ *            simulated (a model fingerprint, say), and the <stream>
+ *            index within it; nothing depends on what other streams
+ *            have been drawn, so streams can be used in any order,
+ *            on any thread or process.
+ *
+ * Returns:   A seed in <1..2^31-1>; never 0, which easel takes as
+ *            "choose an arbitrary seed".
+ * </pre>
+ */
+static uint32_t
+profillic_rng_StreamSeed(uint32_t seed, uint64_t key, uint32_t stream)
+{
+  uint64_t x = seed;
+  uint32_t s;
+
+  x = profillic_splitmix64(&x) ^ key;
+  x = profillic_splitmix64(&x) ^ stream;
+  s = (uint32_t) (profillic_splitmix64(&x) >> 33);
+  return (s == 0 ? 1 : s);
+}
+
+/*****************************************************************
+ * 3. profillic_p7_Calibrate(): p7_Calibrate() over a thread pool.
+ *****************************************************************/
+
+typedef struct {
+  uint32_t seed;		/* this shard's random number stream     */
+  int      nm, nv, nf;		/* how many sequences of each simulation */
+  int      f0;			/* its Forward scores go to fsc[f0..f0+nf-1] */
+  double   mmu, vmu;		/* RETURN: this shard's MSV and Viterbi fits */
+} PROFILLIC_CALIBRATION_SHARD;
+
+typedef struct {
+  P7_OPROFILE                 *om;	/* this worker's copy of the model */
+  P7_BG                       *bg;	/* ... of the null model           */
+  ESL_RANDOMNESS              *r;	/* ... and its RNG, reseeded per shard */
+  PROFILLIC_CALIBRATION_SHARD *shard;
+  double                      *fsc;	/* all shards' Forward scores, in shard order */
+  int                          first, stride, end;	/* does shards first, first+stride, ... below end */
+  double                       lambda;
+  int                          EmL, EvL, EfL;
+  int                          status;
+} PROFILLIC_CALIBRATION_WORKER;
+
+/* Score <n> iid random sequences of length <L> against <om> with Forward, in bits, into <x>: what p7_Tau() fits. */
+static int
+profillic_calibration_ForwardScores(ESL_RANDOMNESS *r, P7_OPROFILE *om, P7_BG *bg, int L, int n, double *x)
+{
+  P7_CHECKPTMX *cx  = NULL;
+  ESL_DSQ      *dsq = NULL;
+  float         fsc, nullsc;
+  int           i;
+  int           status;
+
+  if ((cx = p7_checkptmx_Create(om->M, L, ESL_MBYTES(32))) == NULL) { status = eslEMEM; goto ERROR; }
+  ESL_ALLOC_CPP(ESL_DSQ, dsq, sizeof(ESL_DSQ) * (L+2));
+
+  p7_oprofile_ReconfigLength(om, L);
+  p7_bg_SetLength(bg, L);
+  for (i = 0; i < n; i++)
+    {
+      if ((status = esl_rsq_xfIID(r, bg->f, om->abc->K, L, dsq)) != eslOK) goto ERROR;
+      if ((status = p7_ForwardFilter(dsq, L, om, cx, &fsc))      != eslOK) goto ERROR;
+      if ((status = p7_bg_NullOne(bg, dsq, L, &nullsc))          != eslOK) goto ERROR;
+      x[i] = (fsc - nullsc) / eslCONST_LOG2;
+      p7_checkptmx_Reuse(cx);
+    }
+  p7_checkptmx_Destroy(cx);
+  free(dsq);
+  return eslOK;
+
+ ERROR:
+  if (cx  != NULL) p7_checkptmx_Destroy(cx);
+  if (dsq != NULL) free(dsq);
+  return status;
+}
+
+static int
+profillic_calibration_RunShards(PROFILLIC_CALIBRATION_WORKER *w)
+{
+  PROFILLIC_CALIBRATION_SHARD *sd;
+  int                          s;
+  int                          status;
+
+  for (s = w->first; s < w->end; s += w->stride)
+    {
+      sd = &(w->shard[s]);
+      esl_randomness_Init(w->r, sd->seed);
+      if (sd->nm > 0 && (status = p7_MSVMu    (w->r, w->om, w->bg, w->EmL, sd->nm, w->lambda, &(sd->mmu))) != eslOK) return status;
+      if (sd->nv > 0 && (status = p7_ViterbiMu(w->r, w->om, w->bg, w->EvL, sd->nv, w->lambda, &(sd->vmu))) != eslOK) return status;
+      if (sd->nf > 0 && (status = profillic_calibration_ForwardScores(w->r, w->om, w->bg, w->EfL, sd->nf, w->fsc + sd->f0)) != eslOK) return status;
+    }
+  return eslOK;
+}
+
+#ifdef HMMER_THREADS
+static void
+profillic_calibration_thread(void *arg)
+{
+  ESL_THREADS                  *obj = (ESL_THREADS *) arg;
+  PROFILLIC_CALIBRATION_WORKER *w;
+  int                           workeridx;
+
+  esl_threads_Started(obj, &workeridx);
+  w = (PROFILLIC_CALIBRATION_WORKER *) esl_threads_GetData(obj, workeridx);
+  w->status = profillic_calibration_RunShards(w);
+  esl_threads_Finished(obj, workeridx);
+}
+#endif /*HMMER_THREADS*/
+
+/* Pool Gumbel locations <x[s]> (which 0: MSV, 1: Viterbi), of shards of <n[s]> scores, by -1/lambda log(sum_s n_s/N exp(-lambda x_s)). */
+static double
+profillic_calibration_pool(const PROFILLIC_CALIBRATION_SHARD *sd, int nshard, int which, double lambda)
+{
+  double lse = -eslINFINITY;
+  double ntot = 0.;
+  double n, x;
+  int    s;
+
+  for (s = 0; s < nshard; s++)
+    {
+      if (which == 0) { n = sd[s].nm; x = sd[s].mmu; }
+      else            { n = sd[s].nv; x = sd[s].vmu; }
+      if (n == 0) continue;
+      x     = log(n) - lambda * x;
+      lse   = (lse == -eslINFINITY ? x : ESL_MAX(lse, x) + log1p(exp(-fabs(lse - x))));
+      ntot += n;
+    }
+  return -(lse - log(ntot)) / lambda;
+}
+
+/* Forward tau from <n> scores <x>, fit as p7_Tau() fits it; and, in <*opt_se> (if non-NULL), its asymptotic standard error:
+ * tau = gmu + c/glam + log(tailp)/lambda, c = -log(-log(1-tailp)), and the ML Gumbel (gmu, 1/glam) have variances
+ * (1 + 6(1-gamma)^2/pi^2)/(n glam^2), 6/(pi^2 n glam^2) and covariance 6(1-gamma)/(pi^2 n glam^2).
+ */
+static int
+profillic_calibration_tau(double *x, int n, double lambda, double tailp, double *ret_tau, double *opt_se)
+{
+  double gmu, glam;
+  double c = -log(-log(1.0 - tailp));
+  double k = 6. / (eslCONST_PI * eslCONST_PI);
+  int    status;
+
+  if ((status = esl_gumbel_FitComplete(x, n, &gmu, &glam)) != eslOK) return status;
+  *ret_tau = esl_gumbel_invcdf(1.0 - tailp, gmu, glam) + log(tailp) / lambda;
+  if (opt_se != NULL)
+    *opt_se = sqrt((1. + k * (1.-eslCONST_EULER) * (1.-eslCONST_EULER) + 2. * c * k * (1.-eslCONST_EULER) + c * c * k) / n) / glam;
+  return eslOK;
+}
+
+/* Asymptotic standard error of a Gumbel location fit to <n> scores with lambda known, in bits: 1/(lambda sqrt(n)); -1 if n is 0. */
+static double
+profillic_calibration_mu_stderr(int n, double lambda)
+{
+  return (n > 0 ? 1. / (lambda * sqrt((double) n)) : -1.);
+}
+
+/* TRUE if every fit over shards <0..k-1> (Forward scores <fsc>) is known to within <tol>. */
+static int
+profillic_calibration_converged(const PROFILLIC_CALIBRATION_SHARD *sd, int k, double *fsc, double lambda, double tailp, double tol)
+{
+  int    nm = 0, nv = 0, s;
+  int    nf = sd[k-1].f0 + sd[k-1].nf;
+  double tau, se;
+
+  if (nf < PROFILLIC_CALIBRATION_MINFWD) return FALSE;
+  for (s = 0; s < k; s++) { nm += sd[s].nm; nv += sd[s].nv; }
+  if ((se = profillic_calibration_mu_stderr(nm, lambda)) < 0. || se >= tol) return FALSE;
+  if ((se = profillic_calibration_mu_stderr(nv, lambda)) < 0. || se >= tol) return FALSE;
+  if (profillic_calibration_tau(fsc, nf, lambda, tailp, &tau, &se) != eslOK || se >= tol) return FALSE;
+  return TRUE;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_p7_Calibrate()
+ * Synopsis:  Calibrate E-value parameters, on several threads.
+ *
+ * Purpose:   As <p7_Calibrate()>, with the same arguments and the same
+ *            bypass conventions, but with the MSV, Viterbi and Forward
+ *            simulations cut into shards and shared among
+ *            <calib->ncpus> threads (see the top of this file for how
+ *            their fits are merged).
+ *
+ *            If <calib->seed> is nonzero, each shard's stream comes
+ *            from <profillic_rng_StreamSeed()> of that seed, the
+ *            model's fingerprint and the shard index, and <*byp_rng>
+ *            is not drawn from; results are then the same for any
+ *            thread count and in any processing order. Otherwise the
+ *            shards' seeds are drawn from <*byp_rng> (or <cfg_b->r>).
+ *
+ *            With <calib->seed> 0, and neither <calib->ncpus> > 1 nor
+ *            <calib->tol> set, nothing is sharded: <p7_Calibrate()> is
+ *            called on <*byp_rng>, as usual. With a seed, a single
+ *            thread runs the same shards that several would.
+ *
+ *            If <calib->tol> is set, shards are run in rounds of one
+ *            per thread, and the fits are pooled over the shortest
+ *            prefix of shards that meets the tolerance, so the result
+ *            still doesn't depend on the thread count.
+ *            <calib->last> records how many sequences were used and
+ *            the standard errors reached.
+ *
+ * Returns:   <eslOK> on success, and the <hmm>'s (and any returned
+ *            profiles') <evparam>s are set.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> if threads
+ *            can't be started.
+ * </pre>
+ */
+static int
+profillic_p7_Calibrate(P7_HMM *hmm, P7_BUILDER *cfg_b, ESL_RANDOMNESS **byp_rng, P7_BG **byp_bg, P7_PROFILE **byp_gm, P7_OPROFILE **byp_om,
+                       const PROFILLIC_CALIBRATION *calib)
+{
+  PROFILLIC_CALIBRATION_SHARD  *sd  = NULL;
+  PROFILLIC_CALIBRATION_WORKER *wk  = NULL;
+  double                       *fsc = NULL;	/* Forward scores, fit all together */
+#ifdef HMMER_THREADS
+  ESL_THREADS                  *obj = NULL;
+#endif
+  ESL_RANDOMNESS               *r   = NULL;
+  P7_BG                        *bg  = NULL;
+  P7_PROFILE                   *gm  = NULL;
+  P7_OPROFILE                  *om  = NULL;
+  int      EmL = (cfg_b != NULL ? cfg_b->EmL : 200);
+  int      EmN = (cfg_b != NULL ? cfg_b->EmN : 200);
+  int      EvL = (cfg_b != NULL ? cfg_b->EvL : 200);
+  int      EvN = (cfg_b != NULL ? cfg_b->EvN : 200);
+  int      EfL = (cfg_b != NULL ? cfg_b->EfL : 100);
+  int      EfN = (cfg_b != NULL ? cfg_b->EfN : 200);
+  double   Eft = (cfg_b != NULL ? cfg_b->Eft : 0.04);
+  double   lambda;
+  double   tau;
+  uint64_t fp  = 0;
+  int      nshard, nwk;
+  int      nround;		/* shards per round */
+  int      nused;		/* fits are pooled over shards 0..nused-1 */
+  int      nf;
+  int      start, end;
+  int      s, t;
+  int      status;
+
+  /* with a seed, always shard, so that one thread gives what many do */
+  if (calib == NULL || (calib->seed == 0 && calib->ncpus <= 1 && calib->tol <= 0.))
+    {
+      status = p7_Calibrate(hmm, cfg_b, byp_rng, byp_bg, byp_gm, byp_om);
+      if (calib != NULL)
+        {
+          calib->last.nm     = EmN;
+          calib->last.nv     = EvN;
+          calib->last.nf     = EfN;
+          calib->last.mmu_se = calib->last.vmu_se = calib->last.tau_se = -1.;
+        }
+      return status;
+    }
+
+  /* The shards don't depend on the thread count, so neither do the fits.
+   * MSV and Viterbi mu pool exactly however small the shards, and tau
+   * is fit once to all the Forward scores, so the shards can be small
+   * enough to keep every thread busy.
+   */
+  nshard = ESL_MAX(1, ESL_MIN(PROFILLIC_CALIBRATION_NSHARD, ESL_MAX(EmN, ESL_MAX(EvN, EfN))));
+#ifdef HMMER_THREADS
+  nwk    = ESL_MAX(1, ESL_MIN(calib->ncpus, nshard));
+#else
+  nwk    = 1;
+#endif
+
+  /* Same bypass conventions as p7_Calibrate() */
+  if      (byp_rng != NULL && *byp_rng != NULL) r = *byp_rng;
+  else if (cfg_b   != NULL && cfg_b->r != NULL) r = cfg_b->r;
+  else if ((r = esl_randomness_CreateFast(42)) == NULL) { status = eslEMEM; goto ERROR; }
+
+  if      (byp_bg != NULL && *byp_bg != NULL) bg = *byp_bg;
+  else if ((bg = p7_bg_Create(hmm->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+
+  if (byp_gm != NULL && *byp_gm != NULL) gm = *byp_gm;
+  else
+    {
+      if ((gm = p7_profile_Create(hmm->M, hmm->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+      if ((status = p7_ProfileConfig(hmm, bg, gm, EmL, p7_LOCAL)) != eslOK) goto ERROR;
+    }
+
+  if (byp_om != NULL && *byp_om != NULL) om = *byp_om;
+  else
+    {
+      if ((om = p7_oprofile_Create(hmm->M, hmm->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+      if ((status = p7_oprofile_Convert(gm, om)) != eslOK) goto ERROR;
+    }
+
+  if ((status = p7_Lambda(hmm, bg, &lambda)) != eslOK) goto ERROR;
+  if (calib->seed != 0 && (status = profillic_p7_hmm_Fingerprint(hmm, &fp)) != eslOK) goto ERROR;
+
+  ESL_ALLOC_CPP(PROFILLIC_CALIBRATION_SHARD, sd, sizeof(PROFILLIC_CALIBRATION_SHARD) * nshard);
+  ESL_ALLOC_CPP(double, fsc, sizeof(double) * ESL_MAX(1, EfN));
+  for (s = 0; s < nshard; s++)
+    {
+      sd[s].seed = (calib->seed != 0 ? profillic_rng_StreamSeed(calib->seed, fp, s) : 1 + esl_rnd_Roll(r, 2147483646));
+      sd[s].nm   = EmN / nshard + (s < EmN % nshard ? 1 : 0);
+      sd[s].nv   = EvN / nshard + (s < EvN % nshard ? 1 : 0);
+      sd[s].nf   = EfN / nshard + (s < EfN % nshard ? 1 : 0);
+      sd[s].f0   = (s == 0 ? 0 : sd[s-1].f0 + sd[s-1].nf);
+      sd[s].mmu  = sd[s].vmu = 0.;
+    }
+
+  ESL_ALLOC_CPP(PROFILLIC_CALIBRATION_WORKER, wk, sizeof(PROFILLIC_CALIBRATION_WORKER) * nwk);
+  for (t = 0; t < nwk; t++) { wk[t].om = NULL; wk[t].bg = NULL; wk[t].r = NULL; }
+  for (t = 0; t < nwk; t++)
+    {
+      if ((wk[t].om = p7_oprofile_Clone(om))           == NULL) { status = eslEMEM; goto ERROR; }
+      if ((wk[t].bg = p7_bg_Clone(bg))                 == NULL) { status = eslEMEM; goto ERROR; }
+      if ((wk[t].r  = esl_randomness_CreateFast(42))   == NULL) { status = eslEMEM; goto ERROR; }
+      wk[t].shard  = sd;
+      wk[t].fsc    = fsc;
+      wk[t].stride = nwk;
+      wk[t].lambda = lambda;
+      wk[t].EmL    = EmL;
+      wk[t].EvL    = EvL;
+      wk[t].EfL    = EfL;
+      wk[t].status = eslOK;
+    }
+
+  /* Without a tolerance all shards go in one round. With one, a round
+   * is a shard per thread; the stopping point is found shard by shard,
+   * so a round's surplus shards are simply left out of the pool.
+   */
+  nround = (calib->tol > 0. ? nwk : nshard);
+  nused  = nshard;
+  for (start = 0; start < nshard; start = end)
+    {
+      end = ESL_MIN(nshard, start + nround);
+      for (t = 0; t < nwk; t++) { wk[t].first = start + t; wk[t].end = end; wk[t].status = eslOK; }
+
+      if (nwk == 1) wk[0].status = profillic_calibration_RunShards(&wk[0]);
+#ifdef HMMER_THREADS
+      else
+        {
+          if ((obj = esl_threads_Create(&profillic_calibration_thread)) == NULL) { status = eslESYS; goto ERROR; }
+          for (t = 0; t < nwk; t++)
+            if ((status = esl_threads_AddThread(obj, &wk[t])) != eslOK) goto ERROR;
+          esl_threads_WaitForStart(obj);
+          esl_threads_WaitForFinish(obj);
+          esl_threads_Destroy(obj);
+          obj = NULL;
+        }
+#endif
+      for (t = 0; t < nwk; t++)
+        if ((status = wk[t].status) != eslOK) goto ERROR;
+
+      if (calib->tol > 0.)
+        {
+          for (s = start + 1; s <= end; s++)
+            if (profillic_calibration_converged(sd, s, fsc, lambda, Eft, calib->tol)) break;
+          if (s <= end) { nused = s; break; }
+        }
+    }
+
+  nf = sd[nused-1].f0 + sd[nused-1].nf;
+  if ((status = profillic_calibration_tau(fsc, nf, lambda, Eft, &tau, &(calib->last.tau_se))) != eslOK) goto ERROR;
+
+  hmm->evparam[p7_MLAMBDA] = lambda;
+  hmm->evparam[p7_VLAMBDA] = lambda;
+  hmm->evparam[p7_FLAMBDA] = lambda;
+  hmm->evparam[p7_MMU]     = profillic_calibration_pool(sd, nused, 0, lambda);
+  hmm->evparam[p7_VMU]     = profillic_calibration_pool(sd, nused, 1, lambda);
+  hmm->evparam[p7_FTAU]    = tau;
+  hmm->flags              |= p7H_STATS;
+
+  calib->last.nm = calib->last.nv = 0;
+  for (s = 0; s < nused; s++) { calib->last.nm += sd[s].nm; calib->last.nv += sd[s].nv; }
+  calib->last.nf     = nf;
+  calib->last.mmu_se = profillic_calibration_mu_stderr(calib->last.nm, lambda);
+  calib->last.vmu_se = profillic_calibration_mu_stderr(calib->last.nv, lambda);
+
+  if (gm != NULL) { esl_vec_FCopy(hmm->evparam, p7_NEVPARAM, gm->evparam); }
+  if (om != NULL) { esl_vec_FCopy(hmm->evparam, p7_NEVPARAM, om->evparam); }
+
+  for (t = 0; t < nwk; t++) { p7_oprofile_Destroy(wk[t].om); p7_bg_Destroy(wk[t].bg); esl_randomness_Destroy(wk[t].r); }
+  free(wk);
+  free(sd);
+  free(fsc);
+
+  if (byp_rng != NULL) *byp_rng = r;  else if (cfg_b == NULL || r != cfg_b->r) esl_randomness_Destroy(r);
+  if (byp_bg  != NULL) *byp_bg  = bg; else p7_bg_Destroy(bg);
+  if (byp_gm  != NULL) *byp_gm  = gm; else p7_profile_Destroy(gm);
+  if (byp_om  != NULL) *byp_om  = om; else p7_oprofile_Destroy(om);
+  return eslOK;
+
+ ERROR:
+#ifdef HMMER_THREADS
+  /* threads already started are still running shards: join them first */
+  if (obj != NULL) { esl_threads_WaitForStart(obj); esl_threads_WaitForFinish(obj); esl_threads_Destroy(obj); }
+#endif
+  if (wk  != NULL)
+    {
+      for (t = 0; t < nwk; t++)
+        {
+          if (wk[t].om != NULL) p7_oprofile_Destroy(wk[t].om);
+          if (wk[t].bg != NULL) p7_bg_Destroy(wk[t].bg);
+          if (wk[t].r  != NULL) esl_randomness_Destroy(wk[t].r);
+        }
+      free(wk);
+    }
+  if (sd  != NULL) free(sd);
+  if (fsc != NULL) free(fsc);
+  if (! (byp_rng != NULL && *byp_rng == r) && ! (cfg_b != NULL && cfg_b->r == r) && r != NULL) esl_randomness_Destroy(r);
+  if (! (byp_bg  != NULL && *byp_bg  == bg) && bg != NULL) p7_bg_Destroy(bg);
+  if (! (byp_gm  != NULL && *byp_gm  == gm) && gm != NULL) p7_profile_Destroy(gm);
+  if (! (byp_om  != NULL && *byp_om  == om) && om != NULL) p7_oprofile_Destroy(om);
+  return status;
+}
+
+/*****************************************************************
+ * 4. Profiles for a model calibrated without simulation.
+ *****************************************************************/
+
+/**
+ * <pre>
+ * Function:  profillic_calibration_Profiles()
+ * Synopsis:  Make the profiles a p7_Calibrate() caller asked for.
+ *
+ * Purpose:   For a <hmm> whose <evparam>s were set some other way (from
+ *            a lookup table or a cache), give the caller what
+ *            <p7_Calibrate()> would have: if <byp_gm> is non-NULL, a
+ *            profile configured as p7_Calibrate() configures it (local,
+ *            length <EmL>), made unless <*byp_gm> already is one; the
+ *            same for an optimized profile if <byp_om> is non-NULL;
+ *            each gets the <hmm>'s <evparam>s. Nothing is made that
+ *            wasn't asked for.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+static int
+profillic_calibration_Profiles(const P7_HMM *hmm, const P7_BG *bg, int EmL, P7_PROFILE **byp_gm, P7_OPROFILE **byp_om)
+{
+  P7_PROFILE  *gm = NULL;
+  P7_OPROFILE *om = NULL;
+  int          status;
+
+  if (byp_gm != NULL && *byp_gm != NULL) gm = *byp_gm;
+  else if (byp_gm != NULL || (byp_om != NULL && *byp_om == NULL))
+    {
+      if ((gm = p7_profile_Create(hmm->M, hmm->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+      if ((status = p7_ProfileConfig(hmm, bg, gm, EmL, p7_LOCAL)) != eslOK) goto ERROR;
+    }
+  if (byp_om != NULL && *byp_om != NULL) om = *byp_om;
+  else if (byp_om != NULL)
+    {
+      if ((om = p7_oprofile_Create(hmm->M, hmm->abc)) == NULL) { status = eslEMEM; goto ERROR; }
+      if ((status = p7_oprofile_Convert(gm, om)) != eslOK) goto ERROR;
+    }
+
+  if (gm != NULL) esl_vec_FCopy(hmm->evparam, p7_NEVPARAM, gm->evparam);
+  if (om != NULL) esl_vec_FCopy(hmm->evparam, p7_NEVPARAM, om->evparam);
+
+  if (byp_gm != NULL) *byp_gm = gm; else if (gm != NULL) p7_profile_Destroy(gm);
+  if (byp_om != NULL) *byp_om = om;
+  return eslOK;
+
+ ERROR:
+  if (! (byp_gm != NULL && *byp_gm == gm) && gm != NULL) p7_profile_Destroy(gm);
+  if (! (byp_om != NULL && *byp_om == om) && om != NULL) p7_oprofile_Destroy(om);
+  return status;
+}
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICEVALUES_HPP__
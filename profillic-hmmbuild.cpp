@@ -29,6 +29,7 @@ Alternative model construction strategies:
   --hand            : manual construction (requires reference annotation)
   --profillic-amino : input msa is actually an AA galosh profile (from profillic)
   --profillic-dna   : input msa is actually a DNA galosh profile (from profillic)
+  --profillic-fused : read galosh profiles straight into the HMM count model
   --symfrac <x>     : sets sym fraction controlling --fast construction  [0.5]
   --fragthresh <x>  : if L <= x*alen, tag sequence as a fragment  [0.5]
 
@@ -68,15 +69,27 @@ Control of E-value calibration:
   --EfL <n> : length of sequences for Forward exp tail tau fit  [100]  (n>0)
   --EfN <n> : number of sequences for Forward exp tail tau fit  [200]  (n>0)
   --Eft <x> : tail mass for Forward exponential tail tau fit  [0.04]  (0<x<1)
+  --calib-cpu <n> : threads to share each model's calibration over  [0]  (n>=0)
+  --calib-tol <x> : stop calibrating once mu, tau std errors are < <x> bits  [0]  (x>=0)
+  --calib-lookup <f> : interpolate E-value parameters from lookup table <f>; no simulation
+  --calib-cache <f>  : reuse, and save, simulated E-value parameters in cache file <f>
+  --calib-stamp      : stamp calibrated models with a parameter fingerprint, for hmmcalibrate --missing-only
 
 Other options:
   --cpu <n>      : number of parallel CPU workers for multithreads
+  --reorder-window <n> : hold at most <n> models finished ahead of their turn  [256]  (n>0)
+  --unordered    : write models as they are built, not in input order
+  --lookahead <n>: read <n> alignments ahead, handing out the largest first  [1]  (n>0)
   --stall        : arrest after start: for attaching debugger to process
   --informat <s> : assert input alifile is in format <s> (no autodetect)
   --seed <n>     : set RNG seed to <n> (if 0: one-time arbitrary seed)  [42]
   --w_beta <x>   : tail mass at which window length is determined
   --w_length <n> : window length 
+  --w_batch <n>  : compute DNA/RNA window lengths <n> models at a time  [1]  (n>0)
+                   (>1 only with --cpu 0, and not with --mpi, --cache-dir or --w_extrapolate)
+  --w_extrapolate: extrapolate the tails of DNA/RNA window length computations
   --noprior      : do not apply any priors
+  --cache-dir <s>: reuse models built before from the same input and options, cached in dir <s>
  </pre>
  */
 extern "C" {
@@ -126,6 +139,9 @@ extern "C" {
 #include "profillic-p7_builder.hpp"
 //#include "profillic-esl_msa.hpp"
 #include "profillic-esl_msafile.hpp"
+#include "profillic-buildcache.hpp"
+#include "profillic-calibtable.hpp"
+#include "profillic-calibcache.hpp"
 
 // Updated notices:
 #define PROFILLIC_HMMER_VERSION "1.0a"
@@ -204,32 +220,67 @@ profillic_p7_banner(FILE *fp, char *progname, char *banner)
 
 typedef struct {
 #ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
+  ESL_WORK_QUEUE   *queue;      /* alignments to build, from the reader */
+  ESL_WORK_QUEUE   *outq;       /* built models, to the writer */
 #endif /*HMMER_THREADS*/
   P7_BG	           *bg;
   P7_BUILDER       *bld;
   int                     use_priors;
+  const PROFILLIC_BUILDCACHE *cache;    /* models already built, with --cache-dir; else NULL */
+  PROFILLIC_CALIBRATION   calib;        /* how each model is calibrated (--calib-cpu, --seed) */
+  int                     defer_max_length; /* TRUE with --w_batch > 1, serial and uncached: DNA/RNA window lengths are left to emit_result() */
+  int                     extrapolate_max_length; /* --w_extrapolate */
+  const struct cfg_s     *outcfg;       /* output streams, for format_result() */
 } WORKER_INFO;
 
-#ifdef HMMER_THREADS
+/* A built model's output, formatted ahead by format_result(): what output_result() would write to each stream */
+typedef struct {
+  char       *hmm;          /* for <cfg->hmmfp>; NULL if not formatted */
+  size_t      nhmm;
+  char       *tab;          /* for <cfg->ofp> */
+  size_t      ntab;
+  char       *post;         /* for <cfg->postmsafp>; NULL without -O */
+  size_t      npost;
+} RESULT_TEXT;
+
+/* A built model waiting to be written: for its turn (in thread_loop()), or with --w_batch for its window length */
 typedef struct {
   int         nali;
-  int         processed;
   ESL_MSA    *postmsa;
   ESL_MSA    *msa;
   P7_HMM     *hmm;
   double      entropy;
-  int         force_single; /* FALSE by default,  TRUE if esl_opt_IsUsed(go, "--single") ;  only matters for single sequences */
-} WORK_ITEM;
+  int         calibrated;
+  PROFILLIC_CALIBRATION_STATS cstats;
+  RESULT_TEXT text;
+} RESULT_ITEM;
 
-typedef struct _pending_s {
+#ifdef HMMER_THREADS
+typedef struct {
   int         nali;
+  int         processed;
   ESL_MSA    *postmsa;
   ESL_MSA    *msa;
   P7_HMM     *hmm;
   double      entropy;
-  struct _pending_s *next;
-} PENDING_ITEM;
+  int         calibrated;   /* TRUE if this item's model was calibrated here, with <cstats> saying how */
+  PROFILLIC_CALIBRATION_STATS cstats;
+  RESULT_TEXT text;         /* its output, formatted by the worker, if it was */
+  int         force_single; /* FALSE by default,  TRUE if esl_opt_IsUsed(go, "--single") ;  only matters for single sequences */
+  galosh::ProfileTreeRoot<seqan::Dna, floatrealspace>         *dna_profile;   /* this item's galosh profile with --profillic-dna, else NULL   */
+  galosh::ProfileTreeRoot<seqan::AminoAcid20, floatrealspace> *amino_profile; /* this item's galosh profile with --profillic-amino, else NULL */
+  PROFILLIC_HMMPROFILE                                        *hmm_profile;   /* this item's count model with --profillic-fused, else NULL    */
+} WORK_ITEM;
+
+typedef struct {
+  ESL_WORK_QUEUE   *queue;      /* emptied work items, back to the reader */
+  ESL_WORK_QUEUE   *outq;       /* built models, from the workers */
+  struct cfg_s     *cfg;
+  int               nworkers;   /* stopping items to wait for */
+  int               nitems;     /* work items in all */
+  int               window;     /* --reorder-window, at least <nitems> */
+  int               unordered;  /* TRUE with --unordered */
+} WRITER_INFO;
 #endif /*HMMER_THREADS*/
 
 #define ALPHOPTS "--amino,--dna,--rna"                         /* Exclusive options for alphabet choice */
@@ -252,6 +303,7 @@ static ESL_OPTIONS options[] = {
   { "--hand",    eslARG_NONE,   FALSE, NULL, NULL,    CONOPTS,    NULL,     NULL, "manual construction (requires reference annotation)",   3 },
   { "--profillic-amino",    eslARG_NONE, FALSE,NULL, NULL,    CONOPTS,    NULL,     NULL, "input msa is actually an AA galosh profile (from profillic)",       3 },
   { "--profillic-dna",    eslARG_NONE, FALSE,NULL, NULL,    CONOPTS,    NULL,     NULL, "input msa is actually a DNA galosh profile (from profillic)",       3 },
+  { "--profillic-fused",  eslARG_NONE, FALSE,NULL, NULL,       NULL,    NULL,     NULL, "read galosh profiles straight into the HMM count model",            3 },
   { "--symfrac", eslARG_REAL,   "0.5", NULL, "0<=x<=1", NULL,   "--fast",   NULL, "sets sym fraction controlling --fast construction",     3 },
   { "--fragthresh",eslARG_REAL, "0.5", NULL, "0<=x<=1", NULL,     NULL,     NULL, "if L <= x*alen, tag sequence as a fragment",            3 },
 /* Alternate relative sequence weighting strategies */
@@ -288,10 +340,20 @@ static ESL_OPTIONS options[] = {
   { "--EfL",     eslARG_INT,    "100", NULL,"n>0",       NULL,    NULL,      NULL, "length of sequences for Forward exp tail tau fit",     6 },   
   { "--EfN",     eslARG_INT,    "200", NULL,"n>0",       NULL,    NULL,      NULL, "number of sequences for Forward exp tail tau fit",     6 },   
   { "--Eft",     eslARG_REAL,  "0.04", NULL,"0<x<1",     NULL,    NULL,      NULL, "tail mass for Forward exponential tail tau fit",       6 },   
+#ifdef HMMER_THREADS
+  { "--calib-cpu", eslARG_INT,    "0", NULL,"n>=0",      NULL,    NULL,      NULL, "threads to share each model's calibration over",       6 },
+#endif
+  { "--calib-tol", eslARG_REAL,   "0", NULL,"x>=0",      NULL,    NULL,      NULL, "stop calibrating once mu, tau std errors are < <x> bits", 6 },
+  { "--calib-lookup", eslARG_INFILE, NULL, NULL, NULL,    NULL,    NULL, "--calib-tol", "interpolate E-value parameters from lookup table <f>; no simulation", 6 },
+  { "--calib-cache", eslARG_OUTFILE, NULL, NULL, NULL,    NULL,    NULL,      NULL, "reuse, and save, simulated E-value parameters in cache file <f>", 6 },
+  { "--calib-stamp", eslARG_NONE,  FALSE, NULL, NULL,     NULL,    NULL, "--calib-lookup", "stamp calibrated models with a parameter fingerprint, for hmmcalibrate --missing-only", 6 },
 
 /* Other options */
 #ifdef HMMER_THREADS 
   { "--cpu",     eslARG_INT,    NULL,"HMMER_NCPU","n>=0",NULL,     NULL,  NULL,  "number of parallel CPU workers for multithreads",       8 },
+  { "--reorder-window", eslARG_INT, "256", NULL, "n>0",  NULL,     NULL,  NULL,  "hold at most <n> models finished ahead of their turn",  8 },
+  { "--unordered", eslARG_NONE,   FALSE, NULL, NULL,      NULL,     NULL, "--reorder-window", "write models as they are built, not in input order",  8 },
+  { "--lookahead", eslARG_INT,     "1", NULL, "n>0",      NULL,     NULL,  NULL,  "read <n> alignments ahead, handing out the largest first",  8 },
 #endif
 #ifdef HAVE_MPI
   { "--mpi",     eslARG_NONE,   FALSE, NULL, NULL,      NULL,      NULL,  NULL,  "run as an MPI parallel program",                        8 },
@@ -301,8 +363,11 @@ static ESL_OPTIONS options[] = {
   { "--seed",     eslARG_INT,        "42", NULL, "n>=0",  NULL,     NULL,    NULL, "set RNG seed to <n> (if 0: one-time arbitrary seed)",   8 },
   { "--w_beta",   eslARG_REAL,       NULL, NULL, NULL,    NULL,     NULL,    NULL, "tail mass at which window length is determined",        8 },
   { "--w_length", eslARG_INT,        NULL, NULL, NULL,    NULL,     NULL,    NULL, "window length ",                                        8 },
+  { "--w_batch",  eslARG_INT,         "1", NULL, "n>0",   NULL,     NULL, "--w_length", "compute DNA/RNA window lengths <n> models at a time (>1: --cpu 0 only)", 8 },
+  { "--w_extrapolate", eslARG_NONE, FALSE, NULL, NULL,    NULL,     NULL, "--w_length", "extrapolate the tails of DNA/RNA window length computations", 8 },
   { "--maxinsertlen",  eslARG_INT,   NULL, NULL, "n>=5",  NULL,     NULL,    NULL, "pretend all inserts are length <= <n>",   8 },
   { "--noprior", eslARG_NONE,  FALSE, NULL, NULL,       NULL,      NULL,    NULL, "do not apply any priors",                                8 },
+  { "--cache-dir", eslARG_STRING,    NULL, NULL, NULL,    NULL,     NULL,    "-O", "reuse models built before from the same input and options, cached in dir <s>", 8 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
@@ -337,8 +402,20 @@ struct cfg_s {
   int           do_stall;	/* TRUE to stall the program until gdb attaches */
 
   int           use_priors; /* TRUE except when esl_opt_GetBoolean(go, "--noprior") */
+  int           fused;      /* TRUE to read galosh profiles straight into count models (--profillic-fused) */
+  PROFILLIC_BUILDCACHE *cache; /* open --cache-dir, or NULL */
+  double        calib_tol;  /* --calib-tol: early-stopping calibration, with its precision reported per model; 0 = off */
+  PROFILLIC_CALIBTABLE *calibtable; /* --calib-lookup table, or NULL */
+  PROFILLIC_CALIBCACHE *calibcache; /* --calib-cache file, or NULL */
+  int           w_batch;    /* --w_batch: window lengths computed this many models at a time; 1 = each in its own build */
+  double        w_beta;     /* --w_beta, for window lengths computed here */
+  int           w_extrapolate; /* --w_extrapolate, likewise */
+  RESULT_ITEM  *wbatch;     /* models in input order, waiting on their window lengths */
+  int           nwbatch;    /* how many of them */
 };
 
+static void profillic_open_calibration(const ESL_GETOPTS *go, struct cfg_s *cfg);
+
 
 static char usage[]  = "[-options] <hmmfile_out> <msafile>";
 static char banner[] = "profile HMM construction from multiple sequence alignments and galosh profiles";
@@ -347,8 +424,12 @@ static int  profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg);
 template <class ProfileType>
 static void  profillic_serial_loop  (WORKER_INFO *info, struct cfg_s *cfg, ProfileType * profile_ptr, const ESL_GETOPTS *go);
 #ifdef HMMER_THREADS
-static void thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, struct cfg_s *cfg, const ESL_GETOPTS *go);
+static void thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_WORK_QUEUE *outq, struct cfg_s *cfg, const ESL_GETOPTS *go);
 static void pipeline_thread(void *arg);
+static void writer_thread(void *arg);
+static int  read_work_item(struct cfg_s *cfg, WORK_ITEM *item);
+static int  next_work_item(WORK_ITEM **pool, int npool, int oldest_due);
+static int  format_result (const struct cfg_s *cfg, char *errbuf, WORK_ITEM *item);
 #endif /*HMMER_THREADS*/
 
 #ifdef HAVE_MPI
@@ -359,7 +440,9 @@ static void  mpi_init_other_failure(char *format, ...);
 #endif
 
 static int profillic_output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg);
-static int output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy);
+static int output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy, const PROFILLIC_CALIBRATION_STATS *cstats);
+static int emit_result  (      struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy, const PROFILLIC_CALIBRATION_STATS *cstats, RESULT_TEXT *text);
+static int flush_results(      struct cfg_s *cfg, char *errbuf);
 static int set_msa_name (      struct cfg_s *cfg, char *errbuf, ESL_MSA *msa);
 
 
@@ -417,6 +500,21 @@ process_commandline(int argc, char **argv, ESL_GETOPTS **ret_go, char **ret_hmmf
     { if (puts("Can't write <hmmfile_out> to stdout: don't use '-'")         < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
   if (strcmp(*ret_alifile, "-") == 0 && ! esl_opt_IsOn(go, "--informat"))
     { if (puts("Must specify --informat to read <alifile> from stdin ('-')") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+  /* getopts reqs can't say "one of", so check this one here */
+  if (esl_opt_IsOn(go, "--profillic-fused") && ! esl_opt_IsOn(go, "--profillic-dna") && ! esl_opt_IsOn(go, "--profillic-amino"))
+    { if (puts("Option --profillic-fused requires --profillic-dna or --profillic-amino")   < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+  /* --w_batch pairs models up only where one thread builds them all, before
+   * any is cached, and only without extrapolation, which goes model by model */
+  if (esl_opt_GetInteger(go, "--w_batch") > 1 && (esl_opt_IsOn(go, "--cache-dir") || esl_opt_GetBoolean(go, "--w_extrapolate")))
+    { if (puts("Option --w_batch > 1 is incompatible with --cache-dir and --w_extrapolate") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+#ifdef HMMER_THREADS
+  if (esl_opt_GetInteger(go, "--w_batch") > 1 && ! (esl_opt_IsOn(go, "--cpu") && esl_opt_GetInteger(go, "--cpu") == 0))
+    { if (puts("Option --w_batch > 1 requires --cpu 0: threaded workers compute their own window lengths") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+#endif
+#ifdef HAVE_MPI
+  if (esl_opt_GetInteger(go, "--w_batch") > 1 && esl_opt_GetBoolean(go, "--mpi"))
+    { if (puts("Options --w_batch > 1 and --mpi are incompatible: MPI workers compute their own window lengths") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+#endif
 
 #ifdef HAVE_MPI
   if (esl_opt_IsOn(go, "--mpi") && esl_opt_IsOn(go, "--cpu")) 
@@ -476,6 +574,7 @@ profillic_output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
   if (esl_opt_IsUsed(go, "--hand")       && fprintf(cfg->ofp, "# model architecture construction:  hand-specified by RF annotation\n")                < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--profillic-amino")       && fprintf(cfg->ofp, "# model architecture construction:  use input amino profile\n")                < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--profillic-dna")       && fprintf(cfg->ofp, "# model architecture construction:  use input dna profile\n")                < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--profillic-fused")     && fprintf(cfg->ofp, "# galosh profiles read:             straight into count models\n")           < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--symfrac")    && fprintf(cfg->ofp, "# sym fraction for model structure: %.3f\n",      esl_opt_GetReal(go, "--symfrac"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--fragthresh") && fprintf(cfg->ofp, "# seq called frag if L <= x*alen:   %.3f\n",      esl_opt_GetReal(go, "--fragthresh")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--wpb")        && fprintf(cfg->ofp, "# relative weighting scheme:        Henikoff PB\n")                                    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -499,6 +598,13 @@ profillic_output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
   if (esl_opt_IsUsed(go, "--EfL")        && fprintf(cfg->ofp, "# seq length for Fwd exp tau fit:   %d\n",        esl_opt_GetInteger(go, "--EfL"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--EfN")        && fprintf(cfg->ofp, "# seq number for Fwd exp tau fit:   %d\n",        esl_opt_GetInteger(go, "--EfN"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--Eft")        && fprintf(cfg->ofp, "# tail mass for Fwd exp tau fit:    %f\n",        esl_opt_GetReal(go, "--Eft"))        < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+#ifdef HMMER_THREADS
+  if (esl_opt_IsUsed(go, "--calib-cpu")  && fprintf(cfg->ofp, "# threads per model calibration:    %d\n",        esl_opt_GetInteger(go, "--calib-cpu"))< 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+#endif
+  if (esl_opt_IsUsed(go, "--calib-tol")  && fprintf(cfg->ofp, "# calibration std err tolerance:    %g\n",        esl_opt_GetReal(go, "--calib-tol"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--calib-lookup") && fprintf(cfg->ofp, "# calibration lookup table:         %s\n",      esl_opt_GetString(go, "--calib-lookup")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--calib-cache")  && fprintf(cfg->ofp, "# calibration cache file:           %s\n",      esl_opt_GetString(go, "--calib-cache"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--calib-stamp")  && fprintf(cfg->ofp, "# stamp calibrated models:          yes\n")                                          < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--popen")      && fprintf(cfg->ofp, "# gap open probability:            %f\n",         esl_opt_GetReal   (go, "--popen"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--pextend")    && fprintf(cfg->ofp, "# gap extend probability:          %f\n",         esl_opt_GetReal   (go, "--pextend")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--mx")         && fprintf(cfg->ofp, "# subst score matrix (built-in):   %s\n",         esl_opt_GetString (go, "--mx"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -507,6 +613,9 @@ profillic_output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
 
 #ifdef HMMER_THREADS
   if (esl_opt_IsUsed(go, "--cpu")        && fprintf(cfg->ofp, "# number of worker threads:         %d\n",        esl_opt_GetInteger(go, "--cpu"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
+  if (esl_opt_IsUsed(go, "--reorder-window") && fprintf(cfg->ofp, "# reorder window:                   %d\n",    esl_opt_GetInteger(go, "--reorder-window")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--unordered")  && fprintf(cfg->ofp, "# output order:                     as built (see idx)\n")                        < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--lookahead")  && fprintf(cfg->ofp, "# alignments read ahead:            %d\n",        esl_opt_GetInteger(go, "--lookahead")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #endif
 #ifdef HAVE_MPI
   if (esl_opt_IsUsed(go, "--mpi")        && fprintf(cfg->ofp, "# parallelization mode:             MPI\n")                                            < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -517,6 +626,9 @@ profillic_output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
   }
   if (esl_opt_IsUsed(go, "--w_beta")     && fprintf(cfg->ofp, "# window length beta value:         %g bits\n",   esl_opt_GetReal(go, "--w_beta"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--w_length")   && fprintf(cfg->ofp, "# window length :                   %d\n",        esl_opt_GetInteger(go, "--w_length"))< 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--w_batch")    && fprintf(cfg->ofp, "# window lengths computed per batch: %d\n",       esl_opt_GetInteger(go, "--w_batch")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--w_extrapolate") && fprintf(cfg->ofp, "# window length tails:              extrapolated\n")                         < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--cache-dir")  && fprintf(cfg->ofp, "# build cache directory:            %s\n",        esl_opt_GetString(go, "--cache-dir"))< 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 
   if (fprintf(cfg->ofp, "# - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   return eslOK;
@@ -560,6 +672,16 @@ main(int argc, char **argv)
   cfg.hmmName    = esl_opt_GetString(go, "-n"); /* NULL by default */
 
   cfg.use_priors = !esl_opt_GetBoolean(go, "--noprior");
+  cfg.fused      = esl_opt_GetBoolean(go, "--profillic-fused");
+  cfg.cache      = NULL;
+  cfg.calib_tol  = esl_opt_GetReal(go, "--calib-tol");
+  cfg.calibtable = NULL;
+  cfg.calibcache = NULL;
+  cfg.w_batch    = esl_opt_GetInteger(go, "--w_batch");
+  cfg.w_beta     = esl_opt_IsOn(go, "--w_beta") ? esl_opt_GetReal(go, "--w_beta") : p7_DEFAULT_WINDOW_BETA;
+  cfg.w_extrapolate = esl_opt_GetBoolean(go, "--w_extrapolate");
+  cfg.wbatch     = NULL;
+  cfg.nwbatch    = 0;
 
   if( esl_opt_IsUsed(go, "--profillic-amino")||esl_opt_IsUsed(go, "--profillic-dna") ) {
     cfg.fmt = eslMSAFILE_PROFILLIC;
@@ -619,7 +741,11 @@ main(int argc, char **argv)
     if (cfg.afp)   eslx_msafile_Close(cfg.afp);
     if (cfg.abc)   esl_alphabet_Destroy(cfg.abc);
     if (cfg.hmmfp) fclose(cfg.hmmfp);
+    profillic_buildcache_Destroy(cfg.cache);
   }
+  profillic_calibtable_Destroy(cfg.calibtable);
+  profillic_calibcache_Destroy(cfg.calibcache);
+  if (cfg.wbatch) free(cfg.wbatch);
   esl_getopts_Destroy(go);
   esl_stopwatch_Destroy(w);
   return 0;
@@ -645,6 +771,8 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
   WORK_ITEM       *item     = NULL;
   ESL_THREADS     *threadObj= NULL;
   ESL_WORK_QUEUE  *queue    = NULL;
+  ESL_WORK_QUEUE  *outq     = NULL;
+  int              ncores   = 0;
 #endif
   int              i;
   int              status;
@@ -688,21 +816,41 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
     } 
   else cfg->postmsafp = NULL;
 
+  if (esl_opt_IsOn(go, "--cache-dir"))
+    {
+      char errbuf[eslERRBUFSIZE];
+
+      if (esl_opt_GetInteger(go, "--seed") == 0) p7_Fail("--cache-dir needs a fixed --seed; with --seed 0 no two builds are alike");
+      if (profillic_buildcache_Create(esl_opt_GetString(go, "--cache-dir"), go, cfg->abc, &(cfg->cache), errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+    }
+  profillic_open_calibration(go, cfg);
+
+  if (cfg->w_batch > 1) ESL_ALLOC_CPP(RESULT_ITEM, cfg->wbatch, sizeof(RESULT_ITEM) * cfg->w_batch);
+
   /* Looks like the i/o is set up successfully...
    * Initial output to the user
    */
   profillic_output_header(go, cfg);                                  /* cheery output header                                */
-  output_result(cfg, NULL, 0, NULL, NULL, NULL, 0.0);	   /* tabular results header (with no args, special-case) */
+  output_result(cfg, NULL, 0, NULL, NULL, NULL, 0.0, NULL);	   /* tabular results header (with no args, special-case) */
 
 #ifdef HMMER_THREADS
   /* initialize thread data */
   if (esl_opt_IsOn(go, "--cpu")) ncpus = esl_opt_GetInteger(go, "--cpu");
   else                                   esl_threads_CPUCount(&ncpus);
 
+  /* very long galosh profiles can be parsed in chunks: the workers have little
+   * to do while the reader is stuck on one, so their cores count, as do any
+   * they leave idle */
+  if (cfg->fmt == eslMSAFILE_PROFILLIC) {
+    esl_threads_CPUCount(&ncores);
+    profillic_profile_SetThreads(ESL_MAX(ncpus, ncores - ncpus));
+  }
+
   if (ncpus > 0)
     {
       threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
+      queue = esl_workqueue_Create(ncpus * 2 + esl_opt_GetInteger(go, "--lookahead"));
+      outq  = esl_workqueue_Create(ncpus * 2 + esl_opt_GetInteger(go, "--lookahead"));
     }
 #endif
 
@@ -736,13 +884,35 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
 
 #ifdef HMMER_THREADS
       info[i].queue = queue;
+      info[i].outq  = outq;
       if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
 #endif
       info[i].use_priors = cfg->use_priors;
+      info[i].cache      = cfg->cache;
+#ifdef HMMER_THREADS
+      info[i].calib.ncpus = esl_opt_GetInteger(go, "--calib-cpu");
+#else
+      info[i].calib.ncpus = 0;
+#endif
+      info[i].calib.seed  = esl_opt_GetInteger(go, "--seed");
+      info[i].calib.tol   = cfg->calib_tol;
+      info[i].calib.table = cfg->calibtable;
+      info[i].calib.cache = cfg->calibcache;
+      info[i].calib.stamp = esl_opt_GetBoolean(go, "--calib-stamp");
+      /* Window lengths are batched only where one thread has all the models
+       * anyway (process_commandline() holds --w_batch > 1 to --cpu 0, without
+       * --cache-dir): a threaded worker finishes its own, so that they are
+       * computed in parallel and the writer just writes; nor is a model cached
+       * unfinished.
+       */
+      info[i].defer_max_length = (cfg->w_batch > 1 && ncpus == 0 && cfg->cache == NULL);
+      info[i].extrapolate_max_length = cfg->w_extrapolate;
+      info[i].outcfg           = cfg;
     }
 
 #ifdef HMMER_THREADS
-  for (i = 0; i < ncpus * 2; ++i)
+  /* two items per worker, and one more for each alignment read ahead */
+  for (i = 0; ncpus > 0 && i < ncpus * 2 + esl_opt_GetInteger(go, "--lookahead"); ++i)
     {
       ESL_ALLOC_CPP( WORK_ITEM, item, sizeof(*item));
 
@@ -752,6 +922,18 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
       item->msa       = NULL;
       item->hmm       = NULL;
       item->entropy   = 0.0;
+      item->calibrated = FALSE;
+      item->text.hmm  = NULL;
+      item->text.tab  = NULL;
+      item->text.post = NULL;
+
+      /* Each item carries its own galosh profile, so workers can build from it while the master reads the next one */
+      item->dna_profile   = NULL;
+      item->amino_profile = NULL;
+      item->hmm_profile   = NULL;
+      if      (cfg->fmt == eslMSAFILE_PROFILLIC && cfg->fused)                 item->hmm_profile   = profillic_hmmprofile_Create();
+      else if (cfg->fmt == eslMSAFILE_PROFILLIC && cfg->abc->type == eslDNA)   item->dna_profile   = new galosh::ProfileTreeRoot<seqan::Dna, floatrealspace>();
+      else if (cfg->fmt == eslMSAFILE_PROFILLIC && cfg->abc->type == eslAMINO) item->amino_profile = new galosh::ProfileTreeRoot<seqan::AminoAcid20, floatrealspace>();
 
       status = esl_workqueue_Init(queue, item);
       if (status != eslOK) esl_fatal("Failed to add block to work queue");
@@ -759,10 +941,14 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
 #endif
 
 #ifdef HMMER_THREADS
-  if ((( cfg->afp->format != eslMSAFILE_PROFILLIC )) && (ncpus > 0)) {
-    thread_loop(threadObj, queue, cfg, go);
+  if (ncpus > 0) {
+    thread_loop(threadObj, queue, outq, cfg, go);
   } else if(cfg->fmt == eslMSAFILE_PROFILLIC) {  /// TAH 3/12 replace = with ==; make sure it works!
-    if( cfg->abc != NULL && cfg->abc->type == eslDNA ) {
+    if( cfg->fused ) {
+      PROFILLIC_HMMPROFILE *hmm_profile = profillic_hmmprofile_Create();
+      profillic_serial_loop(info, cfg, hmm_profile, go);
+      profillic_hmmprofile_Destroy(hmm_profile);
+    } else if( cfg->abc != NULL && cfg->abc->type == eslDNA ) {
       galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> profile;
       profillic_serial_loop(info, cfg, &profile, go);
     } else if( cfg->abc != NULL && cfg->abc->type == eslAMINO ) {
@@ -775,8 +961,12 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
     profillic_serial_loop(info, cfg, (galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> *)NULL, go);
   }
 #else
-  if( cfg->fmt = eslMSAFILE_PROFILLIC ) {
-    if( cfg->abc->type == eslDNA ) {
+  if( cfg->fmt == eslMSAFILE_PROFILLIC ) {
+    if( cfg->fused ) {
+      PROFILLIC_HMMPROFILE *hmm_profile = profillic_hmmprofile_Create();
+      profillic_serial_loop(info, cfg, hmm_profile, go);
+      profillic_hmmprofile_Destroy(hmm_profile);
+    } else if( cfg->abc->type == eslDNA ) {
       galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> profile;
       profillic_serial_loop(info, cfg, &profile, go);
     } else if( cfg->abc->type == eslAMINO ) {
@@ -800,9 +990,13 @@ profillic_usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
       esl_workqueue_Reset(queue);
       while (esl_workqueue_Remove(queue, (void **) &item) == eslOK)
 	{
+	  delete item->dna_profile;
+	  delete item->amino_profile;
+	  profillic_hmmprofile_Destroy(item->hmm_profile);
 	  free(item);
 	}
       esl_workqueue_Destroy(queue);
+      esl_workqueue_Destroy(outq);
       esl_threads_Destroy(threadObj);
     }
 #endif
@@ -911,7 +1105,7 @@ mpi_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
   xstatus = eslOK;
   MPI_Bcast(&xstatus, 1, MPI_INT, 0, MPI_COMM_WORLD);
   output_header(go, cfg);                                  /* cheery output header                                */
-  output_result(cfg, NULL, 0, NULL, NULL, NULL, 0.0);	   /* tabular results header (with no args, special-case) */  
+  output_result(cfg, NULL, 0, NULL, NULL, NULL, 0.0, NULL);	   /* tabular results header (with no args, special-case) */  
   ESL_DPRINTF1(("MPI master is initialized\n"));  
 
   /* Worker initialization:
@@ -982,7 +1176,7 @@ mpi_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
 		  } 
 
 		  entropy = p7_MeanMatchRelativeEntropy(hmm, bg);
-		  if ((status = output_result(cfg, errmsg, msaidx[wi], msalist[wi], hmm, postmsa, entropy)) != eslOK) xstatus = status;
+		  if ((status = output_result(cfg, errmsg, msaidx[wi], msalist[wi], hmm, postmsa, entropy, NULL)) != eslOK) xstatus = status;
 
 		  esl_msa_Destroy(postmsa); postmsa = NULL;
 		  p7_hmm_Destroy(hmm);      hmm     = NULL;
@@ -1085,6 +1279,7 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
   int           pos;
   char          errmsg[eslERRBUFSIZE];
   ESL_SQ     *sq          = NULL;
+  PROFILLIC_CALIBRATION calib;		/* per-model RNG streams, so results don't depend on which worker gets which MSA */
 
   /* After master initialization: master broadcasts its status.
    */
@@ -1117,6 +1312,13 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
   }
 
   bg = p7_bg_Create(cfg->abc);
+  profillic_open_calibration(go, cfg);
+  calib.table = cfg->calibtable;
+  calib.cache = cfg->calibcache;
+  calib.ncpus = 0;
+  calib.seed  = esl_opt_GetInteger(go, "--seed");
+  calib.tol   = cfg->calib_tol;
+  calib.stamp = esl_opt_GetBoolean(go, "--calib-stamp");
 
   ESL_DPRINTF2(("worker %d: initialized\n", cfg->my_rank));
 
@@ -1127,12 +1329,12 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
       ESL_DPRINTF2(("worker %d: has received MSA %s (%d columns, %d seqs)\n", cfg->my_rank, msa->name, msa->alen, msa->nseq));
 
       if ( msa->nseq > 1 || cfg->abc->type != eslAMINO || !esl_opt_IsUsed(go, "--single")) {
-        if ((status = profillic_p7_Builder(bld, msa, ( galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> * )NULL, bg, &hmm, NULL, NULL, NULL, postmsa_ptr, cfg->use_priors)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
+        if ((status = profillic_p7_Builder(bld, msa, ( galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> * )NULL, bg, &hmm, NULL, NULL, NULL, postmsa_ptr, cfg->use_priors, &calib, FALSE, cfg->w_extrapolate)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
       } else {
         //for protein, single sequence, use blosum matrix:
         sq = esl_sq_CreateDigital(cfg->abc);
         if ((status = esl_sq_FetchFromMSA(msa, 0, &sq)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
-        if ((status = p7_SingleBuilder(bld, sq, bg, &hmm, NULL, NULL, NULL)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
+        if ((status = profillic_p7_SingleBuilder(bld, sq, bg, &hmm, NULL, NULL, NULL, &calib)) != eslOK) { strcpy(errmsg, bld->errbuf); goto ERROR; }
         esl_sq_Destroy(sq);
         sq = NULL;
         hmm->eff_nseq = 1;
@@ -1194,6 +1396,9 @@ profillic_serial_loop(WORKER_INFO *info, struct cfg_s *cfg, ProfileType * profil
   ESL_MSA   **postmsa_ptr = (cfg->postmsafile != NULL) ? &postmsa : NULL;
   P7_HMM     *hmm         = NULL;
   char        errmsg[eslERRBUFSIZE];
+  uint64_t    key         = 0;
+  int         cached;
+  int         calibrated;
   int         status;
 
   double      entropy;
@@ -1201,8 +1406,7 @@ profillic_serial_loop(WORKER_INFO *info, struct cfg_s *cfg, ProfileType * profil
   cfg->nali = 0;
   // TODO: REMOVE!
   //printf( "HI from serial_loop!\n" );
-  // Note weird hack to make sure we only try to read the profile in once.  TODO: Why doesn't EOF signal it?
-  while ( ( ( cfg->afp->format == eslMSAFILE_PROFILLIC) ? ( cfg->nali == 0 ) : 1 ) && ( (status = profillic_eslx_msafile_Read(cfg->afp, &msa, profile_ptr)) != eslEOF) )
+  while ((status = profillic_eslx_msafile_Read(cfg->afp, &msa, profile_ptr)) != eslEOF)
     {
       if (status != eslOK) eslx_msafile_ReadFailure(cfg->afp, status);
       cfg->nali++;  
@@ -1210,170 +1414,266 @@ profillic_serial_loop(WORKER_INFO *info, struct cfg_s *cfg, ProfileType * profil
       if ((status = set_msa_name(cfg, errmsg, msa)) != eslOK) p7_Fail("%s\n", errmsg); /* cfg->nnamed gets incremented in this call */
 
 
-      /*         bg   new-HMM trarr gm   om  */
-      if ( msa->nseq > 1 || (cfg->abc != NULL && cfg->abc->type != eslAMINO) || !esl_opt_IsUsed(go, "--single")) {
-        if ((status = profillic_p7_Builder(info->bld, msa, profile_ptr, info->bg, &hmm, NULL, NULL, NULL, postmsa_ptr, info->use_priors)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+      /* the key has to be taken before building, which may consume the profile */
+      cached = FALSE;
+      if (info->cache != NULL) {
+        profillic_buildcache_Key(info->cache, msa, profile_ptr, &key);
+        cached = (profillic_buildcache_Fetch(info->cache, key, &hmm) == eslOK);
+      }
+
+      calibrated = FALSE;
+      if (cached) {
+        ; /* built before, from the same input with the same options */
+      } else if ( msa->nseq > 1 || (cfg->abc != NULL && cfg->abc->type != eslAMINO) || !esl_opt_IsUsed(go, "--single")) {
+        /*         bg   new-HMM trarr gm   om  */
+        if ((status = profillic_p7_Builder(info->bld, msa, profile_ptr, info->bg, &hmm, NULL, NULL, NULL, postmsa_ptr, info->use_priors, &(info->calib), info->defer_max_length, info->extrapolate_max_length)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+        calibrated = TRUE;
       } else {
         //for protein, single sequence, use blosum matrix:
         sq = esl_sq_CreateDigital(cfg->abc);
         if ((status = esl_sq_FetchFromMSA(msa, 0, &sq)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
-        if ((status = p7_SingleBuilder(info->bld, sq, info->bg, &hmm, NULL, NULL, NULL)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+        if ((status = profillic_p7_SingleBuilder(info->bld, sq, info->bg, &hmm, NULL, NULL, NULL, &(info->calib))) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+        calibrated = TRUE;
         esl_sq_Destroy(sq);
         sq = NULL;
         hmm->eff_nseq = 1;
       }
+      if (info->cache != NULL && ! cached && profillic_buildcache_Store(info->cache, key, hmm) != eslOK) p7_Fail("failed to save model to build cache");
       entropy = p7_MeanMatchRelativeEntropy(hmm, info->bg);
-      if ((status = output_result(cfg, errmsg, cfg->nali, msa, hmm, postmsa, entropy))         != eslOK) p7_Fail(errmsg);
-
-      p7_hmm_Destroy(hmm);
-      esl_msa_Destroy(msa);
-      esl_msa_Destroy(postmsa);
+      if ((status = emit_result(cfg, errmsg, cfg->nali, msa, hmm, postmsa, entropy, calibrated ? &(info->calib.last) : NULL, NULL)) != eslOK) p7_Fail(errmsg);
+      hmm     = NULL;
+      msa     = NULL;
+      postmsa = NULL;
     }
-  /// \todo DOPTE ERE I AM.  Now there's no status returned!
-  /// \note weird hack to make sure we only try to read the profillic profile in once.  \todo Why doesn't EOF signal it?
-//  if( cfg->afp->format == eslMSAFILE_PROFILLIC ) {
-//    status = eslEOF;
-//  }
-//  return status;
+  if ((status = flush_results(cfg, errmsg)) != eslOK) p7_Fail(errmsg);
 }
 
 #ifdef HMMER_THREADS
+/**
+ * thread_loop()
+ *
+ * The reading stage of a three-stage pipeline: this thread reads each
+ * alignment into an emptied work item and hands it to the workers,
+ * who build its model and pass it on, through <outq>, to a writer
+ * thread (writer_thread()), which writes it and hands the emptied item
+ * back. Parsing the next alignment, building, and writing out the last
+ * model all go on at once, and the work items bound what is in flight.
+ *
+ * Models are written in input order. One finished ahead of its turn
+ * waits in the writer's ring of --reorder-window slots, at slot
+ * nali % window, until the ones before it are written; each is stored,
+ * and drained, in constant time. The writer holds back emptied items
+ * while the ring has no room for what would be read into them: while
+ * one slow alignment holds up the head of the ring, the reader waits
+ * for it, rather than reading ever further ahead.
+ *
+ * With --unordered, each model is written as soon as it is built, its
+ * place in the input given only by the idx column of the tabular
+ * output; then there is no waiting on the head, and no ring.
+ *
+ * With --lookahead <n> > 1, alignments are not handed out in the order
+ * read. The reader keeps a pool of the last <n> alignments read, and
+ * each time it reads one more, hands out the costliest in the pool
+ * (nseq * alen), so that a large alignment near the end of the input is
+ * not the one left running alone once the rest are done. Idle workers all take
+ * from the one queue, so no worker waits while another has work
+ * queued. An alignment passed over for <2n> reads is handed out next
+ * regardless of cost: the writer holds items back for the head of its
+ * ring, and the head must not be stuck in the pool. Only the order
+ * alignments are built in changes. Nothing is handed out until the pool
+ * is full, so the default, 1, hands each out as soon as it is read, in
+ * the input order.
+ */
 static void
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, struct cfg_s *cfg, const ESL_GETOPTS *go)
+thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_WORK_QUEUE *outq, struct cfg_s *cfg, const ESL_GETOPTS *go)
 {
-  int          status    = eslOK;
-  int          sstatus   = eslOK;
-  int          processed = 0;
+  int          status;
+  int          nworkers  = esl_threads_GetWorkerCount(obj);
+  ESL_THREADS *writerObj = NULL;
+  WRITER_INFO  winfo;
   WORK_ITEM   *item;
   void        *newItem;
-
-  int           next     = 1;
-  PENDING_ITEM *top      = NULL;
-  PENDING_ITEM *empty    = NULL;
-  PENDING_ITEM *tmp      = NULL;
+  int          lookahead = esl_opt_GetInteger(go, "--lookahead");
+  WORK_ITEM  **pool      = NULL;	/* alignments read but not yet handed out */
+  int          npool     = 0;
+  int          i;
 
   char        errmsg[eslERRBUFSIZE];
 
+  winfo.queue     = queue;
+  winfo.outq      = outq;
+  winfo.cfg       = cfg;
+  winfo.nworkers  = nworkers;
+  winfo.nitems    = nworkers * 2 + lookahead;
+  winfo.window    = ESL_MAX(esl_opt_GetInteger(go, "--reorder-window"), ESL_MAX(winfo.nitems, 2 * lookahead + 1));
+  winfo.unordered = esl_opt_GetBoolean(go, "--unordered");
+  ESL_ALLOC_CPP(WORK_ITEM*, pool, sizeof(WORK_ITEM *) * lookahead);
+
   esl_workqueue_Reset(queue);
+  esl_workqueue_Reset(outq);
+  if ((writerObj = esl_threads_Create(&writer_thread)) == NULL) esl_fatal("Failed to create writer thread");
+  esl_threads_AddThread(writerObj, &winfo);
   esl_threads_WaitForStart(obj);
+  esl_threads_WaitForStart(writerObj);
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newItem);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
-      
   /* Main loop: */
-  item = (WORK_ITEM *) newItem;
-  while (sstatus == eslOK) {
-    sstatus = eslx_msafile_Read(cfg->afp, &item->msa);
-    if (sstatus == eslOK) {
-      item->nali = ++cfg->nali;
-      if (set_msa_name(cfg, errmsg, item->msa) != eslOK) p7_Fail("%s\n", errmsg);
-    }
-    else if (sstatus == eslEOF && processed < cfg->nali) sstatus = eslOK;
-    else if (sstatus != eslEOF) 
-      eslx_msafile_ReadFailure(cfg->afp, sstatus);
-	  
-    if (sstatus == eslOK) {
-      item->force_single = esl_opt_IsUsed(go, "--single");
-      status = esl_workqueue_ReaderUpdate(queue, item, &newItem);
+  while (TRUE) {
+    status = esl_workqueue_ReaderUpdate(queue, NULL, &newItem);
+    if (status != eslOK) esl_fatal("Work queue reader failed");
+    item = (WORK_ITEM *) newItem;
+
+    status = read_work_item(cfg, item);
+    if (status == eslEOF) break;
+    if (status != eslOK)  eslx_msafile_ReadFailure(cfg->afp, status);
+
+    item->nali = ++cfg->nali;
+    if (set_msa_name(cfg, errmsg, item->msa) != eslOK) p7_Fail("%s\n", errmsg);
+    item->force_single = esl_opt_IsUsed(go, "--single");
+    pool[npool++] = item;
+
+    if (npool == lookahead) {
+      i      = next_work_item(pool, npool, cfg->nali - 2 * lookahead);
+      status = esl_workqueue_ReaderUpdate(queue, pool[i], NULL);
       if (status != eslOK) esl_fatal("Work queue reader failed");
+      pool[i] = pool[--npool];
+    }
+  }
 
-      /* process any results */
-      item = (WORK_ITEM *) newItem;
-      if (item->processed == TRUE) {
-	++processed;
+  /* hand out what is left in the pool, costliest first */
+  while (npool > 0) {
+    i      = next_work_item(pool, npool, 0);
+    status = esl_workqueue_ReaderUpdate(queue, pool[i], NULL);
+    if (status != eslOK) esl_fatal("Work queue reader failed");
+    pool[i] = pool[--npool];
+  }
 
-	/* try to keep the input output order the same */
-	if (item->nali == next) {
-	  sstatus = output_result(cfg, errmsg, item->nali, item->msa, item->hmm, item->postmsa, item->entropy);
-	  if (sstatus != eslOK) p7_Fail(errmsg);
+  /* an item with no alignment stops the worker that takes it, who passes it on to the writer */
+  item->msa = NULL;
+  for (i = 0; i < nworkers; i++) {
+    if (i > 0) {
+      status = esl_workqueue_ReaderUpdate(queue, NULL, &newItem);
+      if (status != eslOK) esl_fatal("Work queue reader failed");
+      item = (WORK_ITEM *) newItem;
+    }
+    status = esl_workqueue_ReaderUpdate(queue, item, NULL);
+    if (status != eslOK) esl_fatal("Work queue reader failed");
+  }
 
-	  p7_hmm_Destroy(item->hmm);
-	  esl_msa_Destroy(item->msa);
-	  esl_msa_Destroy(item->postmsa);
+  /* wait for all the threads to complete */
+  esl_threads_WaitForFinish(obj);
+  esl_threads_WaitForFinish(writerObj);
+  esl_workqueue_Complete(queue);  
+  esl_workqueue_Complete(outq);  
+  esl_threads_Destroy(writerObj);
+  free(pool);
+  return;
 
-	  ++next;
+ ERROR:
+  p7_Fail("thread_loop failed: memory allocation problem");
+}
 
-	  /* output any pending msa as long as the order
-	   * remains the same as read in.
-	   */
-	  while (top != NULL && top->nali == next) {
-	    sstatus = output_result(cfg, errmsg, top->nali, top->msa, top->hmm, top->postmsa, top->entropy);
-	    if (sstatus != eslOK) p7_Fail(errmsg);
+/**
+ * writer_thread()
+ *
+ * The writing stage (see thread_loop()): takes built models from
+ * <outq>, writes them through emit_result(), in input order unless
+ * --unordered, and hands the emptied work items back to the reader.
+ * Stops once every worker has passed on its empty stopping item.
+ */
+static void
+writer_thread(void *arg)
+{
+  ESL_THREADS  *obj;
+  WRITER_INFO  *w;
+  struct cfg_s *cfg;
+  WORK_ITEM    *item;
+  void         *newItem;
+  WORK_ITEM   **held     = NULL;	/* emptied work items, held back until the ring has room for what's read into them */
+  int           nheld    = 0;
+  int           handed;			/* work items the reader has had: the most alignments it can have read */
+  RESULT_ITEM  *ring     = NULL;	/* ring[nali % window]: results finished ahead of their turn; msa NULL if empty */
+  RESULT_ITEM  *r;
+  int           next     = 1;		/* nali of the next model to write */
+  int           nstopped = 0;		/* workers that have stopped */
+  int           workeridx;
+  int           i;
+  int           status;
 
-	    p7_hmm_Destroy(top->hmm);
-	    esl_msa_Destroy(top->msa);
-	    esl_msa_Destroy(top->postmsa);
+  char          errmsg[eslERRBUFSIZE];
 
-	    tmp = top;
-	    top = tmp->next;
+  obj = (ESL_THREADS *) arg;
+  esl_threads_Started(obj, &workeridx);
 
-	    tmp->next = empty;
-	    empty     = tmp;
-	    
-	    ++next;
-	  }
-	} else {
-	  /* queue up the msa so the sequence order is the same in
-	   * the .sto and .hmm
-	   */
-	  if (empty != NULL) {
-	    tmp   = empty;
-	    empty = tmp->next;
-	  } else {
-	    ESL_ALLOC_CPP( PENDING_ITEM, tmp, sizeof(PENDING_ITEM));
-	  }
+  w      = (WRITER_INFO *) esl_threads_GetData(obj, workeridx);
+  cfg    = w->cfg;
+  handed = w->nitems;
+  ESL_ALLOC_CPP(WORK_ITEM*, held, sizeof(WORK_ITEM *) * w->nitems);
+  if (! w->unordered) {
+    ESL_ALLOC_CPP(RESULT_ITEM, ring, sizeof(RESULT_ITEM) * w->window);
+    for (i = 0; i < w->window; i++) ring[i].msa = NULL;
+  }
 
-	  tmp->nali     = item->nali;
-	  tmp->hmm      = item->hmm;
-	  tmp->msa      = item->msa;
-	  tmp->postmsa  = item->postmsa;
-	  tmp->entropy  = item->entropy;
-
-	  /* add the msa to the pending list */
-	  if (top == NULL || tmp->nali < top->nali) {
-	    tmp->next = top;
-	    top       = tmp;
-	  } else {
-	    PENDING_ITEM *ptr = top;
-	    while (ptr->next != NULL && tmp->nali > ptr->next->nali) {
-	      ptr = ptr->next;
-	    }
-	    tmp->next = ptr->next;
-	    ptr->next = tmp;
-	  }
-	}
+  while (nstopped < w->nworkers) {
+    status = esl_workqueue_WorkerUpdate(w->outq, NULL, &newItem);
+    if (status != eslOK) esl_fatal("Work queue writer failed");
+    item = (WORK_ITEM *) newItem;
 
-	item->nali      = 0;
-	item->processed = FALSE;
-	item->hmm       = NULL;
-	item->msa       = NULL;
-	item->postmsa   = NULL;
-	item->entropy   = 0.0;
+    if (item->msa == NULL) {
+      /* the reader is done; nothing more will be read into what we hand back */
+      nstopped++;
+    } else if (w->unordered) {
+      if (emit_result(cfg, errmsg, item->nali, item->msa, item->hmm, item->postmsa, item->entropy, item->calibrated ? &(item->cstats) : NULL, &(item->text)) != eslOK) p7_Fail(errmsg);
+    }
+    /* keep the output order the same as the input */
+    else if (item->nali == next) {
+      if (emit_result(cfg, errmsg, item->nali, item->msa, item->hmm, item->postmsa, item->entropy, item->calibrated ? &(item->cstats) : NULL, &(item->text)) != eslOK) p7_Fail(errmsg);
+      ++next;
+
+      /* output any waiting results, as long as the order remains the same as read in */
+      for (r = &(ring[next % w->window]); r->msa != NULL; r = &(ring[next % w->window])) {
+	if (emit_result(cfg, errmsg, r->nali, r->msa, r->hmm, r->postmsa, r->entropy, r->calibrated ? &(r->cstats) : NULL, &(r->text)) != eslOK) p7_Fail(errmsg);
+	r->msa = NULL;
+	++next;
       }
+    } else {
+      r = &(ring[item->nali % w->window]);
+      r->nali       = item->nali;
+      r->hmm        = item->hmm;
+      r->msa        = item->msa;
+      r->postmsa    = item->postmsa;
+      r->entropy    = item->entropy;
+      r->calibrated = item->calibrated;
+      r->cstats     = item->cstats;
+      r->text       = item->text;
     }
-  }
-
-  if (top != NULL) esl_fatal("Top is not empty\n");
 
-  while (empty != NULL) {
-    tmp   = empty;
-    empty = tmp->next;
-    free(tmp);
+    item->nali      = 0;
+    item->processed = FALSE;
+    item->hmm       = NULL;
+    item->msa       = NULL;
+    item->postmsa   = NULL;
+    item->entropy   = 0.0;
+    item->calibrated = FALSE;
+    item->text.hmm  = NULL;
+    item->text.tab  = NULL;
+    item->text.post = NULL;
+    held[nheld++]   = item;
+
+    while (nheld > 0 && (w->unordered || nstopped > 0 || handed + 1 - next < w->window)) {
+      status = esl_workqueue_WorkerUpdate(w->queue, held[--nheld], NULL);
+      if (status != eslOK) esl_fatal("Work queue writer failed");
+      handed++;
+    }
   }
+  if (flush_results(cfg, errmsg) != eslOK) p7_Fail(errmsg);
 
-  status = esl_workqueue_ReaderUpdate(queue, item, NULL);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
-
-  if (sstatus == eslEOF)
-    {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
-    }
+  free(held);
+  if (ring) free(ring);
+  esl_threads_Finished(obj, workeridx);
   return;
 
  ERROR:
-  p7_Fail("thread_loop failed: memory allocation problem");
+  p7_Fail("writer_thread failed: memory allocation problem");
 }
 
 static void 
@@ -1388,6 +1688,10 @@ pipeline_thread(void *arg)
   WORKER_INFO  *info;
   ESL_THREADS  *obj;
   ESL_SQ     *sq          = NULL;
+  uint64_t      key       = 0;
+  int           cached;
+
+  char          errmsg[eslERRBUFSIZE];
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
@@ -1402,42 +1706,154 @@ pipeline_thread(void *arg)
   while (item->msa != NULL)
     {
 
-      if ( item->msa->nseq > 1 || info->bg->abc->type != eslAMINO || !item->force_single) {
-        status = profillic_p7_Builder(info->bld, item->msa, ( galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> * )NULL, info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors);
+      /* the key has to be taken before building, which may consume the profile */
+      cached = FALSE;
+      if (info->cache != NULL) {
+        if      (item->hmm_profile   != NULL) profillic_buildcache_Key(info->cache, item->msa, item->hmm_profile,   &key);
+        else if (item->dna_profile   != NULL) profillic_buildcache_Key(info->cache, item->msa, item->dna_profile,   &key);
+        else if (item->amino_profile != NULL) profillic_buildcache_Key(info->cache, item->msa, item->amino_profile, &key);
+        else                                  profillic_buildcache_Key(info->cache, item->msa, ( galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> * )NULL, &key);
+        cached = (profillic_buildcache_Fetch(info->cache, key, &item->hmm) == eslOK);
+      }
+
+      if (cached) {
+        ; /* built before, from the same input with the same options */
+      } else if ( item->msa->nseq > 1 || info->bg->abc->type != eslAMINO || !item->force_single) {
+        if      (item->hmm_profile   != NULL) status = profillic_p7_Builder(info->bld, item->msa, item->hmm_profile,   info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors, &(info->calib), info->defer_max_length, info->extrapolate_max_length);
+        else if (item->dna_profile   != NULL) status = profillic_p7_Builder(info->bld, item->msa, item->dna_profile,   info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors, &(info->calib), info->defer_max_length, info->extrapolate_max_length);
+        else if (item->amino_profile != NULL) status = profillic_p7_Builder(info->bld, item->msa, item->amino_profile, info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors, &(info->calib), info->defer_max_length, info->extrapolate_max_length);
+        else                                  status = profillic_p7_Builder(info->bld, item->msa, ( galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> * )NULL, info->bg, &item->hmm, NULL, NULL, NULL, &item->postmsa, info->use_priors, &(info->calib), info->defer_max_length, info->extrapolate_max_length);
         if (status != eslOK) p7_Fail("build failed: %s", info->bld->errbuf);
+        item->calibrated = TRUE;
+        item->cstats     = info->calib.last;
       } else {
         //for protein, single sequence, use blosum matrix:
         sq = esl_sq_CreateDigital(info->bg->abc);
         status = esl_sq_FetchFromMSA(item->msa, 0, &sq);
         if (status != eslOK) p7_Fail("build failed: %s", info->bld->errbuf);
 
-        status = p7_SingleBuilder(info->bld, sq, info->bg, &item->hmm, NULL, NULL, NULL);
+        status = profillic_p7_SingleBuilder(info->bld, sq, info->bg, &item->hmm, NULL, NULL, NULL, &(info->calib));
         if (status != eslOK) p7_Fail("build failed: %s", info->bld->errbuf);
+        item->calibrated = TRUE;
+        item->cstats     = info->calib.last;
 
         esl_sq_Destroy(sq);
         sq = NULL;
         item->hmm->eff_nseq = 1;
       }
+      if (info->cache != NULL && ! cached && profillic_buildcache_Store(info->cache, key, item->hmm) != eslOK) p7_Fail("failed to save model to build cache");
 
       item->entropy   = p7_MeanMatchRelativeEntropy(item->hmm, info->bg);
+      if (format_result(info->outcfg, errmsg, item) != eslOK) p7_Fail(errmsg);
       item->processed = TRUE;
 
-      status = esl_workqueue_WorkerUpdate(info->queue, item, &newItem);
+      status = esl_workqueue_ReaderUpdate(info->outq, item, NULL);
+      if (status != eslOK) esl_fatal("Work queue worker failed");
+      status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newItem);
       if (status != eslOK) esl_fatal("Work queue worker failed");
 
       item = (WORK_ITEM *) newItem;
     }
 
-  status = esl_workqueue_WorkerUpdate(info->queue, item, NULL);
+  /* pass the stopping item on, to stop the writer once every worker has */
+  status = esl_workqueue_ReaderUpdate(info->outq, item, NULL);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
   esl_threads_Finished(obj, workeridx);
   return;
 }
+
+/**
+ * read_work_item()
+ *
+ * Read the next alignment into <item->msa>. For galosh profile input,
+ * the profile itself is read into the item's own typed profile, which
+ * travels with the item to whichever worker builds it.
+ */
+static int
+read_work_item(struct cfg_s *cfg, WORK_ITEM *item)
+{
+  if      (item->hmm_profile   != NULL) return profillic_eslx_msafile_Read(cfg->afp, &item->msa, item->hmm_profile);
+  else if (item->dna_profile   != NULL) return profillic_eslx_msafile_Read(cfg->afp, &item->msa, item->dna_profile);
+  else if (item->amino_profile != NULL) return profillic_eslx_msafile_Read(cfg->afp, &item->msa, item->amino_profile);
+  else                                  return eslx_msafile_Read(cfg->afp, &item->msa);
+}
+
+/**
+ * next_work_item()
+ *
+ * Pick which of the <npool> alignments in <pool> to hand out next: the
+ * costliest, by nseq * alen, the earlier read on a tie; but the
+ * earliest read, if it is numbered <oldest_due> or less. Returns its
+ * index in <pool>.
+ */
+static int
+next_work_item(WORK_ITEM **pool, int npool, int oldest_due)
+{
+  int    i;
+  int    oldest = 0;
+  int    best   = 0;
+  double cost;
+  double bestcost;
+
+  bestcost = (double) pool[0]->msa->nseq * (double) pool[0]->msa->alen;
+  for (i = 1; i < npool; i++) {
+    if (pool[i]->nali < pool[oldest]->nali) oldest = i;
+
+    cost = (double) pool[i]->msa->nseq * (double) pool[i]->msa->alen;
+    if (cost > bestcost || (cost == bestcost && pool[i]->nali < pool[best]->nali)) { best = i; bestcost = cost; }
+  }
+  return (pool[oldest]->nali <= oldest_due) ? oldest : best;
+}
+
+/**
+ * format_result()
+ *
+ * Format <item>'s output into <item->text>, in the worker: the same
+ * output_result(), but writing to memory streams instead of <cfg>'s
+ * files, so that all the writer has left to do is copy the text out.
+ * A DNA/RNA model without its window length (max_length -1, as a
+ * --w_batch run could cache it) has it computed first.
+ * Only <cfg>'s settings are read, which no thread changes.
+ */
+static int
+format_result(const struct cfg_s *cfg, char *errbuf, WORK_ITEM *item)
+{
+  struct cfg_s mcfg;
+  int          status;
+
+  if (item->hmm->max_length == -1 && (item->hmm->abc->type == eslDNA || item->hmm->abc->type == eslRNA) &&
+      profillic_p7_Builder_MaxLength(item->hmm, cfg->w_beta, cfg->w_extrapolate) != eslOK)
+    ESL_FAIL(eslFAIL, errbuf, "window length computation failed for model %d", item->nali);
+
+  memset(&mcfg, 0, sizeof(mcfg));
+  mcfg.calib_tol = cfg->calib_tol;
+
+  if ((mcfg.hmmfp = open_memstream(&(item->text.hmm), &(item->text.nhmm))) == NULL) ESL_XEXCEPTION_SYS(eslESYS, "format_result: open_memstream failed");
+  if ((mcfg.ofp   = open_memstream(&(item->text.tab), &(item->text.ntab))) == NULL) ESL_XEXCEPTION_SYS(eslESYS, "format_result: open_memstream failed");
+  if (cfg->postmsafp != NULL && (mcfg.postmsafp = open_memstream(&(item->text.post), &(item->text.npost))) == NULL) ESL_XEXCEPTION_SYS(eslESYS, "format_result: open_memstream failed");
+
+  if ((status = output_result(&mcfg, errbuf, item->nali, item->msa, item->hmm, item->postmsa, item->entropy, item->calibrated ? &(item->cstats) : NULL)) != eslOK) goto ERROR;
+
+  /* the buffers are only complete once their streams are closed */
+  fclose(mcfg.hmmfp);
+  fclose(mcfg.ofp);
+  if (mcfg.postmsafp != NULL) fclose(mcfg.postmsafp);
+  return eslOK;
+
+ ERROR:
+  if (mcfg.hmmfp     != NULL) fclose(mcfg.hmmfp);
+  if (mcfg.ofp       != NULL) fclose(mcfg.ofp);
+  if (mcfg.postmsafp != NULL) fclose(mcfg.postmsafp);
+  if (item->text.hmm  != NULL) { free(item->text.hmm);  item->text.hmm  = NULL; }
+  if (item->text.tab  != NULL) { free(item->text.tab);  item->text.tab  = NULL; }
+  if (item->text.post != NULL) { free(item->text.post); item->text.post = NULL; }
+  return status;
+}
 #endif   /* HMMER_THREADS */
  
 static int
-output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy)
+output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy, const PROFILLIC_CALIBRATION_STATS *cstats)
 {
   int status;
 
@@ -1467,6 +1883,15 @@ output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P
 	      entropy,
 	      (msa->desc != NULL) ? msa->desc : "") < 0)
     ESL_EXCEPTION_SYS(eslEWRITE, "output_result: write failed");
+
+  /* with --calib-tol, show how far each model's calibration went (not for cached or --single models) */
+  if (cstats != NULL && cfg->calib_tol > 0. && cstats->nf == 0 &&
+      fprintf(cfg->ofp, "#      calibration reused from --calib-cache\n") < 0)
+    ESL_EXCEPTION_SYS(eslEWRITE, "output_result: write failed");
+  if (cstats != NULL && cfg->calib_tol > 0. && cstats->nf > 0 &&
+      fprintf(cfg->ofp, "#      calibrated on %d/%d/%d seqs (MSV/Vit/Fwd); std err mu %.4f/%.4f, tau %.4f bits\n",
+              cstats->nm, cstats->nv, cstats->nf, cstats->mmu_se, cstats->vmu_se, cstats->tau_se) < 0)
+    ESL_EXCEPTION_SYS(eslEWRITE, "output_result: write failed");
   
   if (cfg->postmsafp != NULL && postmsa != NULL) {
     eslx_msafile_Write(cfg->postmsafp, postmsa, eslMSAFILE_STOCKHOLM);
@@ -1475,6 +1900,130 @@ output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P
   return eslOK;
 }
 
+/**
+ * emit_result()
+ *
+ * Hand a built model to output_result(), in input order, and free it
+ * and its alignments. If a worker already formatted its output into
+ * <text> (see format_result(); <text> may be NULL, or empty), that is
+ * just copied out, and freed. A DNA/RNA model whose window length was
+ * left to us (max_length -1; see --w_batch, which the serial loop leaves
+ * to us) has it computed first: with --w_batch <n> > 1 the models are held
+ * back until <n> of them are waiting, then done together by
+ * profillic_p7_Builder_MaxLengthBatch() and output; flush_results() puts
+ * out the rest at the end.
+ */
+static int
+emit_result(struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy, const PROFILLIC_CALIBRATION_STATS *cstats, RESULT_TEXT *text)
+{
+  RESULT_ITEM *r;
+  int          status;
+
+  if (text != NULL && text->hmm != NULL) {
+    status = eslOK;
+    if      (fwrite(text->hmm, 1, text->nhmm, cfg->hmmfp) != text->nhmm)                               status = eslEWRITE;
+    else if (fwrite(text->tab, 1, text->ntab, cfg->ofp)   != text->ntab)                               status = eslEWRITE;
+    else if (text->post != NULL && fwrite(text->post, 1, text->npost, cfg->postmsafp) != text->npost) status = eslEWRITE;
+    free(text->hmm);
+    free(text->tab);
+    if (text->post != NULL) free(text->post);
+    text->hmm = text->tab = text->post = NULL;
+    p7_hmm_Destroy(hmm);
+    esl_msa_Destroy(msa);
+    esl_msa_Destroy(postmsa);
+    if (status != eslOK) ESL_FAIL(status, errbuf, "emit_result: write failed");
+    return eslOK;
+  }
+
+  if (cfg->w_batch <= 1) {
+    if (hmm->max_length == -1 && (hmm->abc->type == eslDNA || hmm->abc->type == eslRNA) &&
+        profillic_p7_Builder_MaxLength(hmm, cfg->w_beta, cfg->w_extrapolate) != eslOK)
+      ESL_FAIL(eslFAIL, errbuf, "window length computation failed for model %d", msaidx);
+    status = output_result(cfg, errbuf, msaidx, msa, hmm, postmsa, entropy, cstats);
+    p7_hmm_Destroy(hmm);
+    esl_msa_Destroy(msa);
+    esl_msa_Destroy(postmsa);
+    return status;
+  }
+
+  r = &(cfg->wbatch[cfg->nwbatch++]);
+  r->nali       = msaidx;
+  r->msa        = msa;
+  r->hmm        = hmm;
+  r->postmsa    = postmsa;
+  r->entropy    = entropy;
+  r->calibrated = (cstats != NULL);
+  if (cstats != NULL) r->cstats = *cstats;
+
+  if (cfg->nwbatch == cfg->w_batch) return flush_results(cfg, errbuf);
+  return eslOK;
+}
+
+/**
+ * flush_results()
+ *
+ * Compute the window lengths of the models waiting in <cfg->wbatch>
+ * that need one, all in one profillic_p7_Builder_MaxLengthBatch(), then
+ * output and free them all, in order.
+ */
+static int
+flush_results(struct cfg_s *cfg, char *errbuf)
+{
+  P7_HMM **hmms  = NULL;
+  int      nhmms = 0;
+  int      i;
+  int      status;
+
+  if (cfg->nwbatch == 0) return eslOK;
+
+  ESL_ALLOC_CPP(P7_HMM*, hmms, sizeof(P7_HMM *) * cfg->nwbatch);
+  for (i = 0; i < cfg->nwbatch; i++)
+    if (cfg->wbatch[i].hmm->max_length == -1 && (cfg->wbatch[i].hmm->abc->type == eslDNA || cfg->wbatch[i].hmm->abc->type == eslRNA))
+      hmms[nhmms++] = cfg->wbatch[i].hmm;
+  if (profillic_p7_Builder_MaxLengthBatch(hmms, nhmms, cfg->w_beta, cfg->w_extrapolate) != eslOK)
+    ESL_XFAIL(eslFAIL, errbuf, "window length computation failed for models %d..%d", cfg->wbatch[0].nali, cfg->wbatch[cfg->nwbatch-1].nali);
+
+  for (i = 0; i < cfg->nwbatch; i++) {
+    RESULT_ITEM *r = &(cfg->wbatch[i]);
+
+    if ((status = output_result(cfg, errbuf, r->nali, r->msa, r->hmm, r->postmsa, r->entropy, r->calibrated ? &(r->cstats) : NULL)) != eslOK) goto ERROR;
+    p7_hmm_Destroy(r->hmm);
+    esl_msa_Destroy(r->msa);
+    esl_msa_Destroy(r->postmsa);
+  }
+  cfg->nwbatch = 0;
+  free(hmms);
+  return eslOK;
+
+ ERROR:
+  if (hmms) free(hmms);
+  return status;
+}
+
+/**
+ * profillic_open_calibration()
+ *
+ * With --calib-lookup, read the lookup table into <cfg->calibtable>,
+ * and check that it covers <cfg->abc>; with --calib-cache, open the
+ * cache file into <cfg->calibcache>. Each is left NULL if not asked for.
+ */
+static void
+profillic_open_calibration(const ESL_GETOPTS *go, struct cfg_s *cfg)
+{
+  char errbuf[eslERRBUFSIZE];
+
+  if (esl_opt_IsOn(go, "--calib-lookup"))
+    {
+      if (profillic_calibtable_Read(esl_opt_GetString(go, "--calib-lookup"), &(cfg->calibtable), errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+      if (profillic_calibtable_Grid(cfg->calibtable, cfg->abc->type) == NULL)
+        p7_Fail("calibration table %s has no %s grid", esl_opt_GetString(go, "--calib-lookup"), esl_abc_DecodeType(cfg->abc->type));
+    }
+  if (esl_opt_IsOn(go, "--calib-cache"))
+    {
+      if (esl_opt_GetInteger(go, "--seed") == 0) p7_Fail("--calib-cache needs a fixed --seed; with --seed 0 no two calibrations are alike");
+      if (profillic_calibcache_Open(esl_opt_GetString(go, "--calib-cache"), &(cfg->calibcache), errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+    }
+}
 
 
 /**
@@ -11,10 +11,29 @@
 # Freely distributed under the GNU General Public License (GPLv3).
 # - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Usage: profillic-hmmcalibrate [-options] <input hmmfile> <output hmmfile>
+   or: profillic-hmmcalibrate [-options] --build-lookup <f>
 
 Options:
   -h         : show brief help on version and usage
   --seed <n> : set RNG seed to <n> (if 0: one-time arbitrary seed)  [42]  (n>=0)
+  --preset <s> : calibration simulation preset: fast, default or precise  [default]
+  --EmL <n>  : length of sequences for MSV Gumbel mu fit (overrides --preset)  (n>0)
+  --EmN <n>  : number of sequences for MSV Gumbel mu fit (overrides --preset)  (n>0)
+  --EvL <n>  : length of sequences for Viterbi Gumbel mu fit (overrides --preset)  (n>0)
+  --EvN <n>  : number of sequences for Viterbi Gumbel mu fit (overrides --preset)  (n>0)
+  --EfL <n>  : length of sequences for Forward exp tail tau fit (overrides --preset)  (n>0)
+  --EfN <n>  : number of sequences for Forward exp tail tau fit (overrides --preset)  (n>0)
+  --Eft <x>  : tail mass for Forward exponential tail tau fit (overrides --preset)  (0<x<1)
+  --calib-cpu <n> : threads to share each model's calibration over  [0]  (n>=0)
+  --calib-tol <x> : stop calibrating once mu, tau std errors are < <x> bits  [0]  (x>=0)
+  --calib-lookup <f> : interpolate E-value parameters from lookup table <f>; no simulation
+  --calib-cache <f>  : reuse, and save, simulated E-value parameters in cache file <f>
+  --cpu <n>          : number of parallel CPU workers, each calibrating whole models
+  --reorder-window <n> : hold at most <n> models finished ahead of their turn  [256]  (n>0)
+  --calib-stamp      : stamp calibrated models with a parameter fingerprint, for --missing-only
+  --missing-only     : pass through models whose calibration is still current; stamp the rest
+  --build-lookup <f> : build a lookup table for --calib-lookup by simulation, into <f>
+  --lookup-abc <s>   : alphabet of the --build-lookup table: amino, dna or rna  [amino]
  * </pre>
  */
 extern "C" {
@@ -35,9 +54,20 @@ extern "C" {
 #undef new
 }
 
+#ifdef HMMER_THREADS
+#include <unistd.h>
+extern "C" {
+#include "esl_threads.h"
+#include "esl_workqueue.h"
+}
+#endif /*HMMER_THREADS*/
+
 /* ////////////// For profillic-hmmer ///////////////////////////////// */
 #include "profillic-hmmer.hpp"
-//#include "profillic-p7_builder.hpp"
+#include "profillic-p7_builder.hpp"
+#include "profillic-evalues.hpp"
+#include "profillic-calibtable.hpp"
+#include "profillic-calibcache.hpp"
 
 // Updated notices:
 #define PROFILLIC_HMMER_VERSION "1.0a"
@@ -118,11 +148,154 @@ static ESL_OPTIONS options[] = {
   /* name           type      default  env  range     toggles   reqs   incomp  help   docgroup*/
   { "-h",        eslARG_NONE,   FALSE, NULL, NULL,      NULL,  NULL, NULL, "show brief help on version and usage",            0 },
   { "--seed",     eslARG_INT,   "42", NULL, "n>=0",     NULL,      NULL,    NULL, "set RNG seed to <n> (if 0: one-time arbitrary seed)",   8 },
+  { "--preset",   eslARG_STRING, "default", NULL, NULL, NULL,      NULL,    NULL, "calibration simulation preset: fast, default or precise", 8 },
+  { "--EmL",      eslARG_INT,    NULL, NULL, "n>0",     NULL,      NULL,    NULL, "length of sequences for MSV Gumbel mu fit (overrides --preset)",     8 },
+  { "--EmN",      eslARG_INT,    NULL, NULL, "n>0",     NULL,      NULL,    NULL, "number of sequences for MSV Gumbel mu fit (overrides --preset)",     8 },
+  { "--EvL",      eslARG_INT,    NULL, NULL, "n>0",     NULL,      NULL,    NULL, "length of sequences for Viterbi Gumbel mu fit (overrides --preset)", 8 },
+  { "--EvN",      eslARG_INT,    NULL, NULL, "n>0",     NULL,      NULL,    NULL, "number of sequences for Viterbi Gumbel mu fit (overrides --preset)", 8 },
+  { "--EfL",      eslARG_INT,    NULL, NULL, "n>0",     NULL,      NULL,    NULL, "length of sequences for Forward exp tail tau fit (overrides --preset)", 8 },
+  { "--EfN",      eslARG_INT,    NULL, NULL, "n>0",     NULL,      NULL,    NULL, "number of sequences for Forward exp tail tau fit (overrides --preset)", 8 },
+  { "--Eft",      eslARG_REAL,   NULL, NULL, "0<x<1",   NULL,      NULL,    NULL, "tail mass for Forward exponential tail tau fit (overrides --preset)",   8 },
+#ifdef HMMER_THREADS
+  { "--calib-cpu", eslARG_INT,   "0", NULL, "n>=0",     NULL,      NULL,    NULL, "threads to share each model's calibration over",        8 },
+#endif
+  { "--calib-tol", eslARG_REAL,  "0", NULL, "x>=0",     NULL,      NULL,    NULL, "stop calibrating once mu, tau std errors are < <x> bits", 8 },
+  { "--calib-lookup", eslARG_INFILE,  NULL, NULL, NULL, NULL,      NULL, "--calib-tol,--build-lookup", "interpolate E-value parameters from lookup table <f>; no simulation", 8 },
+  { "--calib-cache", eslARG_OUTFILE,  NULL, NULL, NULL,  NULL,      NULL, "--build-lookup", "reuse, and save, simulated E-value parameters in cache file <f>", 8 },
+#ifdef HMMER_THREADS
+  { "--cpu",      eslARG_INT,   NULL, "HMMER_NCPU", "n>=0", NULL,  NULL,    NULL, "number of parallel CPU workers, each calibrating whole models", 8 },
+  { "--reorder-window", eslARG_INT, "256", NULL, "n>0", NULL,      NULL, "--build-lookup", "hold at most <n> models finished ahead of their turn", 8 },
+#endif
+  { "--calib-stamp", eslARG_NONE,  FALSE, NULL, NULL,   NULL,      NULL, "--calib-lookup,--build-lookup", "stamp calibrated models with a parameter fingerprint, for --missing-only", 8 },
+  { "--missing-only", eslARG_NONE,  FALSE, NULL, NULL,  NULL,      NULL, "--build-lookup", "pass through models whose calibration is still current; stamp the rest", 8 },
+  { "--build-lookup", eslARG_OUTFILE, NULL, NULL, NULL, NULL,      NULL,    NULL, "build a lookup table for --calib-lookup by simulation, into <f>", 8 },
+  { "--lookup-abc", eslARG_STRING, "amino", NULL, NULL, NULL, "--build-lookup", NULL, "alphabet of the --build-lookup table: amino, dna or rna", 8 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
 static char usage[]  = "[-options] <input hmmfile> <output hmmfile>";
 static char banner[] = "calibrate HMM search statistics";
+
+/**
+ * create_builder()
+ *
+ * A P7_BUILDER for models in <abc> that carries the calibration
+ * settings: those of --preset, with any of --EmL..--Eft given
+ * overriding them.
+ */
+static P7_BUILDER *
+create_builder(const ESL_GETOPTS *go, const ESL_ALPHABET *abc)
+{
+  P7_BUILDER *bld;
+
+  if ((bld = profillic_p7_builder_Create(NULL, abc)) == NULL) esl_fatal("p7_builder_Create failed");
+  if (profillic_p7_builder_SetCalibration(bld, esl_opt_GetString(go, "--preset")) != eslOK)
+    esl_fatal("unknown --preset %s: use fast, default or precise", esl_opt_GetString(go, "--preset"));
+
+  if (esl_opt_IsOn(go, "--EmL")) bld->EmL = esl_opt_GetInteger(go, "--EmL");
+  if (esl_opt_IsOn(go, "--EmN")) bld->EmN = esl_opt_GetInteger(go, "--EmN");
+  if (esl_opt_IsOn(go, "--EvL")) bld->EvL = esl_opt_GetInteger(go, "--EvL");
+  if (esl_opt_IsOn(go, "--EvN")) bld->EvN = esl_opt_GetInteger(go, "--EvN");
+  if (esl_opt_IsOn(go, "--EfL")) bld->EfL = esl_opt_GetInteger(go, "--EfL");
+  if (esl_opt_IsOn(go, "--EfN")) bld->EfN = esl_opt_GetInteger(go, "--EfN");
+  if (esl_opt_IsOn(go, "--Eft")) bld->Eft = esl_opt_GetReal   (go, "--Eft");
+  return bld;
+}
+
+/**
+ * build_lookup()
+ *
+ * --build-lookup mode: calibrate synthetic models over the default
+ * grid of model lengths and relative entropies, as <calib> and the
+ * --preset and --EmL..--Eft options say, and save the fits as a
+ * lookup table for --calib-lookup.
+ */
+static void
+build_lookup(const ESL_GETOPTS *go, const PROFILLIC_CALIBRATION *calib)
+{
+  char               *tablefile = esl_opt_GetString(go, "--build-lookup");
+  ESL_ALPHABET       *abc       = NULL;
+  ESL_RANDOMNESS     *r         = NULL;
+  P7_BUILDER         *bld       = NULL;
+  FILE               *tfp       = NULL;
+  PROFILLIC_CALIBGRID g;
+  int                 type;
+
+  if ((type = esl_abc_EncodeType(esl_opt_GetString(go, "--lookup-abc"))) == eslUNKNOWN) esl_fatal("unknown alphabet %s", esl_opt_GetString(go, "--lookup-abc"));
+  if ((abc  = esl_alphabet_Create(type))                       == NULL) esl_fatal("failed to create alphabet");
+  if ((r    = esl_randomness_CreateFast(esl_opt_GetInteger(go, "--seed"))) == NULL) esl_fatal("failed to create random number generator");
+  if ((tfp  = fopen(tablefile, "w"))                           == NULL) esl_fatal("Failed to open lookup table %s for writing", tablefile);
+  bld = create_builder(go, abc);
+
+  printf("# building %s lookup table:         %s\n", esl_abc_DecodeType(type), tablefile);
+  if (profillic_calibtable_Sweep(r, abc,
+                                 profillic_calibtable_defaultM,  sizeof(profillic_calibtable_defaultM)  / sizeof(double),
+                                 profillic_calibtable_defaultRE, sizeof(profillic_calibtable_defaultRE) / sizeof(double),
+                                 bld, calib, stdout, &g) != eslOK) esl_fatal("Unexpected error in building the lookup table");
+
+  if (fprintf(tfp, "# profillic-hmmer E-value calibration lookup table (--seed %d)\n", esl_opt_GetInteger(go, "--seed")) < 0 ||
+      profillic_calibtable_Write(tfp, &g) != eslOK) esl_fatal("lookup table write failed");
+
+  profillic_calibgrid_Release(&g);
+  profillic_p7_builder_Destroy(bld);
+  fclose(tfp);
+  esl_randomness_Destroy(r);
+  esl_alphabet_Destroy(abc);
+}
+
+/* One per worker thread (just one without threads); each has its own background and RNG. */
+typedef struct {
+#ifdef HMMER_THREADS
+  ESL_WORK_QUEUE       *queue;
+#endif
+  P7_BG                *bg;		/* made from the first model it calibrates               */
+  ESL_RANDOMNESS       *r;		/* its own RNG; only drawn from with --seed 0             */
+  P7_BUILDER           *bld;		/* calibration settings (--preset, --EmL..); made with <bg> */
+  const ESL_GETOPTS    *go;
+  PROFILLIC_CALIBRATION calib;		/* how each model is calibrated (--calib-cpu, --seed, ...) */
+  int                   missing_only;	/* TRUE to pass through models with a current calibration */
+} WORKER_INFO;
+
+#ifdef HMMER_THREADS
+typedef struct {
+  int         nhmm;		/* index of this model in the input, 1.. */
+  int         processed;
+  P7_HMM     *hmm;		/* NULL at the end of the input */
+  int         kept;		/* TRUE if passed through uncalibrated (--missing-only) */
+  PROFILLIC_CALIBRATION_STATS cstats;
+} WORK_ITEM;
+
+/* A calibrated model waiting in thread_loop()'s ring for its turn to be written */
+typedef struct {
+  int         nhmm;
+  P7_HMM     *hmm;		/* NULL if the slot is empty */
+  PROFILLIC_CALIBRATION_STATS cstats;
+} RESULT_ITEM;
+#endif /*HMMER_THREADS*/
+
+struct cfg_s {
+  char                 *hmmfile;	/* input HMM file name                  */
+  P7_HMMFILE           *hfp;		/* open input HMM file                  */
+  ESL_ALPHABET         *abc;		/* alphabet of the models, once read    */
+  FILE                 *outhmmfp;	/* output HMM file                      */
+  P7_BG                *bg;		/* background for the table of results  */
+  const PROFILLIC_CALIBTABLE *table;	/* --calib-lookup table, or NULL        */
+  const char           *tablefile;
+  double                tol;		/* --calib-tol; 0 = off, and no std error columns */
+  int                   window;		/* --reorder-window                     */
+  int                   nhmm;		/* models read so far                   */
+  int                   nkept;		/* models passed through uncalibrated   */
+};
+
+static void serial_loop(WORKER_INFO *info, struct cfg_s *cfg);
+#ifdef HMMER_THREADS
+static void thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, struct cfg_s *cfg);
+static void pipeline_thread(void *arg);
+#endif
+static int  read_hmm(struct cfg_s *cfg, P7_HMM **ret_hmm);
+static void calibrate_hmm(WORKER_INFO *info, P7_HMM *hmm, int *ret_kept);
+static void output_result(struct cfg_s *cfg, int nhmm, P7_HMM *hmm, const PROFILLIC_CALIBRATION_STATS *cstats);
+
 /**
  * int main(int argc, char **argv) 
  * main driver
@@ -132,16 +305,20 @@ int
 main(int argc, char **argv)
 {
   ESL_GETOPTS     *go	   = NULL;      /* command line processing                   */
-  ESL_ALPHABET    *abc     = NULL;
   char            *hmmfile = NULL;
   char            *outhmmfile = NULL;
   P7_HMMFILE      *hfp     = NULL;
   FILE         *outhmmfp;          /* HMM output file handle                  */
-  P7_HMM          *hmm     = NULL;
-  P7_BG           *bg      = NULL;
-  int              nhmm;	
-  double           x;
-  float            KL;
+  struct cfg_s     cfg;
+  WORKER_INFO     *info    = NULL;
+  int              infocnt;
+  int              ncpus   = 0;
+#ifdef HMMER_THREADS
+  WORK_ITEM       *item     = NULL;
+  ESL_THREADS     *threadObj= NULL;
+  ESL_WORK_QUEUE  *queue    = NULL;
+#endif
+  int              i;
   int              status;
   char             errbuf[eslERRBUFSIZE];
 
@@ -149,8 +326,10 @@ main(int argc, char **argv)
 
   /* Run-to-run variation due to random number generation                                          */
   int         seed;
-  ESL_RANDOMNESS      *r;	         /* RNG for E-value calibration simulations                */
-  int                  do_reseeding;	 /* TRUE to reseed, making results reproducible            */
+  ESL_RANDOMNESS      *r;	         /* seeds the workers' RNGs (with --seed 0)                 */
+  PROFILLIC_CALIBRATION calib;           /* how each model is calibrated (--calib-cpu, --seed)      */
+  PROFILLIC_CALIBTABLE *table = NULL;    /* --calib-lookup table                                    */
+  PROFILLIC_CALIBCACHE *cache = NULL;    /* --calib-cache file                                      */
 
   /* Process the command line options.
    */
@@ -171,7 +350,7 @@ main(int argc, char **argv)
       esl_opt_DisplayHelp(stdout, go, 0, 2, 80); /* 0=docgroup, 2 = indentation; 80=textwidth*/
       exit(0);
     }
-  if (esl_opt_ArgNumber(go) != 2) 
+  if (esl_opt_ArgNumber(go) != (esl_opt_IsOn(go, "--build-lookup") ? 0 : 2)) 
     {
       puts("Incorrect number of command line arguments.");
       esl_usage(stdout, argv[0], usage);
@@ -179,7 +358,7 @@ main(int argc, char **argv)
       exit(1);
     }
 
-  if ((hmmfile = esl_opt_GetArg(go, 1)) == NULL) 
+  if (! esl_opt_IsOn(go, "--build-lookup") && (hmmfile = esl_opt_GetArg(go, 1)) == NULL) 
     {
       puts("Failed to read <input hmmfile> argument from command line.");
       esl_usage(stdout, argv[0], usage);
@@ -187,7 +366,7 @@ main(int argc, char **argv)
       exit(1);
     }
 
-  if ((outhmmfile = esl_opt_GetArg(go, 2)) == NULL) 
+  if (! esl_opt_IsOn(go, "--build-lookup") && (outhmmfile = esl_opt_GetArg(go, 2)) == NULL) 
     {
       puts("Failed to read <output hmmfile> argument from command line.");
       esl_usage(stdout, argv[0], usage);
@@ -200,6 +379,53 @@ main(int argc, char **argv)
     if (esl_opt_GetInteger(go, "--seed") == 0) printf("# random number seed:               one-time arbitrary\n");
     else                                       printf("# random number seed set to:        %d\n", esl_opt_GetInteger(go, "--seed"));
   }
+  if (profillic_p7_builder_SetCalibration(NULL, esl_opt_GetString(go, "--preset")) != eslOK)
+    p7_Fail("unknown --preset %s: use fast, default or precise", esl_opt_GetString(go, "--preset"));
+  if (esl_opt_IsUsed(go, "--preset")) printf("# calibration preset:               %s\n", esl_opt_GetString(go, "--preset"));
+  if (esl_opt_IsUsed(go, "--EmL"))    printf("# seq length for MSV Gumbel mu fit: %d\n", esl_opt_GetInteger(go, "--EmL"));
+  if (esl_opt_IsUsed(go, "--EmN"))    printf("# seq number for MSV Gumbel mu fit: %d\n", esl_opt_GetInteger(go, "--EmN"));
+  if (esl_opt_IsUsed(go, "--EvL"))    printf("# seq length for Vit Gumbel mu fit: %d\n", esl_opt_GetInteger(go, "--EvL"));
+  if (esl_opt_IsUsed(go, "--EvN"))    printf("# seq number for Vit Gumbel mu fit: %d\n", esl_opt_GetInteger(go, "--EvN"));
+  if (esl_opt_IsUsed(go, "--EfL"))    printf("# seq length for Fwd exp tau fit:   %d\n", esl_opt_GetInteger(go, "--EfL"));
+  if (esl_opt_IsUsed(go, "--EfN"))    printf("# seq number for Fwd exp tau fit:   %d\n", esl_opt_GetInteger(go, "--EfN"));
+  if (esl_opt_IsUsed(go, "--Eft"))    printf("# tail mass for Fwd exp tau fit:    %f\n", esl_opt_GetReal(go, "--Eft"));
+#ifdef HMMER_THREADS
+  if (esl_opt_IsUsed(go, "--cpu"))       printf("# number of worker threads:         %d\n", esl_opt_GetInteger(go, "--cpu"));
+  if (esl_opt_IsUsed(go, "--reorder-window")) printf("# reorder window:                   %d\n", esl_opt_GetInteger(go, "--reorder-window"));
+  if (esl_opt_IsUsed(go, "--calib-cpu")) printf("# threads per model calibration:    %d\n", esl_opt_GetInteger(go, "--calib-cpu"));
+  calib.ncpus = esl_opt_GetInteger(go, "--calib-cpu");
+#else
+  calib.ncpus = 0;
+#endif
+  if (esl_opt_IsUsed(go, "--calib-tol")) printf("# calibration std err tolerance:    %g\n", esl_opt_GetReal(go, "--calib-tol"));
+  calib.tol   = esl_opt_GetReal(go, "--calib-tol");
+  calib.table = NULL;
+  calib.cache = NULL;
+  /* only a stamped model can be passed through by a later --missing-only run */
+  calib.stamp = esl_opt_GetBoolean(go, "--calib-stamp") || esl_opt_GetBoolean(go, "--missing-only");
+
+  if (esl_opt_IsOn(go, "--build-lookup"))
+    {
+      calib.seed = esl_opt_GetInteger(go, "--seed");
+      build_lookup(go, &calib);
+      esl_getopts_Destroy(go);
+      exit(0);
+    }
+  if (esl_opt_IsOn(go, "--calib-lookup"))
+    {
+      printf("# calibration lookup table:         %s\n", esl_opt_GetString(go, "--calib-lookup"));
+      if (profillic_calibtable_Read(esl_opt_GetString(go, "--calib-lookup"), &table, errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+      calib.table = table;
+    }
+  if (esl_opt_IsOn(go, "--calib-cache"))
+    {
+      printf("# calibration cache file:           %s\n", esl_opt_GetString(go, "--calib-cache"));
+      if (esl_opt_GetInteger(go, "--seed") == 0) p7_Fail("--calib-cache needs a fixed --seed; with --seed 0 no two calibrations are alike");
+      if (profillic_calibcache_Open(esl_opt_GetString(go, "--calib-cache"), &cache, errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+      calib.cache = cache;
+    }
+  if (calib.stamp)                              printf("# stamp calibrated models:          yes\n");
+  if (esl_opt_GetBoolean(go, "--missing-only")) printf("# recalibrate:                      only models without a current calibration\n");
   
   /* Initializations: open the input HMM file for reading
    */
@@ -212,67 +438,399 @@ main(int argc, char **argv)
    */
   if ((outhmmfp = fopen(outhmmfile, "w")) == NULL) ESL_FAIL(status, errmsg, "Failed to open HMM file %s for writing", outhmmfile);
 
-  /* Normally we reinitialize the RNG to original seed before calibrating each model.
-   * This eliminates run-to-run variation.
-   * As a special case, seed==0 means choose an arbitrary seed and shut off the
-   * reinitialization; this allows run-to-run variation.
+  /* Normally each model's simulations draw from random number streams derived
+   * from the seed and the model's own parameters, so a model calibrates the same
+   * wherever it is in the file, and whichever worker gets it. As a special case,
+   * seed==0 means choose an arbitrary seed and draw every model's streams from
+   * its worker's RNG, itself seeded from <r>; this allows run-to-run variation.
    */
   seed       = esl_opt_GetInteger(go, "--seed");
-  r            = esl_randomness_CreateFast(seed);
-  do_reseeding = (seed == 0) ? FALSE : TRUE;
+  r          = esl_randomness_CreateFast(seed);
+  calib.seed = seed;
 
-  /* Main body: read HMMs one at a time, print one line of stats
-   */
-  printf("#\n");
-  printf("# %-4s %-20s %-12s %8s %8s %6s %6s %6s %6s %6s\n", "idx",  "name",                 "accession",    "nseq",     "eff_nseq", "M",      "relent", "info",   "p relE", "compKL");
-  printf("# %-4s %-20s %-12s %8s %8s %6s %6s %6s %6s %6s\n", "----", "--------------------", "------------", "--------", "--------", "------", "------", "------", "------", "------");
+  cfg.hmmfile   = hmmfile;
+  cfg.hfp       = hfp;
+  cfg.abc       = NULL;
+  cfg.outhmmfp  = outhmmfp;
+  cfg.bg        = NULL;
+  cfg.table     = table;
+  cfg.tablefile = (table != NULL ? esl_opt_GetString(go, "--calib-lookup") : NULL);
+  cfg.tol       = calib.tol;
+#ifdef HMMER_THREADS
+  cfg.window    = esl_opt_GetInteger(go, "--reorder-window");
+#endif
+  cfg.nhmm      = 0;
+  cfg.nkept     = 0;
+
+#ifdef HMMER_THREADS
+  if (esl_opt_IsOn(go, "--cpu")) ncpus = esl_opt_GetInteger(go, "--cpu");
+  else                           esl_threads_CPUCount(&ncpus);
 
-  nhmm = 0;
-  while ((status = p7_hmmfile_Read(hfp, &abc, &hmm)) != eslEOF) 
+  if (ncpus > 0)
     {
-      if      (status == eslEOD)       esl_fatal("read failed, HMM file %s may be truncated?", hmmfile);
-      else if (status == eslEFORMAT)   esl_fatal("bad file format in HMM file %s",             hmmfile);
-      else if (status == eslEINCOMPAT) esl_fatal("HMM file %s contains different alphabets",   hmmfile);
-      else if (status != eslOK)        esl_fatal("Unexpected error in reading HMMs from %s",   hmmfile);
-      nhmm++;
+      threadObj = esl_threads_Create(&pipeline_thread);
+      queue     = esl_workqueue_Create(ncpus * 2);
+    }
+#endif
 
-      if (bg == NULL) bg = p7_bg_Create(abc);
+  infocnt = (ncpus == 0) ? 1 : ncpus;
+  ESL_ALLOC_CPP( WORKER_INFO, info, sizeof(*info) * infocnt);
 
-      /// \todo Add use of profillic-p7_builder and command-line args to control calibration.
-      if ((status = p7_Calibrate(hmm, NULL, &r, &bg, NULL, NULL)) != eslOK) esl_fatal("Unexpected error in calibrating the hmm");
+  for (i = 0; i < infocnt; ++i)
+    {
+      info[i].bg           = NULL;
+      info[i].bld          = NULL;
+      info[i].go           = go;
+      info[i].r            = esl_randomness_CreateFast(seed == 0 ? 1 + esl_rnd_Roll(r, 2147483646) : seed);
+      info[i].calib        = calib;
+      info[i].missing_only = esl_opt_GetBoolean(go, "--missing-only");
+#ifdef HMMER_THREADS
+      info[i].queue = queue;
+      if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
+#endif
+    }
 
-      if( do_reseeding ) {
-        // For next time, reset the RNG to what it was this time..
-        esl_randomness_Init(r, esl_randomness_GetSeed(r));
-      }
+#ifdef HMMER_THREADS
+  for (i = 0; i < ncpus * 2; ++i)
+    {
+      ESL_ALLOC_CPP( WORK_ITEM, item, sizeof(*item));
 
-      if ((status = p7_hmm_Validate(hmm, errmsg, 0.0001))       != eslOK) return status;
-      if ((status = p7_hmmfile_WriteASCII(outhmmfp, -1, hmm)) != eslOK) ESL_FAIL(status, errmsg, "HMM save failed");
-  
-      p7_MeanPositionRelativeEntropy(hmm, bg, &x); 
-      p7_hmm_CompositionKLDist(hmm, bg, &KL, NULL);
-
-      printf("%-6d %-20s %-12s %8d %8.2f %6d %6.2f %6.2f %6.2f %6.2f\n",
-	     nhmm,
-	     hmm->name,
-	     hmm->acc == NULL ? "-" : hmm->acc,
-	     hmm->nseq,
-	     hmm->eff_nseq,
-	     hmm->M,
-	     p7_MeanMatchRelativeEntropy(hmm, bg),
-	     p7_MeanMatchInfo(hmm, bg),
-	     x,
-	     KL);
-
-	     /*	     p7_MeanForwardScore(hmm, bg)); */
+      item->nhmm      = 0;
+      item->processed = FALSE;
+      item->hmm       = NULL;
+      item->kept      = FALSE;
 
-      p7_hmm_Destroy(hmm);
+      status = esl_workqueue_Init(queue, item);
+      if (status != eslOK) esl_fatal("Failed to add block to work queue");
     }
+#endif
 
-  p7_bg_Destroy(bg);
-  esl_alphabet_Destroy(abc);
+  /* Main body: read HMMs one at a time, print one line of stats
+   */
+  printf("#\n");
+  if (cfg.tol > 0.) {
+    printf("# %-4s %-20s %-12s %8s %8s %6s %6s %6s %6s %6s %6s %6s %6s\n", "idx",  "name",                 "accession",    "nseq",     "eff_nseq", "M",      "relent", "info",   "p relE", "compKL", "EfN",    "mu se",  "tau se");
+    printf("# %-4s %-20s %-12s %8s %8s %6s %6s %6s %6s %6s %6s %6s %6s\n", "----", "--------------------", "------------", "--------", "--------", "------", "------", "------", "------", "------", "------", "------", "------");
+  } else {
+    printf("# %-4s %-20s %-12s %8s %8s %6s %6s %6s %6s %6s\n", "idx",  "name",                 "accession",    "nseq",     "eff_nseq", "M",      "relent", "info",   "p relE", "compKL");
+    printf("# %-4s %-20s %-12s %8s %8s %6s %6s %6s %6s %6s\n", "----", "--------------------", "------------", "--------", "--------", "------", "------", "------", "------", "------");
+  }
+
+#ifdef HMMER_THREADS
+  if (ncpus > 0) thread_loop(threadObj, queue, &cfg);
+  else           serial_loop(info, &cfg);
+#else
+  serial_loop(info, &cfg);
+#endif
+  if (esl_opt_GetBoolean(go, "--missing-only")) printf("# %d of %d models already calibrated, passed through\n", cfg.nkept, cfg.nhmm);
+
+  for (i = 0; i < infocnt; ++i)
+    {
+      p7_bg_Destroy(info[i].bg);
+      profillic_p7_builder_Destroy(info[i].bld);
+      esl_randomness_Destroy(info[i].r);
+    }
+  free(info);
+
+#ifdef HMMER_THREADS
+  if (ncpus > 0)
+    {
+      esl_workqueue_Reset(queue);
+      while (esl_workqueue_Remove(queue, (void **) &item) == eslOK) free(item);
+      esl_workqueue_Destroy(queue);
+      esl_threads_Destroy(threadObj);
+    }
+#endif
+
+  p7_bg_Destroy(cfg.bg);
+  esl_randomness_Destroy(r);
+  profillic_calibtable_Destroy(table);
+  profillic_calibcache_Destroy(cache);
+  esl_alphabet_Destroy(cfg.abc);
   p7_hmmfile_Close(hfp);
   if (outhmmfp != NULL) fclose(outhmmfp);
  esl_getopts_Destroy(go);
   exit(0);
+
+ ERROR:
+  esl_fatal("profillic-hmmcalibrate: memory allocation failed");
+}
+
+/**
+ * read_hmm()
+ *
+ * Read the next model from <cfg->hfp> into <*ret_hmm>. The first one
+ * sets the alphabet, and with it the background for the table of
+ * results. Returns <eslOK>, or <eslEOF> at the end of the input with
+ * <*ret_hmm> NULL; dies on a read error.
+ */
+static int
+read_hmm(struct cfg_s *cfg, P7_HMM **ret_hmm)
+{
+  int status;
+
+  *ret_hmm = NULL;
+  status   = p7_hmmfile_Read(cfg->hfp, &(cfg->abc), ret_hmm);
+  if      (status == eslEOF)       { *ret_hmm = NULL; return eslEOF; }
+  else if (status == eslEOD)       esl_fatal("read failed, HMM file %s may be truncated?", cfg->hmmfile);
+  else if (status == eslEFORMAT)   esl_fatal("bad file format in HMM file %s",             cfg->hmmfile);
+  else if (status == eslEINCOMPAT) esl_fatal("HMM file %s contains different alphabets",   cfg->hmmfile);
+  else if (status != eslOK)        esl_fatal("Unexpected error in reading HMMs from %s",   cfg->hmmfile);
+
+  if (cfg->bg == NULL) {
+    cfg->bg = p7_bg_Create(cfg->abc);
+    if (cfg->table != NULL && profillic_calibtable_Grid(cfg->table, cfg->abc->type) == NULL)
+      esl_fatal("calibration table %s has no %s grid", cfg->tablefile, esl_abc_DecodeType(cfg->abc->type));
+  }
+  return eslOK;
+}
+
+/**
+ * calibrate_hmm()
+ *
+ * Calibrate and validate one model with <info>'s background and RNG,
+ * leaving how it went in <info->calib.last>. With --missing-only, a
+ * model whose calibration is still current is left as it is, and
+ * <*ret_kept> is TRUE.
+ */
+static void
+calibrate_hmm(WORKER_INFO *info, P7_HMM *hmm, int *ret_kept)
+{
+  char errbuf[eslERRBUFSIZE];
+
+  errbuf[0] = '\0';
+  if (info->bg  == NULL) info->bg  = p7_bg_Create(hmm->abc);
+  if (info->bld == NULL) info->bld = create_builder(info->go, hmm->abc);
+
+  /* with --missing-only, keep a calibration that is still current: not interpolated, and
+   * stamped for the parameters the model has now */
+  if (info->missing_only && profillic_calibration_IsCurrent(hmm))
+    {
+      info->calib.last.nm     = info->calib.last.nv     = info->calib.last.nf     = 0;
+      info->calib.last.mmu_se = info->calib.last.vmu_se = info->calib.last.tau_se = -1.;
+      *ret_kept = TRUE;
+      return;
+    }
+
+  /* from the cache, the lookup table, or by simulation; a simulated model loses any lookup tag it had */
+  if (profillic_Calibrate(hmm, info->bld, &(info->r), &(info->bg), NULL, NULL, &(info->calib), errbuf) != eslOK) esl_fatal("Unexpected error in calibrating the hmm: %s", errbuf);
+  if (p7_hmm_Validate(hmm, errbuf, 0.0001) != eslOK) esl_fatal("calibrated model %s failed validation: %s", hmm->name, errbuf);
+  *ret_kept = FALSE;
+}
+
+/**
+ * output_result()
+ *
+ * Save model number <nhmm> to the output HMM file, and print its line
+ * of the table of results; <cstats> says how its calibration went.
+ */
+static void
+output_result(struct cfg_s *cfg, int nhmm, P7_HMM *hmm, const PROFILLIC_CALIBRATION_STATS *cstats)
+{
+  double x;
+  float  KL;
+  char   muse[16], tause[16];	/* calibration std errors, or "-" if unknown */
+
+  if (p7_hmmfile_WriteASCII(cfg->outhmmfp, -1, hmm) != eslOK) esl_fatal("HMM save failed");
+
+  p7_MeanPositionRelativeEntropy(hmm, cfg->bg, &x); 
+  p7_hmm_CompositionKLDist(hmm, cfg->bg, &KL, NULL);
+
+  /* the larger of the MSV and Viterbi mu errors */
+  if (cstats->mmu_se < 0. || cstats->vmu_se < 0.) strcpy(muse, "-");
+  else snprintf(muse, sizeof(muse), "%.3f", ESL_MAX(cstats->mmu_se, cstats->vmu_se));
+  if (cstats->tau_se < 0.) strcpy(tause, "-");
+  else snprintf(tause, sizeof(tause), "%.3f", cstats->tau_se);
+
+  printf("%-6d %-20s %-12s %8d %8.2f %6d %6.2f %6.2f %6.2f %6.2f",
+	 nhmm,
+	 hmm->name,
+	 hmm->acc == NULL ? "-" : hmm->acc,
+	 hmm->nseq,
+	 hmm->eff_nseq,
+	 hmm->M,
+	 p7_MeanMatchRelativeEntropy(hmm, cfg->bg),
+	 p7_MeanMatchInfo(hmm, cfg->bg),
+	 x,
+	 KL);
+  if (cfg->tol > 0.) printf(" %6d %6s %6s", cstats->nf, muse, tause);
+  printf("\n");
+
+	 /*	     p7_MeanForwardScore(hmm, bg)); */
+}
+
+static void
+serial_loop(WORKER_INFO *info, struct cfg_s *cfg)
+{
+  P7_HMM *hmm = NULL;
+  int     kept;
+
+  while (read_hmm(cfg, &hmm) == eslOK)
+    {
+      cfg->nhmm++;
+      calibrate_hmm(info, hmm, &kept);
+      if (kept) cfg->nkept++;
+      output_result(cfg, cfg->nhmm, hmm, &(info->calib.last));
+      p7_hmm_Destroy(hmm);
+    }
+}
+
+#ifdef HMMER_THREADS
+/**
+ * thread_loop()
+ *
+ * The master thread reads models into idle work items and hands them
+ * to the workers through <queue>; as they come back calibrated, it
+ * writes them out in input order. A model finished ahead of its turn
+ * waits in a ring of --reorder-window slots, at slot nhmm % window,
+ * until the ones before it are written. No model is read whose slot
+ * would still be taken, so a slow model at the head of the ring holds
+ * up reading rather than letting it run ever further ahead.
+ */
+static void
+thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, struct cfg_s *cfg)
+{
+  int          status    = eslOK;
+  int          processed = 0;
+  int          eof       = FALSE;
+  int          nworkers  = esl_threads_GetWorkerCount(obj);
+  int          window    = cfg->window;
+  WORK_ITEM   *item;
+  void        *newItem;
+  WORK_ITEM  **idle      = NULL;	/* work items back from the workers, not yet handed out again */
+  int          nidle     = 0;
+  RESULT_ITEM *ring      = NULL;	/* ring[nhmm % window]: models finished ahead of their turn */
+  RESULT_ITEM *r;
+  int          next      = 1;		/* nhmm of the next model to write */
+  int          i;
+
+  ESL_ALLOC_CPP(WORK_ITEM*,  idle, sizeof(WORK_ITEM *) * nworkers * 2);
+  ESL_ALLOC_CPP(RESULT_ITEM, ring, sizeof(RESULT_ITEM) * window);
+  for (i = 0; i < window; i++) ring[i].hmm = NULL;
+
+  esl_workqueue_Reset(queue);
+  esl_threads_WaitForStart(obj);
+
+  status = esl_workqueue_ReaderUpdate(queue, NULL, &newItem);
+  if (status != eslOK) esl_fatal("Work queue reader failed");
+  idle[nidle++] = (WORK_ITEM *) newItem;
+
+  /* Main loop: */
+  while (TRUE) {
+    /* hand out idle items, while the ring has room for their results */
+    while (nidle > 0 && ! eof && cfg->nhmm + 1 - next < window) {
+      item = idle[nidle-1];
+      if (read_hmm(cfg, &item->hmm) == eslEOF) { eof = TRUE; break; }
+      item->nhmm = ++cfg->nhmm;
+
+      nidle--;
+      status = esl_workqueue_ReaderUpdate(queue, item, NULL);
+      if (status != eslOK) esl_fatal("Work queue reader failed");
+    }
+    if (eof && processed == cfg->nhmm) break;
+
+    /* wait for an item back: a calibrated model, or one not yet handed out */
+    status = esl_workqueue_ReaderUpdate(queue, NULL, &newItem);
+    if (status != eslOK) esl_fatal("Work queue reader failed");
+    item = (WORK_ITEM *) newItem;
+
+    if (item->processed == TRUE) {
+      ++processed;
+      if (item->kept) cfg->nkept++;
+
+      /* keep the output order the same as the input's */
+      if (item->nhmm == next) {
+	output_result(cfg, item->nhmm, item->hmm, &(item->cstats));
+	p7_hmm_Destroy(item->hmm);
+	++next;
+
+	/* output any waiting models, as long as the order remains the same as read in */
+	for (r = &(ring[next % window]); r->hmm != NULL; r = &(ring[next % window])) {
+	  output_result(cfg, r->nhmm, r->hmm, &(r->cstats));
+	  p7_hmm_Destroy(r->hmm);
+	  r->hmm = NULL;
+	  ++next;
+	}
+      } else {
+	r = &(ring[item->nhmm % window]);
+	r->nhmm   = item->nhmm;
+	r->hmm    = item->hmm;
+	r->cstats = item->cstats;
+      }
+
+      item->nhmm      = 0;
+      item->processed = FALSE;
+      item->hmm       = NULL;
+      item->kept      = FALSE;
+    }
+    idle[nidle++] = item;
+  }
+
+  /* an item with no model stops the worker that takes it */
+  for (i = 0; i < nworkers; i++) {
+    if (nidle == 0) {
+      status = esl_workqueue_ReaderUpdate(queue, NULL, &newItem);
+      if (status != eslOK) esl_fatal("Work queue reader failed");
+      idle[nidle++] = (WORK_ITEM *) newItem;
+    }
+    status = esl_workqueue_ReaderUpdate(queue, idle[--nidle], NULL);
+    if (status != eslOK) esl_fatal("Work queue reader failed");
+  }
+  while (nidle > 0) {
+    status = esl_workqueue_ReaderUpdate(queue, idle[--nidle], NULL);
+    if (status != eslOK) esl_fatal("Work queue reader failed");
+  }
+
+  /* wait for all the threads to complete */
+  esl_threads_WaitForFinish(obj);
+  esl_workqueue_Complete(queue);
+
+  free(idle);
+  free(ring);
+  return;
+
+ ERROR:
+  p7_Fail("thread_loop failed: memory allocation problem");
+}
+
+static void
+pipeline_thread(void *arg)
+{
+  int           workeridx;
+  int           status;
+
+  WORK_ITEM    *item;
+  void         *newItem;
+
+  WORKER_INFO  *info;
+  ESL_THREADS  *obj;
+
+  obj = (ESL_THREADS *) arg;
+  esl_threads_Started(obj, &workeridx);
+
+  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+
+  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newItem);
+  if (status != eslOK) esl_fatal("Work queue worker failed");
+
+  /* loop until all models have been calibrated */
+  item = (WORK_ITEM *) newItem;
+  while (item->hmm != NULL)
+    {
+      calibrate_hmm(info, item->hmm, &(item->kept));
+      item->cstats    = info->calib.last;
+      item->processed = TRUE;
+
+      status = esl_workqueue_WorkerUpdate(info->queue, item, &newItem);
+      if (status != eslOK) esl_fatal("Work queue worker failed");
+
+      item = (WORK_ITEM *) newItem;
+    }
+
+  status = esl_workqueue_WorkerUpdate(info->queue, item, NULL);
+  if (status != eslOK) esl_fatal("Work queue worker failed");
+
+  esl_threads_Finished(obj, workeridx);
+  return;
 }
+#endif   /* HMMER_THREADS */
@@ -14,7 +14,8 @@
 Usage: profillic-hmmtoprofile [-options] <input hmmfile> <output galosh profile>
 
 Options:
-  -h : show brief help on version and usage
+  -h       : show brief help on version and usage
+  --binary : write a binary (mmap-able) galosh profile
 </pre>
  */
 extern "C" {
@@ -37,6 +38,8 @@ extern "C" {
 
 /* ////////////// For profillic-hmmer ////////////////////////////////// */
 #include "profillic-hmmer.hpp"
+#include "profillic-profilefile.hpp"
+#include "profillic-residuemap.hpp"
 
 #include <iostream>
 
@@ -124,7 +127,8 @@ convert_to_galosh_profile ( P7_HMM * hmm, ProfileType & profile )
 
   uint32_t pos_i; // Position in profile.  Corresponds to one less than match state pos in HMM.
   uint32_t res_i;
-  ESL_DSQ hmmer_digitized_residue;
+  profillic_residuemap_s<ResidueType> const resmap( hmm->abc );
+  const uint32_t K = profillic_residuemap_s<ResidueType>::K;
 
   /* How many match states in the HMM? */
   if( hmm->M == 0 ) { status = eslENORESULT; goto ERROR; }
@@ -148,12 +152,10 @@ convert_to_galosh_profile ( P7_HMM * hmm, ProfileType & profile )
     hmm->t[ 0 ][ p7H_II ];
   profile[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toBegin ] =
     hmm->t[ 0 ][ p7H_IM ];
-  for( res_i = 0; res_i < seqan::ValueSize<ResidueType>::VALUE; res_i++ ) {
-    hmmer_digitized_residue =
-      esl_abc_DigitizeSymbol( hmm->abc, static_cast<char>( ResidueType( res_i ) ) );
+  for( res_i = 0; res_i < K; res_i++ ) {
     // See below where it says "TODO/NOTE"..
     profile[ galosh::Emission::PreAlignInsertion ][ res_i ] =
-      hmm->ins[ 0 ][ hmmer_digitized_residue ];
+      hmm->ins[ 0 ][ resmap[ res_i ] ];
   }
 
   // fromBegin
@@ -167,21 +169,22 @@ convert_to_galosh_profile ( P7_HMM * hmm, ProfileType & profile )
 //      cout << '.';
 //      cout.flush();
 //    }
-    // TODO: If this is too slow, memoize the ResidueType( res_i )s.
-    for( res_i = 0; res_i < seqan::ValueSize<ResidueType>::VALUE; res_i++ ) {
-      hmmer_digitized_residue =
-        esl_abc_DigitizeSymbol( hmm->abc, static_cast<char>( ResidueType( res_i ) ) );
+    for( res_i = 0; res_i < K; res_i++ ) {
       profile[ pos_i ][ galosh::Emission::Match ][ res_i ] =
-        hmm->mat[ pos_i + 1 ][ hmmer_digitized_residue ];
-      if( pos_i == ( profile.length() - 1 ) ) {
-        // Use post-align insertions
+        hmm->mat[ pos_i + 1 ][ resmap[ res_i ] ];
+    } // End foreach res_i
+    if( pos_i == ( profile.length() - 1 ) ) {
+      // Use post-align insertions
+      for( res_i = 0; res_i < K; res_i++ ) {
         profile[ galosh::Emission::PostAlignInsertion ][ res_i ] =
-          hmm->ins[ pos_i + 1 ][ hmmer_digitized_residue ];
-      } else { // if this is the last position (use post-align insertions) .. else ..
+          hmm->ins[ pos_i + 1 ][ resmap[ res_i ] ];
+      } // End foreach res_i
+    } else { // if this is the last position (use post-align insertions) .. else ..
+      for( res_i = 0; res_i < K; res_i++ ) {
         profile[ galosh::Emission::Insertion ][ res_i ] +=
-          hmm->ins[ pos_i + 1 ][ hmmer_digitized_residue ];
-      } // End if this is the last position (use post-align insertions) .. else ..
-    } // End foreach res_i
+          hmm->ins[ pos_i + 1 ][ resmap[ res_i ] ];
+      } // End foreach res_i
+    } // End if this is the last position (use post-align insertions) .. else ..
     if( pos_i == ( profile.length() - 1 ) ) {
       // Use post-align insertions
       profile[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toTerminal ] =
@@ -217,11 +220,51 @@ convert_to_galosh_profile ( P7_HMM * hmm, ProfileType & profile )
   return status;
 } // convert_to_galosh_profile (..)
 
+/**
+ * <pre>
+ * Function:  write_galosh_profile()
+ * Synopsis:  Save a converted profile, as text or as a binary record.
+ *
+ * Purpose:   Write <profile> to file <outfile>: in the galosh text
+ *            format, or if <binary> is TRUE, as a binary profile
+ *            record (see profillic-profilefile.hpp) carrying <hmm>'s
+ *            name and accession as metadata.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if <outfile> can't be opened for writing.
+ *
+ * Throws:    <eslEWRITE> on a write failure.
+ * </pre>
+ */
+template <typename ProfileType>
+static int
+write_galosh_profile(const char *outfile, int binary, const P7_HMM *hmm, ProfileType const & profile)
+{
+  if (binary) {
+    const char *keys[2] = { "name",    "acc"    };
+    const char *vals[2] = { hmm->name, hmm->acc };
+    FILE       *fp;
+    int         status;
+
+    if ((fp = fopen(outfile, "wb")) == NULL) return eslENOTFOUND;
+    status = profillic_profilefile_WriteBinary(fp, profile, 2, keys, vals);
+    if (fclose(fp) != 0 && status == eslOK) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+    return status;
+  }
+
+  std::ofstream fs ( outfile );
+  if( !fs.is_open() ) return eslENOTFOUND;
+  fs << profile;
+  fs.close();
+  return eslOK;
+} // write_galosh_profile (..)
+
 /* ////////////// End profillic-hmmer ////////////////////////////////// */
 
 static ESL_OPTIONS options[] = {
   /* name           type      default  env  range     toggles   reqs   incomp  help   docgroup*/
   { "-h",        eslARG_NONE,   FALSE, NULL, NULL,      NULL,  NULL, NULL, "show brief help on version and usage",            0 },
+  { "--binary",  eslARG_NONE,   FALSE, NULL, NULL,      NULL,  NULL, NULL, "write a binary (mmap-able) galosh profile",       0 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
@@ -322,25 +365,11 @@ main(int argc, char **argv)
       if( abc->type == eslDNA ) {
         galosh::ProfileTreeRoot<seqan::Dna, floatrealspace> profile;
         if( (status = convert_to_galosh_profile( hmm, profile )) != eslOK ) esl_fatal("Unexpected error in converting HMM from file %s to a dna galosh profile",   hmmfile);
-        std::ofstream fs ( outhmmfile );
-    
-        if( !fs.is_open() ) {
-          esl_fatal("Unexpected error in opening the file %s for writing", outhmmfile);
-        } else {
-          fs << profile;
-          fs.close();
-        }
+        if( (status = write_galosh_profile( outhmmfile, esl_opt_GetBoolean(go, "--binary"), hmm, profile )) != eslOK ) esl_fatal("Unexpected error in writing the galosh profile to file %s", outhmmfile);
       } else if( abc->type == eslAMINO ) {
         galosh::ProfileTreeRoot<seqan::AminoAcid20, floatrealspace> profile;
         if( (status = convert_to_galosh_profile( hmm, profile )) != eslOK ) esl_fatal("Unexpected error in converting HMM from file %s to an amino galosh profile",   hmmfile);
-        std::ofstream fs ( outhmmfile );
-    
-        if( !fs.is_open() ) {
-          esl_fatal("Unexpected error in opening the file %s for writing", outhmmfile);
-        } else {
-          fs << profile;
-          fs.close();
-        }
+        if( (status = write_galosh_profile( outhmmfile, esl_opt_GetBoolean(go, "--binary"), hmm, profile )) != eslOK ) esl_fatal("Unexpected error in writing the galosh profile to file %s", outhmmfile);
       } else {
         ESL_EXCEPTION(eslEUNIMPLEMENTED, "Sorry, at present the profillic-hmmtoprofile software can only handle amino and dna.");
       }
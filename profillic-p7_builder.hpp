@@ -20,6 +20,11 @@ extern "C" {
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 extern "C" {
 #include "easel.h"
@@ -55,15 +60,34 @@ extern "C" {
 /* ////////////// For profillic-hmmer ////////////////////////////////// */
 /// Stuff we needed to modify in order to compile it in c++:
 #include "profillic-hmmer.hpp"
+#include "profillic-p7_hmm.hpp"
+#include "profillic-evalues.hpp"
+#include "profillic-calibtable.hpp"
+#include "profillic-calibcache.hpp"
+#include "profillic-residuemap.hpp"
 #include <seqan/basic.h>
 
+/* Tail extrapolation in profillic_p7_Builder_MaxLength(), if asked for: how
+ * closely and for how many columns the limiting ratio must hold, what fraction
+ * of a column a jump may be off by, how many columns to leave to the DP at the
+ * end, and the shortest jump worth taking. */
+#define PROFILLIC_MAXLENGTH_RTOL     1e-12
+#define PROFILLIC_MAXLENGTH_NSTABLE  16
+#define PROFILLIC_MAXLENGTH_COLTOL   1e-3
+#define PROFILLIC_MAXLENGTH_GUARD    8
+#define PROFILLIC_MAXLENGTH_MINJUMP  64
+/* Models advanced together by profillic_p7_Builder_MaxLengthBatch(): a 128-bit register of doubles. */
+#define PROFILLIC_MAXLENGTH_LANES    2
+
 // Forward declarations
 void
 profillic_p7_builder_Destroy(P7_BUILDER *bld);
 static int
 profillic_annotate_model(P7_HMM *hmm, ESL_MSA * msa);
 int
-profillic_p7_Builder_MaxLength (P7_HMM *hmm, double emit_thresh);
+profillic_p7_Builder_MaxLength (P7_HMM *hmm, double emit_thresh, int extrapolate = FALSE);
+int
+profillic_p7_Builder_MaxLengthBatch (P7_HMM **hmm, int nhmm, double emit_thresh, int extrapolate = FALSE);
 //
 /* ////////////// End profillic-hmmer ////////////////////////////////// */
 
@@ -175,7 +199,7 @@ profillic_p7_builder_Create(const ESL_GETOPTS *go, const ESL_ALPHABET *abc)
   bld->do_reseeding = (seed == 0) ? FALSE : TRUE;
 
   // NOTE: this is now redundant with the new --pnone and --plaplace arguments.  Remove these, after verifying that they're the same.
-  if(esl_opt_GetBoolean(go, "--noprior") || esl_opt_GetBoolean(go, "--laplace")) {
+  if (go != NULL && esl_opt_GetBoolean(go, "--noprior")) {
     /// \note NOTE: we need the prior to be initialized for the rest of the
     /// code to work.  A laplace prior (eg a dirichlet with all "1"s)
     /// should have no effect in most cases.  See below in
@@ -205,6 +229,62 @@ profillic_p7_builder_Create(const ESL_GETOPTS *go, const ESL_ALPHABET *abc)
   return NULL;
 }
 
+/**
+ * PROFILLIC_CALIBRATION_PRESET
+ *
+ * Named settings for the E-value calibration simulations. "default"
+ * is H3's own; the others change only how many sequences each fit
+ * uses, since the fitted mu's depend on the simulated lengths.
+ */
+typedef struct {
+  const char *name;
+  int         EmL, EmN, EvL, EvN, EfL, EfN;
+  double      Eft;
+} PROFILLIC_CALIBRATION_PRESET;
+
+static const PROFILLIC_CALIBRATION_PRESET profillic_calibration_presets[] = {
+  /* name       EmL   EmN  EvL   EvN  EfL   EfN   Eft */
+  { "fast",     200,  100, 200,  100, 100,  100, 0.04 },
+  { "default",  200,  200, 200,  200, 100,  200, 0.04 },
+  { "precise",  200, 1000, 200, 1000, 100, 1000, 0.04 },
+  { NULL,         0,    0,   0,    0,   0,    0, 0.   },
+};
+
+/**
+ * <pre>
+ * Function:  profillic_p7_builder_SetCalibration()
+ * Synopsis:  Set a builder's calibration simulations from a named preset.
+ *
+ * Purpose:   Set <bld>'s <EmL>, <EmN>, <EvL>, <EvN>, <EfL>, <EfN> and
+ *            <Eft> from the preset called <name>: "fast", "default",
+ *            or "precise". A NULL <bld> just checks the name.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if there is no such preset; <bld> is unchanged.
+ * </pre>
+ */
+static int
+profillic_p7_builder_SetCalibration(P7_BUILDER *bld, const char *name)
+{
+  const PROFILLIC_CALIBRATION_PRESET *p;
+
+  for (p = profillic_calibration_presets; p->name != NULL; p++)
+    if (strcmp(p->name, name) == 0) break;
+  if (p->name == NULL) return eslENOTFOUND;
+
+  if (bld != NULL)
+    {
+      bld->EmL = p->EmL;
+      bld->EmN = p->EmN;
+      bld->EvL = p->EvL;
+      bld->EvN = p->EvN;
+      bld->EfL = p->EfL;
+      bld->EfN = p->EfN;
+      bld->Eft = p->Eft;
+    }
+  return eslOK;
+}
+
 
 /** 
  * <pre>
@@ -422,10 +502,11 @@ static int    validate_msa         (P7_BUILDER *bld, ESL_MSA *msa);
 static int    relative_weights     (P7_BUILDER *bld, ESL_MSA *msa);
 template <class ProfileType>
 static int    profillic_build_model          (P7_BUILDER *bld, ESL_MSA *msa, ProfileType const & profile, P7_HMM **ret_hmm, P7_TRACE ***opt_tr);
+static int    profillic_build_model          (P7_BUILDER *bld, ESL_MSA *msa, PROFILLIC_HMMPROFILE const * const profile_ptr, P7_HMM **ret_hmm, P7_TRACE ***opt_tr);
 static int    effective_seqnumber  (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, const P7_BG *bg);
 static int    profillic_parameterize         (P7_BUILDER *bld, P7_HMM *hmm, int const use_priors);
 static int    annotate             (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm);
-static int    calibrate            (P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om);
+static int    calibrate            (P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, const PROFILLIC_CALIBRATION *calib);
 static int    make_post_msa        (P7_BUILDER *bld, const ESL_MSA *premsa, const P7_HMM *hmm, P7_TRACE **tr, ESL_MSA **opt_postmsa);
 
 /**
@@ -448,6 +529,13 @@ static int    make_post_msa        (P7_BUILDER *bld, const ESL_MSA *premsa, cons
  *            opt_gm      - optRETURN: profile corresponding to <hmm>
  *            opt_om      - optRETURN: optimized profile corresponding to <gm>
  *            opt_postmsa - optRETURN: RF-annotated, possibly modified MSA 
+ *            use_priors  - TRUE to parameterize with <bld->prior>
+ *            calib       - optional E-value calibration settings (NULL: as p7_Calibrate())
+ *            defer_max_length - TRUE to leave a DNA/RNA model's max_length, when it
+ *                          would be computed from <bld->w_beta>, at -1 for the caller
+ *                          to set, e.g. with profillic_p7_Builder_MaxLengthBatch()
+ *            extrapolate_max_length - TRUE to let profillic_p7_Builder_MaxLength()
+ *                          extrapolate the tail of that computation
  *
  * Returns:   <eslOK> on success. The new HMM is optionally returned in
  *            <*opt_hmm>, along with optional returns of an array of faux tracebacks
@@ -472,10 +560,12 @@ template <class ProfileType>
 int
 profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const profile_ptr, P7_BG *bg,
 	   P7_HMM **opt_hmm, P7_TRACE ***opt_trarr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om,
-                     ESL_MSA **opt_postmsa, int const use_priors)
+                     ESL_MSA **opt_postmsa, int const use_priors, const PROFILLIC_CALIBRATION *calib = NULL,
+                     int const defer_max_length = FALSE, int const extrapolate_max_length = FALSE)
 {
   int i,j;
-  uint32_t    checksum = 0;	/* checksum calculated for the input MSA. hmmalign --mapali verifies against this. */
+  uint32_t    checksum = 0;	/* checksum calculated for the input MSA (or profile). hmmalign --mapali verifies against this. */
+  uint64_t    fp;
   P7_HMM     *hmm      = NULL;
   P7_TRACE  **tr       = NULL;
   P7_TRACE ***tr_ptr   = (opt_trarr != NULL || opt_postmsa != NULL) ? &tr : NULL;
@@ -484,9 +574,10 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
   // NOTE: This checks the alignment for "missing data chars" ('~'), which is not relevant to a profillic profile consensus, but should be fine to call.
   if ((status =  validate_msa         (bld, msa))                       != eslOK) goto ERROR;
 
-  // The following creates hashcode from the msa (or the consensus sequence of the galosh profile):
-  // TODO [profillic]: Consider altering this to create a checksum from the full Profile HMM somehow.
-  if ((status =  esl_msa_Checksum     (msa, &checksum))                 != eslOK) ESL_XFAIL(status, bld->errbuf, "Failed to calculate checksum"); 
+  // The following creates hashcode from the msa; for a galosh profile, it's made from the full profile's count model, below.
+  if( profile_ptr == NULL ) {
+    if ((status =  esl_msa_Checksum     (msa, &checksum))                 != eslOK) ESL_XFAIL(status, bld->errbuf, "Failed to calculate checksum"); 
+  }
 
   /// \note For now, we don't use this with profillic.  In the future, when we read in both an msa (viterbi alignments, perhaps .. or random alignment draws) and a profile, then we can use this for the msa.
   if( msa->nseq > 1 ) {
@@ -498,6 +589,12 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
 
   if ((status =  profillic_build_model          (bld, msa, profile_ptr, &hmm, tr_ptr))         != eslOK) goto ERROR;
 
+  // The count model holds every profile parameter, before any priors are mixed in.
+  if( profile_ptr != NULL ) {
+    if ((status = profillic_p7_hmm_Fingerprint(hmm, &fp)) != eslOK) ESL_XFAIL(status, bld->errbuf, "Failed to calculate checksum");
+    checksum = (uint32_t) (fp ^ (fp >> 32));
+  }
+
   //Ensures that the weighted-average I->I count <=  bld->max_insert_len
   if (bld->max_insert_len>0)
     for (i=1; i<hmm->M; i++ )   hmm->t[i][p7H_II] = ESL_MIN(hmm->t[i][p7H_II], bld->max_insert_len*hmm->t[i][p7H_MI]);
@@ -505,20 +602,23 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
   if ((status =  effective_seqnumber  (bld, msa, hmm, bg))              != eslOK) goto ERROR;
   if ((status =  profillic_parameterize (bld, hmm, use_priors))          != eslOK) goto ERROR;
   if ((status =  annotate             (bld, msa, hmm))                  != eslOK) goto ERROR;
-  if ((status =  calibrate            (bld, hmm, bg, opt_gm, opt_om))   != eslOK) goto ERROR;
-  if ((status =  make_post_msa        (bld, msa, hmm, tr, opt_postmsa)) != eslOK) goto ERROR;
 
   //force masked positions to background  (it'll be close already, so no relevant impact on weighting)
+  //before calibrating, so that the E-values, and any stamp, are for the parameters that are saved
   if (hmm->mm != NULL)
     for (i=1; i<hmm->M; i++ )
       if (hmm->mm[i] == 'm')
         for (j=0; j<hmm->abc->K; j++)
           hmm->mat[i][j] = bg->f[j];
 
+  if ((status =  calibrate            (bld, hmm, bg, opt_gm, opt_om, calib)) != eslOK) goto ERROR;
+  if ((status =  make_post_msa        (bld, msa, hmm, tr, opt_postmsa)) != eslOK) goto ERROR;
+
   if ( bld->abc->type == eslDNA ||  bld->abc->type == eslRNA ) {
 	  if (bld->w_len > 0)           hmm->max_length = bld->w_len;
 	  else if (bld->w_beta == 0.0)  hmm->max_length = hmm->M *4;
-	  else if ( (status =  profillic_p7_Builder_MaxLength(hmm, bld->w_beta)) != eslOK) goto ERROR;
+	  else if (defer_max_length)    hmm->max_length = -1;
+	  else if ( (status =  profillic_p7_Builder_MaxLength(hmm, bld->w_beta, extrapolate_max_length)) != eslOK) goto ERROR;
   }
 
   hmm->checksum = checksum;
@@ -555,6 +655,7 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
  *            opt_hmm   - optRETURN: new HMM
  *            opt_gm    - optRETURN: profile corresponding to <hmm>
  *            opt_om    - optRETURN: optimized profile corresponding to <gm>
+ *            calib     - optional E-value calibration settings, as for profillic_p7_Builder()
  *
  * Returns:   <eslOK> on success.
  *
@@ -564,7 +665,7 @@ profillic_p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const pr
  */
 int
 profillic_p7_SingleBuilder(P7_BUILDER *bld, ESL_SQ *sq, P7_BG *bg, P7_HMM **opt_hmm,
-		 P7_TRACE **opt_tr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om)
+		 P7_TRACE **opt_tr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, const PROFILLIC_CALIBRATION *calib = NULL)
 {
   P7_HMM   *hmm = NULL;
   P7_TRACE *tr  = NULL;
@@ -577,7 +678,7 @@ profillic_p7_SingleBuilder(P7_BUILDER *bld, ESL_SQ *sq, P7_BG *bg, P7_HMM **opt_
   if ((status = p7_Seqmodel(bld->abc, sq->dsq, sq->n, sq->name, bld->Q, bg->f, bld->popen, bld->pextend, &hmm)) != eslOK) goto ERROR;
   if ((status = p7_hmm_SetComposition(hmm))                                                                     != eslOK) goto ERROR;
   if ((status = p7_hmm_SetConsensus(hmm, sq))                                                                   != eslOK) goto ERROR; 
-  if ((status = calibrate(bld, hmm, bg, opt_gm, opt_om))                                                        != eslOK) goto ERROR;
+  if ((status = calibrate(bld, hmm, bg, opt_gm, opt_om, calib))                                                 != eslOK) goto ERROR;
 
   /* build a faux glocal trace */
   if (opt_tr != NULL) 
@@ -709,24 +810,62 @@ profillic_p7_SingleBuilder(P7_BUILDER *bld, ESL_SQ *sq, P7_BG *bg, P7_HMM **opt_
  * (2) each D[i] should contribute (1-t_dd)D[i] to Y.
  *
  *
+ * The two columns and the transitions are held as contiguous arrays over
+ * the states k, so the M and I recurrences, which only look back a column,
+ * run two states at a time with SSE2; D, a chain down the column, is a
+ * scalar sweep that also sums Y. Every value is computed in the same
+ * order as by the plain recurrences above, so nothing changes but speed.
+ *
+ * With a small emit_thresh on a long DNA model the tail takes many
+ * thousands of columns, over most of which every state's mass just
+ * shrinks by the same ratio r per column, r itself settling geometrically.
+ * If <extrapolate> is TRUE, that is taken as given: once the limit of r
+ * (Aitken's estimate from the last three ratios of Y) has held to
+ * PROFILLIC_MAXLENGTH_RTOL for PROFILLIC_MAXLENGTH_NSTABLE columns, and
+ * what is left of the settling could move the answer by at most
+ * PROFILLIC_MAXLENGTH_COLTOL of a column, the DP jumps once, by scaling
+ * the column, to PROFILLIC_MAXLENGTH_GUARD columns short of where that
+ * geometric tail predicts Y/(X+Y) falls below emit_thresh, adding the
+ * skipped lengths' mass to X as a geometric series; the last columns are
+ * computed as usual. Models whose tail never settles that well just run
+ * the full DP. This is a heuristic, and the length it gives may differ
+ * from the full DP's (by a column or so, if the tail is as geometric as
+ * it looks), so it is off by default.
+ *
  * Args:      hmm         - p7_HMM (required for the transition probabilities)
+ *            emit_thresh - tail mass at which the length is taken
+ *            extrapolate - TRUE to jump over a settled geometric tail (see above)
  *
  * Returns:   <eslOK> on success. The max length is set in hmm->max_length.
+ *            <eslERANGE> if the tail is still above emit_thresh after
+ *            200000 columns; hmm->max_length is then 200000.
  * </pre>
  */
 int
-profillic_p7_Builder_MaxLength (P7_HMM *hmm, double emit_thresh)
+profillic_p7_Builder_MaxLength (P7_HMM *hmm, double emit_thresh, int extrapolate)
 {
-  int      col_ptr, prev_col_ptr; // which true column in above 2d-arrays is active
-  int      col;                   // which conceptual column in above 2d-arrays is active (up to table_len)
+  double  *buf          = NULL;   // one block for the columns and transitions below
+  double  *Mc, *Ic, *Dc;          // current column
+  double  *Mp, *Ip, *Dp;          // previous column
+  double  *tmp;
+  double  *tMM, *tDM, *tIM;       // t[k][p7H_MM] etc., as contiguous arrays over k
+  double  *tMI, *tII;
+  double  *tMD, *tDD;
+  double  *rMD, *rDD;             // 1 - t[k][p7H_MD], 1 - t[k][p7H_DD]
+  int      col;                   // which conceptual column of the DP table is active (up to length_bound)
   double   p_sum;                 // sum of probabilities for lengths <=L;  X from above
   double   surv;                  // surviving probability mass at length L; Y from above
-  int      k;                     // active state in model
-  int      i;
+  double   surv_prev  = 0.0;      // unnormalized surv of the previous column
+  double   ratio, ratio_prev = 0.0; // surv over surv_prev
+  double   drift, drift_prev = 0.0; // change in ratio from the column before
+  double   rho, r, err;             // drift's decay per column; the limiting ratio; error bound on a jump
+  double   r_prev     = 0.0;
+  int      nstable    = 0;        // columns in a row over which r has held steady
+  int      jumped     = FALSE;
+  double   dp, scale;
+  double   n;
+  int      k;
   int      length_bound = 200000; // default cap on # iterations (aka max model length)
-  double **I            = NULL;
-  double **M            = NULL;
-  double **D            = NULL;
   int      model_len    = hmm->M; // model length                
   int      status;
   
@@ -735,93 +874,337 @@ profillic_p7_Builder_MaxLength (P7_HMM *hmm, double emit_thresh)
     return eslOK;
   }
 
-
-  //    double I[model_len+1][2], M[model_len+1][2], D[model_len+1][2]; //2 columns for each way of ending a subpath
-  ESL_ALLOC_CPP(double*, I, (model_len+1) * sizeof(double*)); 
-  ESL_ALLOC_CPP(double*, M, (model_len+1) * sizeof(double*)); 
-  ESL_ALLOC_CPP(double*, D, (model_len+1) * sizeof(double*)); 
-  for (i = 0; i <= model_len; i++) {
-    I[i] = M[i] = D[i] = NULL; 
-  }
-  for (i=0; i <= model_len; i++) {
-    ESL_ALLOC_CPP(double, I[i], 2 * sizeof(double));
-    ESL_ALLOC_CPP(double, M[i], 2 * sizeof(double));
-    ESL_ALLOC_CPP(double, D[i], 2 * sizeof(double));
+  ESL_ALLOC_CPP(double, buf, 15 * (model_len+1) * sizeof(double));
+  Mc  = buf;                   Ic  = Mc  + (model_len+1);  Dc  = Ic  + (model_len+1);
+  Mp  = Dc  + (model_len+1);   Ip  = Mp  + (model_len+1);  Dp  = Ip  + (model_len+1);
+  tMM = Dp  + (model_len+1);   tDM = tMM + (model_len+1);  tIM = tDM + (model_len+1);
+  tMI = tIM + (model_len+1);   tII = tMI + (model_len+1);
+  tMD = tII + (model_len+1);   tDD = tMD + (model_len+1);
+  rMD = tDD + (model_len+1);   rDD = rMD + (model_len+1);
+  for (k = 0; k <= model_len; k++) {
+    tMM[k] = hmm->t[k][p7H_MM];  tDM[k] = hmm->t[k][p7H_DM];  tIM[k] = hmm->t[k][p7H_IM];
+    tMI[k] = hmm->t[k][p7H_MI];  tII[k] = hmm->t[k][p7H_II];
+    tMD[k] = hmm->t[k][p7H_MD];  tDD[k] = hmm->t[k][p7H_DD];
+    rMD[k] = 1 - hmm->t[k][p7H_MD];
+    rDD[k] = 1 - hmm->t[k][p7H_DD];
   }
+  Mc[0] = Ic[0] = Dc[0] = Mp[0] = Ip[0] = Dp[0] = 0.0;
 
   /*  Compute max length and max prefix lengths*/
   // special case for filling in 1st column of DP table,  col=1;
-  M[1][0] = 1.0;// 1st match state must emit a character
-  I[1][0] = D[1][0] = M[2][0] = I[2][0] = 0;
-  D[2][0] = hmm->t[1][p7H_MD];  // The 2nd delete state is reached, having emitted only 1 character
+  Mp[1] = 1.0;// 1st match state must emit a character
+  Ip[1] = Dp[1] = Mp[2] = Ip[2] = 0;
+  Dp[2] = tMD[1];  // The 2nd delete state is reached, having emitted only 1 character
   for (k=3; k<=model_len; k++){
-    M[k][0] = I[k][0] = 0;
-    D[k][0] = hmm->t[k-1][p7H_DD] * D[k-1][0];  // only way to get to the 3rd or greater state with only 1 character
+    Mp[k] = Ip[k] = 0;
+    Dp[k] = tDD[k-1] * Dp[k-1];  // only way to get to the 3rd or greater state with only 1 character
   }
 
   //special case for 2nd column
-  M[1][1] = D[1][1] = D[2][1] = I[2][1] = 0;  //No way any of these states can be responsible for the second emitted character.
-  I[1][1] = hmm->t[1][p7H_MI] * M[1][0];  //1st insert state can emit char #2.
-  M[2][1] = hmm->t[1][p7H_MM] * M[1][0] ; //2nd match state can emit char #2.
+  Mc[1] = Dc[1] = Dc[2] = Ic[2] = 0;  //No way any of these states can be responsible for the second emitted character.
+  Ic[1] = tMI[1] * Mp[1];  //1st insert state can emit char #2.
+  Mc[2] = tMM[1] * Mp[1] ; //2nd match state can emit char #2.
   for (k=3; k<=model_len; k++){
-    M[k][1] = hmm->t[k-1][p7H_DM] * D[k-1][0] ; //kth match state would have to follow the k-1th delete state, having emitted only 1 char so far
-    I[k][1] = 0;
-    D[k][1] = hmm->t[k-1][p7H_MD] * M[k-1][1]  +  hmm->t[k-1][p7H_DD] * D[k-1][1]; //in general only by extending a delete.  For k=3, this could be a transition from M=2, with 2 chars.
+    Mc[k] = tDM[k-1] * Dp[k-1] ; //kth match state would have to follow the k-1th delete state, having emitted only 1 char so far
+    Ic[k] = 0;
+    Dc[k] = tMD[k-1] * Mc[k-1]  +  tDD[k-1] * Dc[k-1]; //in general only by extending a delete.  For k=3, this could be a transition from M=2, with 2 chars.
   }
 
-  p_sum = M[model_len][0] + M[model_len][1] + D[model_len][0] + D[model_len][1];
+  p_sum = Mp[model_len] + Mc[model_len] + Dp[model_len] + Dc[model_len];
 
   //general case for all remaining columns
-  col_ptr = 0;
+  hmm->max_length = length_bound;
   for (col=3; col<=length_bound; col++) {
-    prev_col_ptr = 1-col_ptr;
-    surv = 0.0;
-    M[1][col_ptr] = D[1][col_ptr] = 0; //M[i][prev_col_ptr] is zero :  no way the first M state could have emitted >=2 chars
-    I[1][col_ptr] =  hmm->t[1][p7H_II] * I[1][prev_col_ptr];  // 1st insert state can emit chars indefinitely
-    surv += I[1][col_ptr];
+    tmp = Mp; Mp = Mc; Mc = tmp;
+    tmp = Ip; Ip = Ic; Ic = tmp;
+    tmp = Dp; Dp = Dc; Dc = tmp;
+
+    Mc[1] = Dc[1] = 0; //Mp[1] is zero :  no way the first M state could have emitted >=2 chars
+    Ic[1] = tII[1] * Ip[1];  // 1st insert state can emit chars indefinitely
+
+    /* M and I depend only on the previous column, so k=2..M go two at a time */
+    k = 2;
+#ifdef __SSE2__
+    for (; k+1 <= model_len; k += 2) {
+      __m128d m = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(tMM+k-1), _mm_loadu_pd(Mp+k-1)),
+                                        _mm_mul_pd(_mm_loadu_pd(tDM+k-1), _mm_loadu_pd(Dp+k-1))),
+                             _mm_mul_pd(_mm_loadu_pd(tIM+k-1), _mm_loadu_pd(Ip+k-1)));
+      __m128d i = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(tMI+k), _mm_loadu_pd(Mp+k)),
+                             _mm_mul_pd(_mm_loadu_pd(tII+k), _mm_loadu_pd(Ip+k)));
+      _mm_storeu_pd(Mc+k, m);
+      _mm_storeu_pd(Ic+k, i);
+    }
+#endif
+    for (; k<=model_len; k++){
+      Mc[k] = tMM[k-1] * Mp[k-1]  +  tDM[k-1] * Dp[k-1]  +  tIM[k-1] * Ip[k-1];
+      Ic[k] = tMI[k] * Mp[k]    +  tII[k] * Ip[k];
+    }
 
+    /* D is a chain down the column; sum the surviving mass along with it, in the same order as ever */
+    surv = Ic[1];
     for (k=2; k<=model_len; k++){
-      M[k][col_ptr] = hmm->t[k-1][p7H_MM] * M[k-1][prev_col_ptr]  +  hmm->t[k-1][p7H_DM] * D[k-1][prev_col_ptr]  +  hmm->t[k-1][p7H_IM] * I[k-1][prev_col_ptr];
-      I[k][col_ptr] = hmm->t[k][p7H_MI] * M[k][prev_col_ptr]    +  hmm->t[k][p7H_II] * I[k][prev_col_ptr];
-      D[k][col_ptr] = hmm->t[k-1][p7H_MD] * M[k-1][col_ptr]  +  hmm->t[k-1][p7H_DD] * D[k-1][col_ptr];
-
-      if (k<=model_len) {
-        surv +=  I[k][col_ptr] +
-     	           M[k][col_ptr] * ( 1 - hmm->t[k][p7H_MD] ) +  //this much of M[k]'s mass will bleed into D[k+1], and thus be added to surv then
-                 D[k][col_ptr] * ( 1 - hmm->t[k][p7H_DD] )  ; //this much of D[k]'s mass will bleed into D[k+1], and thus be added to surv then
-      }
+      Dc[k] = tMD[k-1] * Mc[k-1]  +  tDD[k-1] * Dc[k-1];
+      surv +=  Ic[k] +
+               Mc[k] * rMD[k] +  //this much of M[k]'s mass will bleed into D[k+1], and thus be added to surv then
+               Dc[k] * rDD[k]  ; //this much of D[k]'s mass will bleed into D[k+1], and thus be added to surv then
     }
-    surv +=    M[model_len][col_ptr] * ( hmm->t[model_len][p7H_MD] )   //the final state doesn't pass on to the next D state
-             + D[model_len][col_ptr] * ( hmm->t[model_len][p7H_DD] )  // the final state doesn't pass on to the next D state
-             - I[model_len][col_ptr] ;  // no I state for final position
+    surv +=    Mc[model_len] * ( tMD[model_len] )   //the final state doesn't pass on to the next D state
+             + Dc[model_len] * ( tDD[model_len] )  // the final state doesn't pass on to the next D state
+             - Ic[model_len] ;  // no I state for final position
 
-    p_sum += M[model_len][col_ptr] + D[model_len][col_ptr];
-    surv /= surv + p_sum;
+    dp     = Mc[model_len] + Dc[model_len];
+    p_sum += dp;
 
-    if (surv < emit_thresh) {
+    if (surv / (surv + p_sum) < emit_thresh) {
       hmm->max_length = col;
       break;
     }
 
-    col_ptr = 1-col_ptr; // alternating between 0 and 1
-  }
-
-  for (i=0; i<model_len+1; i++) {
-    free(I[i]);
-    free(M[i]);
-    free(D[i]);
+    /* Far out in the tail every state's mass shrinks by the same ratio r
+     * each column, and the ratio itself settles geometrically. Once what is
+     * left of that settling could move the answer by no more than a small
+     * fraction of a column, skip to a few columns short of where the tail
+     * falls below the threshold: scale the column by r^n, add the skipped
+     * lengths' mass as a geometric series, and finish the DP from there.
+     */
+    if (extrapolate && surv_prev > 0.0) {
+      ratio = surv / surv_prev;
+      drift = ratio - ratio_prev;
+      if (! jumped && ratio < 1.0 && drift_prev != 0.0) {
+        rho = drift / drift_prev;
+        if (rho <= 0.0 || rho >= 1.0) nstable = 0;
+        else {
+          r   = ratio + drift * rho / (1.0 - rho);                       // where the ratio is headed
+          err = fabs(drift) * rho / ((1.0 - rho) * (1.0 - rho)) / r;     // how far log(surv) may stray over the jump
+          if (fabs(r - r_prev) <= PROFILLIC_MAXLENGTH_RTOL * r) nstable++; else nstable = 0;
+          r_prev = r;
+          if (nstable >= PROFILLIC_MAXLENGTH_NSTABLE && r < 1.0 && err <= PROFILLIC_MAXLENGTH_COLTOL * -log(r)) {
+            n = floor(log(emit_thresh * (p_sum + dp * r / (1.0 - r)) / ((1.0 - emit_thresh) * surv)) / log(r)) - PROFILLIC_MAXLENGTH_GUARD;
+            if (n >= PROFILLIC_MAXLENGTH_MINJUMP && col + n < length_bound) {
+              scale  = pow(r, n);
+              for (k = 1; k <= model_len; k++) { Mc[k] *= scale; Ic[k] *= scale; Dc[k] *= scale; }
+              p_sum += dp * r * (1.0 - scale) / (1.0 - r);
+              surv  *= scale;
+              col   += (int) n;
+              jumped = TRUE;
+            }
+          }
+        }
+      }
+      drift_prev = drift;
+      ratio_prev = ratio;
+    }
+    surv_prev = surv;
   }
-  free(I);
-  free(M);
-  free(D);
 
+  free(buf);
   if (hmm->max_length >= length_bound) return eslERANGE;
   return eslOK;
   
  ERROR:
-  if (I) { for (i = 0; i <= model_len; i++) { if (I[i]) free(I[i]); }  free(I);  }
-  if (D) { for (i = 0; i <= model_len; i++) { if (D[i]) free(D[i]); }  free(D);  }
-  if (M) { for (i = 0; i <= model_len; i++) { if (M[i]) free(M[i]); }  free(M);  }
+  if (buf) free(buf);
+  return status;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_p7_Builder_MaxLengthBatch()
+ *
+ * Purpose:   Set hmm[i]->max_length for each of the <nhmm> models
+ *            <hmm[0..nhmm-1]>, just as profillic_p7_Builder_MaxLength()
+ *            would one at a time.
+ *
+ *            The models are sorted by length and taken
+ *            PROFILLIC_MAXLENGTH_LANES at a time, one to a SIMD lane,
+ *            and their columns are advanced together. Within a column
+ *            every recurrence, the D chain included, runs across the
+ *            lanes, so short models, whose D chain is most of the work
+ *            and gives a single model nothing to vectorize, go about
+ *            twice as fast. A lane is padded past its own model's end
+ *            with zero transitions, which adds exact zeros to its sums,
+ *            and retires once its Y/(X+Y) is below <emit_thresh>; the
+ *            pair goes on until both have. Each lane's values are
+ *            computed in the same order as by the single-model DP, so
+ *            the lengths are the same; an odd model out is done on its
+ *            own. Extrapolation jumps each model's own tail at its own
+ *            column, so with <extrapolate> every model is done on its
+ *            own, and the lengths are again the same.
+ *
+ * Args:      hmm         - the models (required for the transition probabilities)
+ *            nhmm        - how many
+ *            emit_thresh - as for profillic_p7_Builder_MaxLength()
+ *            extrapolate - likewise
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslERANGE> if any model's tail is still above emit_thresh
+ *            after 200000 columns; that model's max_length is 200000,
+ *            and the others are set all the same.
+ *
+ * Throws:    <eslEMEM> on allocation error.
+ * </pre>
+ */
+static int
+profillic_p7_Builder_MaxLengthBatchCmp(const void *a, const void *b)
+{
+  int Ma = (*(P7_HMM * const *) a)->M;
+  int Mb = (*(P7_HMM * const *) b)->M;
+  return (Ma > Mb) - (Ma < Mb);
+}
+
+int
+profillic_p7_Builder_MaxLengthBatch (P7_HMM **hmm, int nhmm, double emit_thresh, int extrapolate)
+{
+  const int L = PROFILLIC_MAXLENGTH_LANES;
+  P7_HMM  **byM          = NULL;  // the models, shortest first
+  double   *buf          = NULL;  // one block for the columns and transitions below
+  double   *Mc, *Ic, *Dc;         // current column, [k*L + lane]
+  double   *Mp, *Ip, *Dp;         // previous column
+  double   *tmp;
+  double   *tMM, *tDM, *tIM;      // t[k][p7H_MM] etc., [k*L + lane]; zero past the lane's model
+  double   *tMI, *tII;
+  double   *tMD, *tDD;
+  double   *rMD, *rDD;            // 1 - t[k][p7H_MD], 1 - t[k][p7H_DD]
+  double   *surv         = NULL;  // per lane: as in profillic_p7_Builder_MaxLength()
+  double   *p_sum        = NULL;
+  int      *live         = NULL;  // TRUE while the lane's model has yet to cross emit_thresh
+  int       nlive;
+  int       col;
+  int       Kmax;                 // longest model of the group
+  int       length_bound = 200000; // default cap on # iterations (aka max model length)
+  int       g, l, k, m, n;
+  int       status       = eslOK;
+  int       xstatus;
+
+  if (nhmm <= 0) return eslOK;
+
+  ESL_ALLOC_CPP(P7_HMM*, byM, nhmm * sizeof(P7_HMM *));
+  for (n = 0, g = 0; g < nhmm; g++) {
+    if (hmm[g]->M == 1) hmm[g]->max_length = 1;
+    else                byM[n++] = hmm[g];
+  }
+  qsort(byM, n, sizeof(P7_HMM *), profillic_p7_Builder_MaxLengthBatchCmp);
+
+  ESL_ALLOC_CPP(double, surv,  L * sizeof(double));
+  ESL_ALLOC_CPP(double, p_sum, L * sizeof(double));
+  ESL_ALLOC_CPP(int,    live,  L * sizeof(int));
+  if (n >= L && ! extrapolate) ESL_ALLOC_CPP(double, buf, 15 * L * (byM[n-1]->M+1) * sizeof(double));
+
+  for (g = 0; ! extrapolate && g + L <= n; g += L) {
+    Kmax = byM[g+L-1]->M;
+    Mc  = buf;                   Ic  = Mc  + L*(Kmax+1);  Dc  = Ic  + L*(Kmax+1);
+    Mp  = Dc  + L*(Kmax+1);      Ip  = Mp  + L*(Kmax+1);  Dp  = Ip  + L*(Kmax+1);
+    tMM = Dp  + L*(Kmax+1);      tDM = tMM + L*(Kmax+1);  tIM = tDM + L*(Kmax+1);
+    tMI = tIM + L*(Kmax+1);      tII = tMI + L*(Kmax+1);
+    tMD = tII + L*(Kmax+1);      tDD = tMD + L*(Kmax+1);
+    rMD = tDD + L*(Kmax+1);      rDD = rMD + L*(Kmax+1);
+    for (k = 0; k < 15 * L * (Kmax+1); k++) buf[k] = 0.0;
+
+    for (l = 0; l < L; l++) {
+      const P7_HMM *h = byM[g+l];
+      m = h->M;
+      for (k = 0; k <= m; k++) {
+        if (k < m) { tMM[k*L+l] = h->t[k][p7H_MM];  tDM[k*L+l] = h->t[k][p7H_DM];  tIM[k*L+l] = h->t[k][p7H_IM]; }
+        tMI[k*L+l] = h->t[k][p7H_MI];  tII[k*L+l] = h->t[k][p7H_II];
+        tMD[k*L+l] = h->t[k][p7H_MD];  tDD[k*L+l] = h->t[k][p7H_DD];
+        rMD[k*L+l] = 1 - h->t[k][p7H_MD];
+        rDD[k*L+l] = 1 - h->t[k][p7H_DD];
+      }
+
+      /* 1st and 2nd columns, as for a single model; zero transitions keep the padding harmless */
+      Mp[1*L+l] = 1.0;
+      Ip[1*L+l] = Dp[1*L+l] = Mp[2*L+l] = Ip[2*L+l] = 0;
+      Dp[2*L+l] = tMD[1*L+l];
+      for (k=3; k<=Kmax; k++) {
+        Mp[k*L+l] = Ip[k*L+l] = 0;
+        Dp[k*L+l] = tDD[(k-1)*L+l] * Dp[(k-1)*L+l];
+      }
+      Mc[1*L+l] = Dc[1*L+l] = Dc[2*L+l] = Ic[2*L+l] = 0;
+      Ic[1*L+l] = tMI[1*L+l] * Mp[1*L+l];
+      Mc[2*L+l] = tMM[1*L+l] * Mp[1*L+l];
+      for (k=3; k<=Kmax; k++) {
+        Mc[k*L+l] = tDM[(k-1)*L+l] * Dp[(k-1)*L+l];
+        Ic[k*L+l] = 0;
+        Dc[k*L+l] = tMD[(k-1)*L+l] * Mc[(k-1)*L+l]  +  tDD[(k-1)*L+l] * Dc[(k-1)*L+l];
+      }
+      p_sum[l] = Mp[m*L+l] + Mc[m*L+l] + Dp[m*L+l] + Dc[m*L+l];
+      live[l]  = TRUE;
+      byM[g+l]->max_length = length_bound;
+    }
+    nlive = L;
+
+    for (col=3; col<=length_bound && nlive > 0; col++) {
+      tmp = Mp; Mp = Mc; Mc = tmp;
+      tmp = Ip; Ip = Ic; Ic = tmp;
+      tmp = Dp; Dp = Dc; Dc = tmp;
+
+#ifdef __SSE2__
+      {
+        __m128d s;
+        _mm_storeu_pd(Mc+L, _mm_setzero_pd());
+        _mm_storeu_pd(Dc+L, _mm_setzero_pd());
+        _mm_storeu_pd(Ic+L, _mm_mul_pd(_mm_loadu_pd(tII+L), _mm_loadu_pd(Ip+L)));
+        s = _mm_loadu_pd(Ic+L);
+        for (k=2; k<=Kmax; k++) {
+          __m128d mk = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(tMM+(k-1)*L), _mm_loadu_pd(Mp+(k-1)*L)),
+                                             _mm_mul_pd(_mm_loadu_pd(tDM+(k-1)*L), _mm_loadu_pd(Dp+(k-1)*L))),
+                                  _mm_mul_pd(_mm_loadu_pd(tIM+(k-1)*L), _mm_loadu_pd(Ip+(k-1)*L)));
+          __m128d ik = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(tMI+k*L), _mm_loadu_pd(Mp+k*L)),
+                                  _mm_mul_pd(_mm_loadu_pd(tII+k*L), _mm_loadu_pd(Ip+k*L)));
+          __m128d dk = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(tMD+(k-1)*L), _mm_loadu_pd(Mc+(k-1)*L)),
+                                  _mm_mul_pd(_mm_loadu_pd(tDD+(k-1)*L), _mm_loadu_pd(Dc+(k-1)*L)));
+          _mm_storeu_pd(Mc+k*L, mk);
+          _mm_storeu_pd(Ic+k*L, ik);
+          _mm_storeu_pd(Dc+k*L, dk);
+          s = _mm_add_pd(s, _mm_add_pd(_mm_add_pd(ik, _mm_mul_pd(mk, _mm_loadu_pd(rMD+k*L))),
+                                       _mm_mul_pd(dk, _mm_loadu_pd(rDD+k*L))));
+        }
+        _mm_storeu_pd(surv, s);
+      }
+#else
+      for (l = 0; l < L; l++) {
+        Mc[1*L+l] = Dc[1*L+l] = 0;
+        Ic[1*L+l] = tII[1*L+l] * Ip[1*L+l];
+        surv[l]   = Ic[1*L+l];
+      }
+      for (k=2; k<=Kmax; k++)
+        for (l = 0; l < L; l++) {
+          Mc[k*L+l] = tMM[(k-1)*L+l] * Mp[(k-1)*L+l]  +  tDM[(k-1)*L+l] * Dp[(k-1)*L+l]  +  tIM[(k-1)*L+l] * Ip[(k-1)*L+l];
+          Ic[k*L+l] = tMI[k*L+l] * Mp[k*L+l]    +  tII[k*L+l] * Ip[k*L+l];
+          Dc[k*L+l] = tMD[(k-1)*L+l] * Mc[(k-1)*L+l]  +  tDD[(k-1)*L+l] * Dc[(k-1)*L+l];
+          surv[l]  += Ic[k*L+l] + Mc[k*L+l] * rMD[k*L+l] + Dc[k*L+l] * rDD[k*L+l];
+        }
+#endif
+
+      for (l = 0; l < L; l++) {
+        if (! live[l]) continue;
+        m = byM[g+l]->M;
+        surv[l]  +=   Mc[m*L+l] * ( tMD[m*L+l] )   //the final state doesn't pass on to the next D state
+                    + Dc[m*L+l] * ( tDD[m*L+l] )   // the final state doesn't pass on to the next D state
+                    - Ic[m*L+l] ;                  // no I state for final position
+        p_sum[l] += Mc[m*L+l] + Dc[m*L+l];
+        if (surv[l] / (surv[l] + p_sum[l]) < emit_thresh) {
+          byM[g+l]->max_length = col;
+          live[l] = FALSE;
+          nlive--;
+        }
+      }
+    }
+    if (nlive > 0) status = eslERANGE;
+  }
+
+  /* the odd models out; all of them, extrapolating */
+  for (; g < n; g++)
+    if ((xstatus = profillic_p7_Builder_MaxLength(byM[g], emit_thresh, extrapolate)) != eslOK) {
+      if (xstatus != eslERANGE) { status = xstatus; goto ERROR; }
+      status = eslERANGE;
+    }
+
+ ERROR:
+  if (byM)   free(byM);
+  if (buf)   free(buf);
+  if (surv)  free(surv);
+  if (p_sum) free(p_sum);
+  if (live)  free(live);
   return status;
 }
 
@@ -911,7 +1294,8 @@ profillic_p7_Profillicmodelmaker(P7_BUILDER *bld, ESL_MSA * msa, ProfileType con
 
   uint32_t pos_i; ///< Position in profile.  Corresponds to one less than match state pos in HMM.
   uint32_t res_i;
-  ESL_DSQ hmmer_digitized_residue;
+  profillic_residuemap_s<ResidueType> const resmap( msa->abc );
+  const uint32_t K = profillic_residuemap_s<ResidueType>::K;
 
   /* How many match states in the HMM? */
   M = static_cast<int>( profile.length() );
@@ -943,10 +1327,8 @@ profillic_p7_Profillicmodelmaker(P7_BUILDER *bld, ESL_MSA * msa, ProfileType con
     );
   hmm->t[ 0 ][ p7H_II ] =  hmm->t[ 0 ][ p7H_MI ];
   hmm->t[ 0 ][ p7H_IM ] = ( 1 - hmm->t[ 0 ][ p7H_MI ] );
-  for( res_i = 0; res_i < seqan::ValueSize<ResidueType>::VALUE; res_i++ ) {
-    hmmer_digitized_residue =
-      esl_abc_DigitizeSymbol( msa->abc, static_cast<char>( ResidueType( res_i ) ) );
-    hmm->ins[ 0 ][ hmmer_digitized_residue ] =
+  for( res_i = 0; res_i < K; res_i++ ) {
+    hmm->ins[ 0 ][ resmap[ res_i ] ] =
        toDouble(
         profile[ galosh::Emission::PreAlignInsertion ][ res_i ]
        );
@@ -976,28 +1358,29 @@ profillic_p7_Profillicmodelmaker(P7_BUILDER *bld, ESL_MSA * msa, ProfileType con
 //      cout << '.';
 //      cout.flush();
 //    }
-    // TODO: If this is too slow, memoize the ResidueType( res_i )s.
-    for( res_i = 0; res_i < seqan::ValueSize<ResidueType>::VALUE; res_i++ ) {
-      hmmer_digitized_residue =
-        esl_abc_DigitizeSymbol( msa->abc, static_cast<char>( ResidueType( res_i ) ) );
-      hmm->mat[ pos_i + 1 ][ hmmer_digitized_residue ] =
+    for( res_i = 0; res_i < K; res_i++ ) {
+      hmm->mat[ pos_i + 1 ][ resmap[ res_i ] ] =
         toDouble(
           profile[ pos_i ][ galosh::Emission::Match ][ res_i ]
         );
-      if( pos_i == ( profile.length() - 1 ) ) {
-        // Use post-align insertions
-        hmm->ins[ pos_i + 1 ][ hmmer_digitized_residue ] =
+    } // End foreach res_i
+    if( pos_i == ( profile.length() - 1 ) ) {
+      // Use post-align insertions
+      for( res_i = 0; res_i < K; res_i++ ) {
+        hmm->ins[ pos_i + 1 ][ resmap[ res_i ] ] =
           toDouble(
             profile[ galosh::Emission::PostAlignInsertion ][ res_i ]
           );
-        assert( hmm->ins[ pos_i + 1 ][ hmmer_digitized_residue ] == hmm->ins[ 0 ][ hmmer_digitized_residue ] );
-      } else { // if this is the last position (use post-align insertions) .. else ..
-        hmm->ins[ pos_i + 1 ][ hmmer_digitized_residue ] =
+        assert( hmm->ins[ pos_i + 1 ][ resmap[ res_i ] ] == hmm->ins[ 0 ][ resmap[ res_i ] ] );
+      } // End foreach res_i
+    } else { // if this is the last position (use post-align insertions) .. else ..
+      for( res_i = 0; res_i < K; res_i++ ) {
+        hmm->ins[ pos_i + 1 ][ resmap[ res_i ] ] =
           toDouble(
             profile[ galosh::Emission::Insertion ][ res_i ]
           );
-      } // End if this is the last position (use post-align insertions) .. else ..
-    } // End foreach res_i
+      } // End foreach res_i
+    } // End if this is the last position (use post-align insertions) .. else ..
     if( pos_i == ( profile.length() - 1 ) ) {
       // Use post-align insertions
       hmm->t[ pos_i + 1 ][ p7H_IM ] =
@@ -1122,6 +1505,46 @@ profillic_build_model(P7_BUILDER *bld, ESL_MSA *msa, ProfileType const * const p
   return status;
 }
 
+/**
+ * profillic_build_model():
+ *
+ * Fused-path version: the count model was already made by the
+ * profile reader (see profillic-p7_hmm.hpp), so take it over from
+ * <profile_ptr> and finish it as profillic_p7_Profillicmodelmaker()
+ * would: counts, annotation, and an all-match \#=RF line on the
+ * consensus <msa>.
+ */
+static int
+profillic_build_model(P7_BUILDER *bld, ESL_MSA *msa, PROFILLIC_HMMPROFILE const * const profile_ptr, P7_HMM **ret_hmm, P7_TRACE ***opt_tr)
+{
+  P7_HMM *hmm = NULL;
+  int     apos;
+  int     status;
+
+  if (profile_ptr == NULL || profile_ptr->hmm == NULL) ESL_XEXCEPTION(eslEINCONCEIVABLE, "no count model in fused galosh profile");
+  if (profile_ptr->hmm->M != msa->alen)                ESL_XEXCEPTION(eslEINCONCEIVABLE, "fused galosh profile doesn't match its consensus msa");
+  hmm = profile_ptr->hmm;
+  profile_ptr->hmm = NULL;
+
+  hmm->nseq     = msa->nseq;
+  hmm->eff_nseq = msa->nseq;
+  if ((status = profillic_annotate_model(hmm, msa)) != eslOK) goto ERROR;
+
+  if (msa->rf == NULL)  ESL_ALLOC_CPP(char, msa->rf, sizeof(char) * (msa->alen + 1));
+  for (apos = 1; apos <= msa->alen; apos++)
+    msa->rf[apos-1] = 'x';
+  msa->rf[msa->alen] = '\0';
+
+  if (opt_tr != NULL) *opt_tr = NULL;
+  *ret_hmm = hmm;
+  return eslOK;
+
+ ERROR:
+  if (hmm != NULL) p7_hmm_Destroy(hmm);
+  *ret_hmm = NULL;
+  return status;
+}
+
 
 /**
  * <pre>
@@ -1346,17 +1769,19 @@ annotate(P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm)
  * 
  * Sets the E value parameters of the model with two short simulations.
  * A profile and an oprofile are created here. If caller wants to keep either
- * of them, it can pass non-<NULL> <opt_gm>, <opt_om> pointers.
+ * of them, it can pass non-<NULL> <opt_gm>, <opt_om> pointers. A non-<NULL>
+ * <calib> may spread the simulations over several threads, or replace
+ * them with a lookup table or a cached calibration.
  */
 static int
-calibrate(P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om)
+calibrate(P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, const PROFILLIC_CALIBRATION *calib)
 {
   int status;
 
   if (opt_gm != NULL) *opt_gm = NULL;
   if (opt_om != NULL) *opt_om = NULL;
 
-  if ((status = p7_Calibrate(hmm, bld, &(bld->r), &bg, opt_gm, opt_om)) != eslOK) goto ERROR;
+  if ((status = profillic_Calibrate(hmm, bld, &(bld->r), &bg, opt_gm, opt_om, calib, bld->errbuf)) != eslOK) goto ERROR;
   return eslOK;
 
  ERROR:
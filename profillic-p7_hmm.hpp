@@ -0,0 +1,403 @@
+/**
+ * \file profillic-p7_hmm.hpp
+ * \brief
+ * Building a P7_HMM straight from a galosh profile stream (for profillic)
+ * \details
+ * <pre>
+ * Table of contents:
+ *     1. PROFILLIC_HMMPROFILE: a galosh profile held as an H3 count model.
+ *     2. The parser sink that fills it.
+ *     3. Fingerprinting a model's parameters.
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICP7HMM_HPP__
+#define __GALOSH_PROFILLICP7HMM_HPP__
+
+extern "C" {
+#include "p7_config.h"
+}
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+extern "C" {
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_vectorops.h"
+
+#include "base/p7_hmm.h"
+}
+
+#include "profillic-hmmer.hpp"
+
+/*****************************************************************
+ * 1. PROFILLIC_HMMPROFILE: a galosh profile held as an H3 count model.
+ *****************************************************************/
+
+/**
+ * PROFILLIC_HMMPROFILE
+ *
+ * Stands in for a galosh ProfileTreeRoot on the fused build path:
+ * the profile reader fills <hmm> directly with the same count model
+ * profillic_p7_Profillicmodelmaker() would make from the galosh
+ * profile, and profillic_build_model() takes it over (setting <hmm>
+ * back to NULL) instead of building one.
+ */
+typedef struct profillic_hmmprofile_s {
+  mutable P7_HMM *hmm;		/**< count model of the last profile read; NULL once handed to the builder */
+} PROFILLIC_HMMPROFILE;
+
+/**
+ * <pre>
+ * Function:  profillic_hmmprofile_Create()
+ * Synopsis:  Create an empty <PROFILLIC_HMMPROFILE>.
+ *
+ * Returns:   pointer to the new object.
+ *
+ * Throws:    <NULL> on allocation failure.
+ * </pre>
+ */
+static PROFILLIC_HMMPROFILE *
+profillic_hmmprofile_Create(void)
+{
+  PROFILLIC_HMMPROFILE *prof = NULL;
+  int                   status;
+
+  ESL_ALLOC_CPP(PROFILLIC_HMMPROFILE, prof, sizeof(PROFILLIC_HMMPROFILE));
+  prof->hmm = NULL;
+  return prof;
+
+ ERROR:
+  return NULL;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_hmmprofile_Destroy()
+ * Synopsis:  Free a <PROFILLIC_HMMPROFILE>, and any model it still holds.
+ * </pre>
+ */
+static void
+profillic_hmmprofile_Destroy(PROFILLIC_HMMPROFILE *prof)
+{
+  if (prof == NULL) return;
+  if (prof->hmm != NULL) p7_hmm_Destroy(prof->hmm);
+  free(prof);
+}
+
+/*****************************************************************
+ * 2. The parser sink that fills it.
+ *****************************************************************/
+
+/**
+ * profillic_hmm_sink_s
+ *
+ * Sink for profillic_profile_ParseRecord() and
+ * profillic_profilefile_ParseBinary() that writes a galosh profile
+ * into a new P7_HMM count model as it is parsed. Match emissions go
+ * straight into <hmm->mat>; the global transitions and insertion
+ * emissions are collected and laid out over all nodes by End(),
+ * following the galosh-to-H3 mapping of
+ * profillic_p7_Profillicmodelmaker().
+ */
+struct profillic_hmm_sink_s
+{
+  PROFILLIC_HMMPROFILE *prof;
+  const ESL_ALPHABET   *abc;
+  P7_HMM               *hmm;
+  double                ins[p7_MAXABET];
+  double                mm, mi, md, im, ii, dm, dd;	/* fromMatch, fromInsertion, fromDeletion */
+  double                nn, bm, bd, cc, ct;		/* fromPreAlign, fromBegin, fromPostAlign  */
+
+  profillic_hmm_sink_s(PROFILLIC_HMMPROFILE *p, const ESL_ALPHABET *a) :
+    prof(p), abc(a), hmm(NULL),
+    mm(0.), mi(0.), md(0.), im(0.), ii(0.), dm(0.), dd(0.), nn(0.), bm(0.), bd(0.), cc(0.), ct(0.)
+  {
+    esl_vec_DSet(ins, p7_MAXABET, 0.);
+  }
+
+  /* A binary record's residues must be <abc>'s canonical ones, in order. */
+  int Alphabet(uint32_t K, const char *sym)
+  {
+    uint32_t x;
+    if ((int) K != abc->K) return eslEINCOMPAT;
+    for (x = 0; x < K; x++)
+      if (toupper(sym[x]) != toupper(abc->sym[x])) return eslEINCOMPAT;
+    return eslOK;
+  }
+
+  int Begin(uint32_t npos)
+  {
+    if (prof->hmm != NULL) { p7_hmm_Destroy(prof->hmm); prof->hmm = NULL; }
+    if ((hmm = p7_hmm_Create(npos, abc)) == NULL) return eslEMEM;
+    p7_hmm_Zero(hmm);
+    prof->hmm = hmm;
+    return eslOK;
+  }
+
+  int Match(uint32_t pos, char key, double x)
+  {
+    ESL_DSQ x_i = abc->inmap[ (unsigned char) key ];
+    if (! esl_abc_XIsCanonical(abc, x_i)) return eslEFORMAT;
+    hmm->mat[ pos + 1 ][ x_i ] = x;
+    return eslOK;
+  }
+
+  int Insertion(char key, double x)
+  {
+    ESL_DSQ x_i = abc->inmap[ (unsigned char) key ];
+    if (! esl_abc_XIsCanonical(abc, x_i)) return eslEFORMAT;
+    ins[ x_i ] = x;
+    return eslOK;
+  }
+
+  int Transition(char from, char to, double x)
+  {
+    switch (from) {
+    case 'M': if (to == 'M') mm = x; else if (to == 'I') mi = x; else if (to == 'D') md = x; else return eslEFORMAT; break;
+    case 'I': if (to == 'M') im = x; else if (to == 'I') ii = x; else return eslEFORMAT; break;
+    case 'D': if (to == 'M') dm = x; else if (to == 'D') dd = x; else return eslEFORMAT; break;
+    case 'N': if (to == 'N') nn = x; else if (to == 'B') ;       else return eslEFORMAT; break; /* N->B is implied by N->N */
+    case 'B': if (to == 'M') bm = x; else if (to == 'D') bd = x; else return eslEFORMAT; break;
+    case 'C': if (to == 'C') cc = x; else if (to == 'T') ct = x; else return eslEFORMAT; break;
+    default:  return eslEFORMAT;
+    }
+    return eslOK;
+  }
+
+  int End()
+  {
+    int M = hmm->M;
+    int k, x;
+
+    /* node 0: galosh's pre-align and Begin states */
+    hmm->t[0][p7H_MI] = hmm->t[0][p7H_II] = nn;
+    hmm->t[0][p7H_IM] = 1. - nn;
+    hmm->t[0][p7H_MM] = (1. - nn) * bm;
+    hmm->t[0][p7H_MD] = (1. - nn) * bd;
+    hmm->mat[0][0]    = 1.0;
+
+    for (k = 1; k < M; k++)
+      {
+        hmm->t[k][p7H_MM] = mm;  hmm->t[k][p7H_MI] = mi;  hmm->t[k][p7H_MD] = md;
+        hmm->t[k][p7H_IM] = im;  hmm->t[k][p7H_II] = ii;
+        hmm->t[k][p7H_DM] = dm;  hmm->t[k][p7H_DD] = dd;
+      }
+
+    /* node M: galosh's post-align state */
+    hmm->t[M][p7H_MM] = hmm->t[M][p7H_IM] = ct;
+    hmm->t[M][p7H_MI] = hmm->t[M][p7H_II] = cc;
+
+    /* pre-, mid-, and post-align insertions are tied */
+    for (k = 0; k <= M; k++)
+      for (x = 0; x < abc->K; x++)
+        hmm->ins[k][x] = ins[x];
+    return eslOK;
+  }
+};
+
+/*****************************************************************
+ * 3. Fingerprinting a model's parameters.
+ *****************************************************************/
+
+/* xxHash64 (Y. Collet) primes. */
+#define PROFILLIC_XXH_P1  0x9E3779B185EBCA87ULL
+#define PROFILLIC_XXH_P2  0xC2B2AE3D27D4EB4FULL
+#define PROFILLIC_XXH_P3  0x165667B19E3779F9ULL
+#define PROFILLIC_XXH_P4  0x85EBCA77C2B2AE63ULL
+#define PROFILLIC_XXH_P5  0x27D4EB2F165667C5ULL
+
+#define PROFILLIC_XXH_ROTL(x, r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+/**
+ * PROFILLIC_XXH64
+ *
+ * Streaming xxHash64 state over 32-bit words. Words are hashed as
+ * numbers, not as host bytes, so the same words give the same hash
+ * on any byte order.
+ */
+typedef struct {
+  uint64_t v[4];
+  uint32_t buf[8];		/* words not yet folded into <v>: one 32-byte stripe */
+  int      nbuf;
+  uint64_t nbytes;
+} PROFILLIC_XXH64;
+
+static inline uint64_t
+profillic_xxh64_round(uint64_t acc, uint64_t lane)
+{
+  acc += lane * PROFILLIC_XXH_P2;
+  acc  = PROFILLIC_XXH_ROTL(acc, 31);
+  return acc * PROFILLIC_XXH_P1;
+}
+
+static inline uint64_t
+profillic_xxh64_merge(uint64_t h, uint64_t v)
+{
+  h ^= profillic_xxh64_round(0, v);
+  return h * PROFILLIC_XXH_P1 + PROFILLIC_XXH_P4;
+}
+
+static void
+profillic_xxh64_Init(PROFILLIC_XXH64 *xh, uint64_t seed)
+{
+  xh->v[0]   = seed + PROFILLIC_XXH_P1 + PROFILLIC_XXH_P2;
+  xh->v[1]   = seed + PROFILLIC_XXH_P2;
+  xh->v[2]   = seed;
+  xh->v[3]   = seed - PROFILLIC_XXH_P1;
+  xh->nbuf   = 0;
+  xh->nbytes = 0;
+}
+
+static void
+profillic_xxh64_UpdateWords(PROFILLIC_XXH64 *xh, const uint32_t *w, size_t n)
+{
+  size_t i;
+
+  xh->nbytes += (uint64_t) n * 4;
+  for (i = 0; i < n; i++)
+    {
+      xh->buf[xh->nbuf++] = w[i];
+      if (xh->nbuf == 8)
+        {
+          xh->v[0] = profillic_xxh64_round(xh->v[0], (uint64_t) xh->buf[0] | ((uint64_t) xh->buf[1] << 32));
+          xh->v[1] = profillic_xxh64_round(xh->v[1], (uint64_t) xh->buf[2] | ((uint64_t) xh->buf[3] << 32));
+          xh->v[2] = profillic_xxh64_round(xh->v[2], (uint64_t) xh->buf[4] | ((uint64_t) xh->buf[5] << 32));
+          xh->v[3] = profillic_xxh64_round(xh->v[3], (uint64_t) xh->buf[6] | ((uint64_t) xh->buf[7] << 32));
+          xh->nbuf = 0;
+        }
+    }
+}
+
+/* Bytes are packed into little-endian words; a partial last word is zero-padded. */
+static void
+profillic_xxh64_UpdateBytes(PROFILLIC_XXH64 *xh, const void *p, size_t n)
+{
+  const unsigned char *b = (const unsigned char *) p;
+  uint32_t             w[64];
+  size_t               i, j;
+
+  for (i = 0; i < n; i += 4 * j)
+    {
+      for (j = 0; j < 64 && i + 4*j < n; j++)
+        {
+          size_t o = i + 4*j;
+          w[j] =                        (uint32_t) b[o];
+          if (o+1 < n) w[j] |= (uint32_t) b[o+1] << 8;
+          if (o+2 < n) w[j] |= (uint32_t) b[o+2] << 16;
+          if (o+3 < n) w[j] |= (uint32_t) b[o+3] << 24;
+        }
+      profillic_xxh64_UpdateWords(xh, w, j);
+    }
+}
+
+/* A string is hashed with its length, so that adjacent strings can't run together; NULL differs from "". */
+static void
+profillic_xxh64_UpdateString(PROFILLIC_XXH64 *xh, const char *s)
+{
+  uint32_t len = (s == NULL ? 0xffffffffu : (uint32_t) strlen(s));
+
+  profillic_xxh64_UpdateWords(xh, &len, 1);
+  if (s != NULL) profillic_xxh64_UpdateBytes(xh, s, len);
+}
+
+/* Floats are hashed by their IEEE bits, with -0 taken as +0. */
+static void
+profillic_xxh64_UpdateFloats(PROFILLIC_XXH64 *xh, const float *x, size_t n)
+{
+  uint32_t w[64];
+  size_t   i, j;
+
+  for (i = 0; i < n; i += j)
+    {
+      for (j = 0; j < 64 && i + j < n; j++)
+        {
+          float f = (x[i+j] == 0.0f ? 0.0f : x[i+j]);
+          memcpy(&w[j], &f, sizeof(uint32_t));
+        }
+      profillic_xxh64_UpdateWords(xh, w, j);
+    }
+}
+
+static uint64_t
+profillic_xxh64_Digest(const PROFILLIC_XXH64 *xh)
+{
+  uint64_t h;
+  int      i = 0;
+
+  if (xh->nbytes >= 32)
+    {
+      h = PROFILLIC_XXH_ROTL(xh->v[0], 1) + PROFILLIC_XXH_ROTL(xh->v[1], 7) + PROFILLIC_XXH_ROTL(xh->v[2], 12) + PROFILLIC_XXH_ROTL(xh->v[3], 18);
+      h = profillic_xxh64_merge(h, xh->v[0]);
+      h = profillic_xxh64_merge(h, xh->v[1]);
+      h = profillic_xxh64_merge(h, xh->v[2]);
+      h = profillic_xxh64_merge(h, xh->v[3]);
+    }
+  else h = xh->v[2] + PROFILLIC_XXH_P5;
+  h += xh->nbytes;
+
+  for (; i + 1 < xh->nbuf; i += 2)
+    {
+      h ^= profillic_xxh64_round(0, (uint64_t) xh->buf[i] | ((uint64_t) xh->buf[i+1] << 32));
+      h  = PROFILLIC_XXH_ROTL(h, 27) * PROFILLIC_XXH_P1 + PROFILLIC_XXH_P4;
+    }
+  if (i < xh->nbuf)
+    {
+      h ^= (uint64_t) xh->buf[i] * PROFILLIC_XXH_P1;
+      h  = PROFILLIC_XXH_ROTL(h, 23) * PROFILLIC_XXH_P2 + PROFILLIC_XXH_P3;
+    }
+
+  h ^= h >> 33;  h *= PROFILLIC_XXH_P2;
+  h ^= h >> 29;  h *= PROFILLIC_XXH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_p7_hmm_Fingerprint()
+ * Synopsis:  64-bit content hash of a model's parameters.
+ *
+ * Purpose:   Hash <hmm>'s alphabet type, length <M>, and every
+ *            transition, match emission, and insert emission
+ *            parameter, nodes <0..M>, and return the hash in <*ret_fp>.
+ *            Two models with bit-identical parameters have the same
+ *            fingerprint on any platform, whatever their names,
+ *            annotation, or calibration; so it identifies a model for
+ *            caching and deduplication without comparing HMM files.
+ *
+ * Returns:   <eslOK> on success.
+ * </pre>
+ */
+static int
+profillic_p7_hmm_Fingerprint(const P7_HMM *hmm, uint64_t *ret_fp)
+{
+  PROFILLIC_XXH64 xh;
+  uint32_t        hdr[3];
+  int             k;
+
+  hdr[0] = (uint32_t) hmm->abc->type;
+  hdr[1] = (uint32_t) hmm->abc->K;
+  hdr[2] = (uint32_t) hmm->M;
+
+  profillic_xxh64_Init(&xh, 0);
+  profillic_xxh64_UpdateWords(&xh, hdr, 3);
+  for (k = 0; k <= hmm->M; k++)
+    {
+      profillic_xxh64_UpdateFloats(&xh, hmm->t[k],   p7H_NTRANSITIONS);
+      profillic_xxh64_UpdateFloats(&xh, hmm->mat[k], hmm->abc->K);
+      profillic_xxh64_UpdateFloats(&xh, hmm->ins[k], hmm->abc->K);
+    }
+  *ret_fp = profillic_xxh64_Digest(&xh);
+  return eslOK;
+}
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICP7HMM_HPP__
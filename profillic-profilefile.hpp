@@ -0,0 +1,333 @@
+/**
+ * \file profillic-profilefile.hpp
+ * \brief
+ * Binary galosh profile container (for profillic profiles)
+ * \details
+ * <pre>
+ * Table of contents:
+ *     1. The binary profile layout.
+ *     2. Writing a binary profile.
+ *     3. Parsing a binary profile held in memory.
+ *
+ * A binary profile record is laid out so that it can be used
+ * straight out of an mmap'ed file; all fields are in the byte order
+ * of the writing host, which the <byteorder> word lets readers
+ * detect (byte-swapped records are read correctly, just not in
+ * place). Records may be concatenated, like text profiles.
+ *
+ *   offset        size           field
+ *   0             8              magic "GLSHPRFB"
+ *   8             4              byteorder, 0x01020304 as written
+ *   12            4              format version (1)
+ *   16            4              K, residues per distribution
+ *   20            4              M, profile length (positions)
+ *   24            4              number of metadata key/value pairs
+ *   28            4              metadata block size in bytes (multiple of 8)
+ *   32            32             residue characters, in the profile's order, NUL-padded
+ *   64            (metadata)     nmeta "key\0value\0" pairs, zero-padded
+ *   ...           16 floats      transitions: M->M,I,D; I->M,I; D->M,D; N->N,B; B->M,D; C->C,T; 3 pad
+ *   ...           K floats       insertion emissions
+ *   ...           M*K floats     match emissions, position by position
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICPROFILEFILE_HPP__
+#define __GALOSH_PROFILLICPROFILEFILE_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+extern "C" {
+#include "easel.h"
+}
+
+#include "profillic-hmmer.hpp"
+
+/*****************************************************************
+ *# 1. The binary profile layout.
+ *****************************************************************/
+
+#define PROFILLIC_PROFILEB_MAGIC      "GLSHPRFB"
+#define PROFILLIC_PROFILEB_MAGICLEN   8
+#define PROFILLIC_PROFILEB_BYTEORDER  0x01020304u
+#define PROFILLIC_PROFILEB_VERSION    1
+#define PROFILLIC_PROFILEB_HDRSIZE    64
+#define PROFILLIC_PROFILEB_MAXK       32
+#define PROFILLIC_PROFILEB_NTRANS     16  /* 13 used, padded to keep the arrays 8-byte aligned */
+
+/* The transitions, in file order, as (from, to) state pairs. */
+static const char profillic_profileb_trans[][2] = {
+  { 'M', 'M' }, { 'M', 'I' }, { 'M', 'D' },
+  { 'I', 'M' }, { 'I', 'I' },
+  { 'D', 'M' }, { 'D', 'D' },
+  { 'N', 'N' }, { 'N', 'B' },
+  { 'B', 'M' }, { 'B', 'D' },
+  { 'C', 'C' }, { 'C', 'T' }
+};
+#define PROFILLIC_PROFILEB_NUSED  (sizeof(profillic_profileb_trans) / sizeof(profillic_profileb_trans[0]))
+
+/**
+ * PROFILLIC_PROFILEB_HDR
+ *
+ * Decoded fixed-size header of one binary profile record.
+ */
+typedef struct {
+  int       swap;		/**< TRUE if record was written with the other byte order */
+  uint32_t  version;
+  uint32_t  K;
+  uint32_t  M;
+  uint32_t  nmeta;
+  uint32_t  metalen;
+  char      alphabet[PROFILLIC_PROFILEB_MAXK+1];
+  esl_pos_t size;		/**< total bytes in the record, header included */
+} PROFILLIC_PROFILEB_HDR;
+
+static inline uint32_t
+profillic_profileb_u32(const char *p, int swap)
+{
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  if (swap) x = ((x >> 24) & 0xff) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+  return x;
+}
+
+static inline float
+profillic_profileb_float(const char *p, int swap)
+{
+  uint32_t u = profillic_profileb_u32(p, swap);
+  float    x;
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profilefile_IsBinary()
+ * Synopsis:  Does memory start with a binary profile record?
+ * </pre>
+ */
+static inline int
+profillic_profilefile_IsBinary(const char *p, esl_pos_t n)
+{
+  return (n >= PROFILLIC_PROFILEB_MAGICLEN && memcmp(p, PROFILLIC_PROFILEB_MAGIC, PROFILLIC_PROFILEB_MAGICLEN) == 0);
+}
+
+/**
+ * <pre>
+ * Function:  profillic_profilefile_ReadHeader()
+ * Synopsis:  Decode and check a binary profile record header.
+ *
+ * Purpose:   Decode the <PROFILLIC_PROFILEB_HDRSIZE> bytes at <p> into
+ *            <hdr>, checking the magic, byte order and version, and
+ *            computing the full record size in <hdr->size>.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEFORMAT> if the header is bad; <errbuf> is set.
+ * </pre>
+ */
+static int
+profillic_profilefile_ReadHeader(const char *p, esl_pos_t n, PROFILLIC_PROFILEB_HDR *hdr, char *errbuf)
+{
+  uint32_t order;
+
+  if (n < PROFILLIC_PROFILEB_HDRSIZE || ! profillic_profilefile_IsBinary(p, n)) ESL_FAIL(eslEFORMAT, errbuf, "not a binary galosh profile record");
+
+  order = profillic_profileb_u32(p+8, FALSE);
+  if      (order == PROFILLIC_PROFILEB_BYTEORDER) hdr->swap = FALSE;
+  else if (order == 0x04030201u)                  hdr->swap = TRUE;
+  else ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile has a bad byte order word");
+
+  hdr->version = profillic_profileb_u32(p+12, hdr->swap);
+  hdr->K       = profillic_profileb_u32(p+16, hdr->swap);
+  hdr->M       = profillic_profileb_u32(p+20, hdr->swap);
+  hdr->nmeta   = profillic_profileb_u32(p+24, hdr->swap);
+  hdr->metalen = profillic_profileb_u32(p+28, hdr->swap);
+  if (hdr->version != PROFILLIC_PROFILEB_VERSION)                ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile is format version %u; this program reads version %d", hdr->version, PROFILLIC_PROFILEB_VERSION);
+  if (hdr->K == 0 || hdr->K > PROFILLIC_PROFILEB_MAXK)           ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile has a bad alphabet size %u", hdr->K);
+  if (hdr->metalen % 8 != 0)                                     ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile has a misaligned metadata block");
+  memcpy(hdr->alphabet, p+32, PROFILLIC_PROFILEB_MAXK);
+  hdr->alphabet[PROFILLIC_PROFILEB_MAXK] = '\0';
+  if (strlen(hdr->alphabet) != hdr->K)                           ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile residue string doesn't match its alphabet size");
+
+  hdr->size = (esl_pos_t) PROFILLIC_PROFILEB_HDRSIZE + hdr->metalen
+            + (esl_pos_t) sizeof(float) * (PROFILLIC_PROFILEB_NTRANS + hdr->K + (esl_pos_t) hdr->M * hdr->K);
+  return eslOK;
+}
+
+/*****************************************************************
+ *# 2. Writing a binary profile.
+ *****************************************************************/
+
+/**
+ * <pre>
+ * Function:  profillic_profilefile_WriteBinary()
+ * Synopsis:  Write a galosh profile as one binary record.
+ *
+ * Purpose:   Write <profile> to open stream <fp> as a binary profile
+ *            record, with <nmeta> key/value pairs <keys>, <vals> of
+ *            metadata (e.g. "name"). Values that are <NULL> are
+ *            skipped.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEWRITE> on a write failure.
+ *            <eslEINVAL> if the profile's alphabet is too big.
+ * </pre>
+ */
+template <typename ProfileType>
+static int
+profillic_profilefile_WriteBinary(FILE *fp, ProfileType const & profile, int nmeta, const char **keys, const char **vals)
+{
+  typedef typename galosh::profile_traits<ProfileType>::ResidueType ResidueType;
+
+  static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  const uint32_t    K        = seqan::ValueSize<ResidueType>::VALUE;
+  const uint32_t    M        = profile.length();
+  uint32_t          hdr[6];
+  char              alphabet[PROFILLIC_PROFILEB_MAXK];
+  float             trans[PROFILLIC_PROFILEB_NTRANS];
+  float             row[PROFILLIC_PROFILEB_MAXK];
+  uint32_t          nkept    = 0;
+  uint32_t          metalen  = 0;
+  uint32_t          pos_i;
+  uint32_t          res_i;
+  int               i;
+
+  if (K > PROFILLIC_PROFILEB_MAXK) ESL_EXCEPTION(eslEINVAL, "alphabet too big for a binary galosh profile");
+
+  for (i = 0; i < nmeta; i++)
+    if (vals[i] != NULL) { nkept++; metalen += strlen(keys[i]) + strlen(vals[i]) + 2; }
+  metalen = (metalen + 7) & ~7u;
+
+  hdr[0] = PROFILLIC_PROFILEB_BYTEORDER;
+  hdr[1] = PROFILLIC_PROFILEB_VERSION;
+  hdr[2] = K;
+  hdr[3] = M;
+  hdr[4] = nkept;
+  hdr[5] = metalen;
+  memset(alphabet, 0, sizeof(alphabet));
+  for (res_i = 0; res_i < K; res_i++) alphabet[res_i] = static_cast<char>( ResidueType( res_i ) );
+
+  if (fwrite(PROFILLIC_PROFILEB_MAGIC, 1, PROFILLIC_PROFILEB_MAGICLEN, fp) != PROFILLIC_PROFILEB_MAGICLEN) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+  if (fwrite(hdr,      sizeof(uint32_t), 6, fp) != 6)                                                       ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+  if (fwrite(alphabet, 1, sizeof(alphabet), fp) != sizeof(alphabet))                                        ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+
+  for (i = 0; i < nmeta; i++)
+    if (vals[i] != NULL) {
+      if (fwrite(keys[i], 1, strlen(keys[i]) + 1, fp) != strlen(keys[i]) + 1) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+      if (fwrite(vals[i], 1, strlen(vals[i]) + 1, fp) != strlen(vals[i]) + 1) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+      metalen -= strlen(keys[i]) + strlen(vals[i]) + 2;
+    }
+  if (metalen && fwrite(zeros, 1, metalen, fp) != metalen) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+
+  memset(trans, 0, sizeof(trans));
+  trans[0]  = toDouble( profile[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toMatch ] );
+  trans[1]  = toDouble( profile[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toInsertion ] );
+  trans[2]  = toDouble( profile[ galosh::Transition::fromMatch ][ galosh::TransitionFromMatch::toDeletion ] );
+  trans[3]  = toDouble( profile[ galosh::Transition::fromInsertion ][ galosh::TransitionFromInsertion::toMatch ] );
+  trans[4]  = toDouble( profile[ galosh::Transition::fromInsertion ][ galosh::TransitionFromInsertion::toInsertion ] );
+  trans[5]  = toDouble( profile[ galosh::Transition::fromDeletion ][ galosh::TransitionFromDeletion::toMatch ] );
+  trans[6]  = toDouble( profile[ galosh::Transition::fromDeletion ][ galosh::TransitionFromDeletion::toDeletion ] );
+  trans[7]  = toDouble( profile[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toPreAlign ] );
+  trans[8]  = toDouble( profile[ galosh::Transition::fromPreAlign ][ galosh::TransitionFromPreAlign::toBegin ] );
+  trans[9]  = toDouble( profile[ galosh::Transition::fromBegin ][ galosh::TransitionFromBegin::toMatch ] );
+  trans[10] = toDouble( profile[ galosh::Transition::fromBegin ][ galosh::TransitionFromBegin::toDeletion ] );
+  trans[11] = toDouble( profile[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toPostAlign ] );
+  trans[12] = toDouble( profile[ galosh::Transition::fromPostAlign ][ galosh::TransitionFromPostAlign::toTerminal ] );
+  if (fwrite(trans, sizeof(float), PROFILLIC_PROFILEB_NTRANS, fp) != PROFILLIC_PROFILEB_NTRANS) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+
+  for (res_i = 0; res_i < K; res_i++) row[res_i] = toDouble( profile[ galosh::Emission::Insertion ][ res_i ] );
+  if (fwrite(row, sizeof(float), K, fp) != K) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+
+  for (pos_i = 0; pos_i < M; pos_i++) {
+    for (res_i = 0; res_i < K; res_i++) row[res_i] = toDouble( profile[ pos_i ][ galosh::Emission::Match ][ res_i ] );
+    if (fwrite(row, sizeof(float), K, fp) != K) ESL_EXCEPTION_SYS(eslEWRITE, "binary profile write failed");
+  }
+  return eslOK;
+}
+
+/*****************************************************************
+ *# 3. Parsing a binary profile held in memory.
+ *****************************************************************/
+
+/**
+ * <pre>
+ * Function:  profillic_profilefile_ParseBinary()
+ * Synopsis:  Deliver one in-memory binary profile record to a sink.
+ *
+ * Purpose:   Parse the binary profile record at <p> (<n> bytes, at
+ *            least <hdr->size>; <hdr> from
+ *            <profillic_profilefile_ReadHeader()>) into <sink>, the
+ *            same sink interface <profillic_profile_ParseRecord()>
+ *            uses for text: <Begin(M)>, <Match(pos, residue, x)>,
+ *            <Insertion(residue, x)>, <Transition(from, to, x)>,
+ *            <End()>. The sink must also provide <Alphabet(K, sym)>,
+ *            which is asked first whether the record's residues are
+ *            the ones it reads; a DNA profile read as amino acids is
+ *            rejected there, before anything is delivered.
+ *
+ *            If the metadata has a "name" and <ret_name> is non-NULL
+ *            and <*ret_name> is NULL, a copy is returned there;
+ *            caller frees.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEFORMAT> if the record is truncated, or the sink
+ *            rejects its alphabet or a residue; <errbuf> is set.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ * </pre>
+ */
+template <typename Sink>
+static int
+profillic_profilefile_ParseBinary(const char *p, esl_pos_t n, const PROFILLIC_PROFILEB_HDR *hdr, Sink &sink, char **ret_name, char *errbuf)
+{
+  const char *meta = p + PROFILLIC_PROFILEB_HDRSIZE;
+  const char *mend = meta + hdr->metalen;
+  const char *q;
+  const char *val;
+  uint32_t    i;
+  uint32_t    pos_i;
+  uint32_t    res_i;
+  int         status;
+
+  if (n < hdr->size) ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile record is truncated");
+
+  for (q = meta, i = 0; i < hdr->nmeta; i++)
+    {
+      if ((val = static_cast<const char *>( memchr(q,   '\0', mend - q) )) == NULL) ESL_FAIL(eslEFORMAT, errbuf, "bad binary galosh profile metadata");
+      val++;
+      if (memchr(val, '\0', mend - val) == NULL)                                    ESL_FAIL(eslEFORMAT, errbuf, "bad binary galosh profile metadata");
+      if (ret_name != NULL && *ret_name == NULL && strcmp(q, "name") == 0 && (status = esl_strdup(val, -1, ret_name)) != eslOK) return status;
+      q = val + strlen(val) + 1;
+    }
+
+  if (sink.Alphabet(hdr->K, hdr->alphabet) != eslOK)
+    ESL_FAIL(eslEFORMAT, errbuf, "binary galosh profile's alphabet (%s) isn't the one being read", hdr->alphabet);
+  if ((status = sink.Begin(hdr->M)) != eslOK) return status;
+
+  q = mend;
+  for (i = 0; i < PROFILLIC_PROFILEB_NUSED; i++)
+    if (sink.Transition(profillic_profileb_trans[i][0], profillic_profileb_trans[i][1], profillic_profileb_float(q + i*sizeof(float), hdr->swap)) != eslOK)
+      ESL_FAIL(eslEFORMAT, errbuf, "unrecognized transition %c->%c", profillic_profileb_trans[i][0], profillic_profileb_trans[i][1]);
+  q += PROFILLIC_PROFILEB_NTRANS * sizeof(float);
+
+  for (res_i = 0; res_i < hdr->K; res_i++, q += sizeof(float))
+    if (sink.Insertion(hdr->alphabet[res_i], profillic_profileb_float(q, hdr->swap)) != eslOK)
+      ESL_FAIL(eslEFORMAT, errbuf, "residue '%c' in binary galosh profile isn't in the alphabet", hdr->alphabet[res_i]);
+
+  for (pos_i = 0; pos_i < hdr->M; pos_i++)
+    for (res_i = 0; res_i < hdr->K; res_i++, q += sizeof(float))
+      if (sink.Match(pos_i, hdr->alphabet[res_i], profillic_profileb_float(q, hdr->swap)) != eslOK)
+        ESL_FAIL(eslEFORMAT, errbuf, "residue '%c' in binary galosh profile isn't in the alphabet", hdr->alphabet[res_i]);
+
+  return sink.End();
+}
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICPROFILEFILE_HPP__
@@ -0,0 +1,81 @@
+/**
+ * \file profillic-residuemap.hpp
+ * \brief
+ * Mapping galosh (seqan) residue indices to H3 digital residues (for profillic)
+ * \details
+ * <pre>
+ * The model maker and its inverse walk every position of a profile,
+ * and used to digitize each seqan residue's character over again at
+ * every position. A profillic_residuemap_s is made once per model
+ * instead; its size is a compile-time constant, so the per-position
+ * loops over it have a fixed trip count.
+ * </pre>
+ */
+#ifndef __GALOSH_PROFILLICRESIDUEMAP_HPP__
+#define __GALOSH_PROFILLICRESIDUEMAP_HPP__
+
+extern "C" {
+#include "p7_config.h"
+}
+
+#include <assert.h>
+
+extern "C" {
+#include "easel.h"
+#include "esl_alphabet.h"
+}
+
+#include "profillic-hmmer.hpp"
+#include <seqan/basic.h>
+
+/**
+ * profillic_residuemap_s
+ *
+ * <(*this)[res_i]> is the digital code, in <abc>, of the seqan
+ * residue <ResidueType(res_i)>; <K> is the size of the seqan
+ * alphabet. The general case digitizes each residue's character
+ * once, when the map is made.
+ */
+template <typename ResidueType>
+struct profillic_residuemap_s
+{
+  enum { K = seqan::ValueSize<ResidueType>::VALUE };
+
+  ESL_DSQ dsq[ K ];
+
+  explicit profillic_residuemap_s( const ESL_ALPHABET * abc )
+  {
+    for( uint32_t res_i = 0; res_i < K; res_i++ ) {
+      dsq[ res_i ] = esl_abc_DigitizeSymbol( abc, static_cast<char>( ResidueType( res_i ) ) );
+    }
+  }
+
+  ESL_DSQ operator[] ( uint32_t res_i ) const { return dsq[ res_i ]; }
+};
+
+/**
+ * profillic_residuemap_s<seqan::Dna>
+ *
+ * seqan's Dna is ordered ACGT, as are easel's DNA (ACGT) and RNA
+ * (ACGU) alphabets, so the map is the identity and needs no table.
+ */
+template <>
+struct profillic_residuemap_s<seqan::Dna>
+{
+  enum { K = 4 };
+
+  explicit profillic_residuemap_s( const ESL_ALPHABET * abc )
+  {
+    assert( abc->type == eslDNA || abc->type == eslRNA );
+  }
+
+  ESL_DSQ operator[] ( uint32_t res_i ) const { return static_cast<ESL_DSQ>( res_i ); }
+};
+
+/**
+ * \par Licence:
+ *****************************************************************
+ * @LICENSE@
+ *****************************************************************/
+
+#endif // __GALOSH_PROFILLICRESIDUEMAP_HPP__